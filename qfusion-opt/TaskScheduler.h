@@ -0,0 +1,175 @@
+// TaskScheduler.h
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Work-stealing scheduler. Every worker owns a deque: it pushes and pops its
+ * own tasks at the back and steals from the front of the others. Threads that
+ * are not workers (main) share one more deque. A thread waiting for a
+ * TaskGroup runs queued tasks instead of blocking, so tasks may wait for the
+ * tasks they spawn and the thread calling wait() counts as one of the
+ * threads: TaskScheduler(1) has no worker and runs every task in wait(). */
+class TaskScheduler {
+  public:
+    class TaskGroup;
+
+    explicit TaskScheduler(size_t threads);
+    ~TaskScheduler();
+    size_t size() const { return workers.size() + 1; }
+
+  private:
+    struct Task {
+        std::function<void()> func;
+        TaskGroup *group;
+    };
+    struct Deque {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Deque>> deques; // the last one is shared
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued = 0;
+    std::atomic<bool> stop = false;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+
+    static inline thread_local const TaskScheduler *tScheduler = nullptr;
+    static inline thread_local size_t tDeque = 0;
+
+    size_t self() const {
+        return tScheduler == this ? tDeque : deques.size() - 1;
+    }
+    void push(Task task);
+    bool runOne();
+};
+
+/* Tasks whose completion is waited for together. After cancel() the queued
+ * tasks are dropped, running tasks may poll cancelled() to stop early. The
+ * first exception thrown by a task is rethrown by wait(). */
+class TaskScheduler::TaskGroup {
+  public:
+    explicit TaskGroup(TaskScheduler &scheduler) : scheduler(scheduler) {}
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+    ~TaskGroup() { join(); }
+
+    template <class F> void run(F &&f) {
+        if (cancelled())
+            return;
+        pending++;
+        scheduler.push({std::forward<F>(f), this});
+    }
+    void wait() {
+        join();
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+    void cancel() { isCancelled = true; }
+    bool cancelled() const {
+        return isCancelled.load(std::memory_order_relaxed);
+    }
+
+  private:
+    friend class TaskScheduler;
+    TaskScheduler &scheduler;
+    std::atomic<size_t> pending = 0;
+    std::atomic<bool> isCancelled = false;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    template <class F> void execute(F &f) {
+        if (cancelled())
+            return;
+        try {
+            f();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+            cancel();
+        }
+    }
+    void join() {
+        while (pending.load(std::memory_order_acquire))
+            if (!scheduler.runOne())
+                std::this_thread::yield();
+    }
+};
+
+inline TaskScheduler::TaskScheduler(size_t threads) {
+    if (threads == 0)
+        threads = 1;
+    for (size_t i = 0; i < threads; ++i)
+        deques.push_back(std::make_unique<Deque>());
+    for (size_t i = 0; i + 1 < threads; ++i)
+        workers.emplace_back([this, i] {
+            tScheduler = this;
+            tDeque = i;
+            while (!stop) {
+                if (runOne())
+                    continue;
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wakeUp.wait(lock, [this] { return stop || queued > 0; });
+            }
+        });
+}
+
+inline TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+inline void TaskScheduler::push(Task task) {
+    {
+        Deque &deque = *deques[self()];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(std::move(task));
+    }
+    queued++;
+    // taking the lock orders this with a worker checking queued before sleep
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeUp.notify_one();
+}
+
+// Run one task, newest of our own deque first, else the oldest of another.
+inline bool TaskScheduler::runOne() {
+    if (!queued.load(std::memory_order_relaxed))
+        return false;
+    size_t me = self();
+    Task task;
+    bool found = false;
+    for (size_t k = 0; k < deques.size() && !found; ++k) {
+        Deque &deque = *deques[(me + k) % deques.size()];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (deque.tasks.empty())
+            continue;
+        if (k == 0) {
+            task = std::move(deque.tasks.back());
+            deque.tasks.pop_back();
+        } else {
+            task = std::move(deque.tasks.front());
+            deque.tasks.pop_front();
+        }
+        found = true;
+    }
+    if (!found)
+        return false;
+    queued--;
+    task.group->execute(task.func);
+    task.group->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
@@ -1,23 +1,27 @@
-#include "ThreadPool.h"
+#include "TaskScheduler.h"
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <cfloat>
 #include <chrono>
 #include <cmath>
 #include <complex>
+#include <cstdint>
 #include <fstream>
-#include <future>
 #include <iomanip>
 #include <iostream>
-#include <map>
-#include <mutex>
+#include <limits>
+#include <numeric>
 #include <ostream>
 #include <queue>
 #include <random>
 #include <set>
+#include <span>
 #include <sstream>
 #include <string>
-#include <unordered_set>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #define DEBUG_getSmallWeight 0
@@ -28,34 +32,90 @@
             y                                                                  \
     } while (0)
 
-using gate_size_t = unsigned short;  // 65535 gates
-using qubit_size_t = unsigned short; // 65535 qubits
+// Width of gate indexes: make GATE_INDEX_BITS=16 halves the index arrays of
+// circuits (or streaming windows) below 65536 gates, 64 lifts every limit.
+#ifndef GATE_INDEX_BITS
+#define GATE_INDEX_BITS 32
+#endif
+static_assert(GATE_INDEX_BITS == 16 || GATE_INDEX_BITS == 32 ||
+                  GATE_INDEX_BITS == 64,
+              "GATE_INDEX_BITS should be 16, 32 or 64");
+using gate_size_t =
+    std::conditional_t<GATE_INDEX_BITS == 16, uint16_t,
+                       std::conditional_t<GATE_INDEX_BITS == 32, uint32_t,
+                                          uint64_t>>;
+// members of all fusion gates and params, a few times the number of gates
+using member_size_t =
+    std::conditional_t<GATE_INDEX_BITS == 16, uint32_t, uint64_t>;
+using qubit_size_t = unsigned short; // at most kMaxQubits
+using qubit_mask_t = uint64_t;       // bit q is qubit q
+constexpr qubit_size_t kMaxQubits = 64;
+
+// Gate opcodes. D and U are fused diagonal / unitary gates, their size comes
+// from the name (e.g. D3) or the number of fused qubits.
+enum class Op : uint8_t { H, X, Y, Z, RX, RY, RZ, U1, CX, CZ, CP, RZZ, D, U };
+
+struct OpInfo {
+    const char *name;
+    qubit_size_t numQubits; // 0: given by the name
+    qubit_size_t numParams; // minimum; D needs 2 * 2^n
+    bool diagonal;
+};
+
+constexpr OpInfo kOpTable[] = {
+    {"H", 1, 0, false},  {"X", 1, 0, false},   {"Y", 1, 0, false},
+    {"Z", 1, 0, true},   {"RX", 1, 1, false},  {"RY", 1, 1, false},
+    {"RZ", 1, 1, true},  {"U1", 1, 3, false},  {"CX", 2, 0, false},
+    {"CZ", 2, 0, true},  {"CP", 2, 1, true},   {"RZZ", 2, 1, true},
+    {"D", 0, 0, true},   {"U", 0, 0, false}};
+
+constexpr const OpInfo &opInfo(Op op) { return kOpTable[size_t(op)]; }
+
+/* Row of the cost table: one per fixed opcode, then D1, U1, D2, U2, ...
+ * A fused 1-qubit unitary is named U1 as well, so it shares the U1 row. */
+constexpr size_t costKey(Op op, qubit_size_t numQubits) {
+    if (op < Op::D)
+        return size_t(op);
+    if (op == Op::U && numQubits == 1)
+        return size_t(Op::U1);
+    return size_t(Op::D) + 2 * (numQubits - 1) + (op == Op::U);
+}
+
+/* Parse a gate name such as "CX" or "D3"; false if unknown */
+bool parseOpName(const std::string &name, Op &op, qubit_size_t &numQubits) {
+    for (size_t i = 0; i < size_t(Op::D); ++i) {
+        if (name == kOpTable[i].name) {
+            op = Op(i);
+            numQubits = kOpTable[i].numQubits;
+            return true;
+        }
+    }
+    if (name.size() < 2 || (name[0] != 'D' && name[0] != 'U') ||
+        !std::all_of(name.begin() + 1, name.end(), ::isdigit))
+        return false;
+    op = name[0] == 'D' ? Op::D : Op::U;
+    numQubits = std::stoi(name.substr(1));
+    return numQubits >= 1 && numQubits <= kMaxQubits;
+}
 
 // global variables
 qubit_size_t gMaxFusionSize;
 qubit_size_t gQubits;
-int gDFSCounter = 0, gSmallCircuitCounter = 0, gShortestPathCounter = 0,
-    gEarlyStopCounter = 0;
+std::atomic<int> gDFSCounter = 0, gSmallCircuitCounter = 0,
+                 gShortestPathCounter = 0, gEarlyStopCounter = 0;
 int gMethod = 0;
 double gCostFactor = 1.8;
-std::map<std::string, std::vector<double>> gGateTime; // dynamic cost
-// Global mutex to protect shared resources (e.g., smallWeight and
-// finalGateList)
-std::mutex gMutex;
-ThreadPool gPool(std::thread::hardware_concurrency());
-
-bool isDiagonalGate(const std::string &gateType) {
-    static const std::set<std::string> kDiagonalGates = {"S",  "Z",  "T",  "RZ",
-                                                         "CZ", "CP", "RZZ"};
-    if (gateType[0] == 'D') {
-        return true;
-    } else {
-        return kDiagonalGates.contains(gateType);
-    }
+// dynamic cost, indexed by costKey() and target qubit
+std::vector<std::vector<double>> gGateTime(costKey(Op::U, kMaxQubits) + 1);
+std::vector<double> gParams; // parameters of all circuit gates
+// FUSION_THREADS overrides the number of threads, e.g. for scaling runs
+size_t schedulerThreads() {
+    const char *threads = std::getenv("FUSION_THREADS");
+    return threads ? std::stoul(threads) : std::thread::hardware_concurrency();
 }
+TaskScheduler gScheduler(schedulerThreads());
 
-double cost(const std::string &gateType,
-            const std::set<qubit_size_t> &sortedQubits);
+double cost(size_t key, qubit_mask_t qubits);
 
 // gate size-index for fusion
 struct Finfo {
@@ -63,52 +123,23 @@ struct Finfo {
     gate_size_t fid;   // fusion gate index
 };
 
-int targetQubitCounter(const std::string &gateType) {
-    if (gateType == "H" || gateType == "X" || gateType == "RY" ||
-        gateType == "RX" || gateType == "U1" || gateType == "RZ" ||
-        gateType == "D1")
-        return 1;
-    else if (gateType == "CX" || gateType == "CP" || gateType == "CZ" ||
-             gateType == "RZZ" || gateType == "D2")
-        return 2;
-    else if (gateType == "D3")
-        return 3;
-    else if (gateType == "D4")
-        return 4;
-    else if (gateType == "D5")
-        return 5;
-    return 0;
-}
-
 class Gate {
   public:
-    std::string gateType;
-    std::vector<qubit_size_t> qubits;
-    std::set<qubit_size_t> sortedQubits;
-    std::vector<double> params; // non-qubit parameters
-
-    // for fusion
-    Finfo finfo;
-    std::vector<gate_size_t> gids; // index to the original circuit
-    std::vector<Gate> subGateList;
-
-    Gate(Finfo finfo) : finfo(finfo) {}
-    Gate(const std::string &gateType,
-         const std::set<qubit_size_t> &sortedQubits, Finfo finfo,
-         const std::vector<gate_size_t> &gids)
-        : gateType(gateType), sortedQubits(sortedQubits), finfo(finfo),
-          gids(gids) {}
-    Gate(Finfo finfo, const Gate &gate)
-        : gateType(gate.gateType), qubits(gate.qubits),
-          sortedQubits(gate.sortedQubits), params(gate.params), finfo(finfo),
-          gids(gate.gids) {}
-    Gate(const std::string &gateType,
-         const std::set<qubit_size_t> &sortedQubits,
-         const std::vector<Gate> &subGateList)
-        : gateType(gateType), qubits(sortedQubits.begin(), sortedQubits.end()),
-          sortedQubits(sortedQubits), subGateList(subGateList) {}
-    Gate(const std::string &line, gate_size_t gateIndex)
-        : finfo{1, gateIndex}, gids{gateIndex} {
+    Op op = Op::H;
+    qubit_size_t numQubits = 0;
+    qubit_size_t q[2] = {0, 0}; // qubits of 1- and 2-qubit gates, input order
+    qubit_mask_t mask = 0;      // all qubits
+    member_size_t param = 0;    // params are pool[param, param + numParams)
+    uint32_t numParams = 0;
+
+    Gate() = default;
+    // gate on the qubits of mask in ascending order
+    Gate(Op op, qubit_mask_t qubits)
+        : op(op), numQubits(std::popcount(qubits)), mask(qubits) {
+        for (int i = 0; i < 2 && qubits; ++i, qubits &= qubits - 1)
+            q[i] = std::countr_zero(qubits);
+    }
+    Gate(const std::string &line) {
         std::vector<std::string> gateInfo;
         size_t pos = 0;
         std::string token;
@@ -123,299 +154,385 @@ class Gate {
             gateInfo.push_back(tempLine);
         }
 
-        gateType = gateInfo[0];
-        int i = 1;
-        for (; i <= targetQubitCounter(gateType); ++i) {
-            qubits.push_back(stoi(gateInfo[i]));
+        if (gateInfo.empty() || !parseOpName(gateInfo[0], op, numQubits) ||
+            op == Op::U)
+            parseError(line, "gate doesn't support!");
+        if (gateInfo.size() <= numQubits)
+            parseError(line, "missing qubits");
+        size_t i = 1;
+        int prevQubit = -1;
+        for (; i <= numQubits; ++i) {
+            int qubit = stoi(gateInfo[i]);
+            if (qubit < 0 || qubit >= gQubits || (mask >> qubit & 1))
+                parseError(line, "bad qubit " + gateInfo[i]);
+            // wider gates keep their qubits in mask only
+            if (numQubits > 2 && qubit < prevQubit)
+                parseError(line, "qubits should be in ascending order");
+            if (i <= 2)
+                q[i - 1] = qubit;
+            mask |= qubit_mask_t(1) << qubit;
+            prevQubit = qubit;
         }
-        sortedQubits = std::set<qubit_size_t>(qubits.begin(), qubits.end());
+        param = gParams.size();
         for (; i < gateInfo.size(); ++i) {
-            params.push_back(stod(gateInfo[i]));
+            gParams.push_back(stod(gateInfo[i]));
         }
+        numParams = gParams.size() - param;
+        uint64_t minParams = op == Op::D ? uint64_t(2) << std::min(+numQubits, 62)
+                                         : opInfo(op).numParams;
+        if (numParams < minParams)
+            parseError(line, "missing parameters");
     }
 
-    std::string str() const {
+    bool isDiagonal() const { return opInfo(op).diagonal; }
+    size_t costKey() const { return ::costKey(op, numQubits); }
+    const double *params(const std::vector<double> &pool = gParams) const {
+        return pool.data() + param;
+    }
+
+    std::string name() const {
+        if (op == Op::D || op == Op::U)
+            return opInfo(op).name + std::to_string(numQubits);
+        return opInfo(op).name;
+    }
+
+    std::vector<qubit_size_t> qubits() const {
+        if (numQubits <= 2)
+            return std::vector<qubit_size_t>(q, q + numQubits);
+        std::vector<qubit_size_t> res;
+        for (qubit_mask_t m = mask; m; m &= m - 1)
+            res.push_back(std::countr_zero(m));
+        return res;
+    }
+
+    std::string str(const std::vector<double> &pool = gParams) const {
         std::stringstream ss;
-        ss << gateType;
-        for (int qubit : qubits) {
+        ss << name();
+        for (int qubit : qubits()) {
             ss << " " << qubit;
         }
-        for (double param : params) {
-            ss << " " << std::fixed << std::setprecision(16) << param;
+        for (uint32_t i = 0; i < numParams; ++i) {
+            ss << " " << std::fixed << std::setprecision(16)
+               << params(pool)[i];
         }
         return ss.str();
     }
 
+  private:
+    [[noreturn]] static void parseError(const std::string &line,
+                                        const std::string &msg) {
+        std::cerr << "\"" << line << "\": " << msg << "\n";
+        exit(1);
+    }
+};
+
+double cost(const Gate &gate) { return cost(gate.costKey(), gate.mask); }
+
+// the scheduled circuit; fusion gates are index spans into it
+std::vector<Gate> gGates;
+// members of all fusion gates, as indexes into gGates
+std::vector<gate_size_t> gMembers;
+
+// Fusion candidate: the gates gGates[gMembers[first, first + count)], in the
+// order they are applied
+struct FusionGate {
+    Finfo finfo;
+    qubit_mask_t mask; // all qubits of the members
+    member_size_t first;
+    gate_size_t count;
+
+    std::span<const gate_size_t> members() const {
+        return {gMembers.data() + first, count};
+    }
+    const Gate &head() const { return gGates[gMembers[first]]; }
+
     void dump() const {
         // To dump only the current gate, use the command provided. To dump all
-        // gates, iterate through the gate.subGateList using a loop such as: for
-        // (const auto &subgate : gate.subGateList) { subgate.dump(); }.
+        // gates, iterate through the members using a loop such as: for
+        // (auto gid : gate.members()) { gGates[gid].str(); }.
         std::cout << finfo.size << "-" << finfo.fid;
-        std::cout << " (" << cost(gateType, sortedQubits) << ") ";
-        if (subGateList.empty())
-            return;
+        std::cout << " (" << cost(head()) << ") ";
         double sum_cost = 0;
-        for (const auto &subgate : subGateList) {
-            sum_cost += cost(subgate.gateType, subgate.sortedQubits);
+        for (auto gid : members()) {
+            sum_cost += cost(gGates[gid]);
         }
         std::cout << "sum_cost = " << sum_cost << "\n";
     }
 };
 
-using Matrix = std::vector<std::vector<std::complex<double>>>;
+using FusionGateList = std::vector<std::vector<FusionGate>>;
 
-void printMat(const Matrix &mat) {
-    for (const auto &row : mat) {
-        for (const auto &val : row) {
-            std::cout << /*std::setw(10) << "(" << */ val.real() << "+"
-                      << val.imag() << "i, ";
-        }
-        std::cout << std::endl;
+using complex_t = std::complex<double>;
+
+/* Allocator of cache-line aligned storage, so rows of a Matrix line up with
+ * the vector registers */
+template <typename T> struct AlignedAllocator {
+    using value_type = T;
+    static constexpr std::align_val_t kAlignment{64};
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+    T *allocate(size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), kAlignment));
     }
-    std::cout << std::endl;
+    void deallocate(T *p, size_t) { ::operator delete(p, kAlignment); }
+    template <typename U> bool operator==(const AlignedAllocator<U> &) const {
+        return true;
+    }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+// a * b without the inf/nan recovery of operator*, which keeps loops vectorized
+inline complex_t cmul(complex_t a, complex_t b) {
+    return {a.real() * b.real() - a.imag() * b.imag(),
+            a.real() * b.imag() + a.imag() * b.real()};
 }
 
-/* Return the matrix of two-qubit gate */
-Matrix twoQubitsGateMat(const Gate &gate,
-                        const std::set<qubit_size_t> &fusedQubits) {
-    int sizeAfterExpand = pow(2, fusedQubits.size());
-    std::vector<int> reorderQubits;
-
-    for (auto i : gate.qubits) {
-        auto it = fusedQubits.find(i);
-        if (it != fusedQubits.end())
-            reorderQubits.push_back(std::distance(fusedQubits.begin(), it));
-    }
-    Matrix resMat(sizeAfterExpand,
-                  std::vector<std::complex<double>>(sizeAfterExpand,
-                                                    std::complex<double>()));
-    if (gate.gateType == "CX") {
-        for (int i = 0; i < sizeAfterExpand; i++)
-            resMat[i][i] = 1;
-        uint32_t controlBit = 1 << reorderQubits[0];
-        uint32_t targetBit = 1 << reorderQubits[1];
-        for (size_t i = 0; i < resMat.size(); i++) {
-            if (i & controlBit) {
-                resMat[i][i] = 0;
-                resMat[i][i ^ targetBit] = 1;
+// 2x2 matrix of a 1-qubit gate, row-major
+using Mat2 = std::array<complex_t, 4>;
+
+/* Row-major 2^n x 2^n matrix of a fused gate, bit k of a row or column index
+ * is the k-th lowest qubit of the fused gate. Gates are applied in place by
+ * multiplying from the left, O(4^n) each. */
+class Matrix {
+  public:
+    explicit Matrix(qubit_size_t numQubits)
+        : dim(size_t(1) << numQubits), elems(dim * dim) {
+        for (size_t i = 0; i < dim; ++i)
+            elems[i * dim + i] = 1;
+    }
+
+    size_t size() const { return dim; }
+    complex_t *operator[](size_t row) { return elems.data() + row * dim; }
+    const complex_t *operator[](size_t row) const {
+        return elems.data() + row * dim;
+    }
+
+    /* this = mat on bit t * this, mixes the rows pairs i, i | 1 << t */
+    void apply1(int t, const Mat2 &mat) {
+        const size_t bit = size_t(1) << t;
+        for (size_t i = 0; i < dim; ++i) {
+            if (i & bit)
+                continue;
+            complex_t *__restrict a = (*this)[i];
+            complex_t *__restrict b = (*this)[i | bit];
+            for (size_t c = 0; c < dim; ++c) {
+                complex_t x = a[c], y = b[c];
+                a[c] = cmul(mat[0], x) + cmul(mat[1], y);
+                b[c] = cmul(mat[2], x) + cmul(mat[3], y);
             }
         }
-    } else if (gate.gateType == "CP") {
-        for (int i = 0; i < sizeAfterExpand; i++)
-            resMat[i][i] = 1;
-        int higherQubit = std::max(reorderQubits[0], reorderQubits[1]);
-        int lowerQubit = std::min(reorderQubits[0], reorderQubits[1]);
-        uint32_t controlledBit = 1 << higherQubit;
-        uint32_t targetBit = 1 << lowerQubit;
-        uint32_t changeTarget = controlledBit | targetBit;
-        for (int i = 0; i < resMat.size(); i++) {
-            if ((i & changeTarget) == changeTarget)
-                resMat[i][i] = {cos(gate.params[0]), sin(gate.params[0])};
-        }
-    } else if (gate.gateType == "CZ") {
-        for (int i = 0; i < sizeAfterExpand; i++)
-            resMat[i][i] = 1;
-        int higherQubit = std::max(reorderQubits[0], reorderQubits[1]);
-        int lowerQubit = std::min(reorderQubits[0], reorderQubits[1]);
-        uint32_t controlledBit = 1 << higherQubit;
-        uint32_t targetBit = 1 << lowerQubit;
-        uint32_t changeTarget = controlledBit | targetBit;
-        for (int i = 0; i < resMat.size(); i++) {
-            if ((i & changeTarget) == changeTarget)
-                resMat[i][i] = -1;
+    }
+
+    /* this = CX * this, swaps the rows whose control bit is set */
+    void applyCX(int control, int target) {
+        const size_t controlBit = size_t(1) << control;
+        const size_t targetBit = size_t(1) << target;
+        for (size_t i = 0; i < dim; ++i) {
+            if ((i & controlBit) && !(i & targetBit))
+                std::swap_ranges((*this)[i], (*this)[i] + dim,
+                                 (*this)[i | targetBit]);
         }
-    } else if (gate.gateType == "RZZ") {
-        Matrix rzzTmp(4, std::vector<std::complex<double>>(4));
-        rzzTmp[0][0] = {cos(gate.params[0] / 2), -sin(gate.params[0] / 2)};
-        rzzTmp[1][1] = {cos(gate.params[0] / 2), sin(gate.params[0] / 2)};
-        rzzTmp[2][2] = rzzTmp[1][1];
-        rzzTmp[3][3] = rzzTmp[0][0];
-        uint32_t firstQubitMask = 1 << reorderQubits[0];
-        uint32_t secondQubitMask = 1 << reorderQubits[1];
-        for (int i = 0; i < resMat.size(); i++) {
-            uint32_t target =
-                ((i & secondQubitMask) >> (reorderQubits[1]) - 1) |
-                ((i & firstQubitMask) >> (reorderQubits[0]));
-            resMat[i][i] = rzzTmp[target][target];
+    }
+
+    /* this = diag(diag) * this, scales row i by diag[i] */
+    void applyDiagonal(const complex_t *diag) {
+        for (size_t i = 0; i < dim; ++i) {
+            complex_t *__restrict row = (*this)[i];
+            const complex_t d = diag[i];
+            for (size_t c = 0; c < dim; ++c)
+                row[c] = cmul(d, row[c]);
         }
-    } else if (gate.gateType[0] == 'D') {
-        int matSize = 1 << fusedQubits.size();
-        for (int i = 0; i < resMat.size(); i++)
-            resMat[i][i] = 1;
-        uint32_t targetMask = 0;
-
-        for (auto qubit : reorderQubits)
-            targetMask |= (1 << qubit);
-
-        for (int i = 0; i < resMat.size(); i++) {
-            uint32_t target = i & targetMask;
-            /* sortTarget is used while the gate.targetQubit would cross a
-             * qubit. For example, if gate.targetQubit = {0 ,2}, and the
-             * fusedQubits = {0, 1, 2}, the targetMask = 101b, which means it
-             * will get the first and third qubit. If i = 5 target = 5 & "101b",
-             * which is 5. But the original target should be "11b". So here is
-             * how we handle it.*/
-            uint32_t sortTarget = 0;
-            for (int idx = 0; idx < reorderQubits.size(); idx++)
-                sortTarget |= ((target >> reorderQubits[idx]) & 1) << idx;
-            std::complex<double> elem = {gate.params[sortTarget * 2],
-                                         gate.params[sortTarget * 2 + 1]};
-            resMat[i][i] = elem;
+    }
+
+  private:
+    size_t dim;
+    aligned_vector<complex_t> elems;
+};
+
+void printMat(const Matrix &mat) {
+    for (size_t i = 0; i < mat.size(); ++i) {
+        for (size_t j = 0; j < mat.size(); ++j) {
+            const complex_t &val = mat[i][j];
+            std::cout << /*std::setw(10) << "(" << */ val.real() << "+"
+                      << val.imag() << "i, ";
         }
+        std::cout << std::endl;
     }
-    return resMat;
+    std::cout << std::endl;
 }
 
-/* Return the matrix of input gate */
-Matrix gateMatrix(const std::string &gateType,
-                  const std::vector<double> &params) {
-    Matrix mat(2, std::vector<std::complex<double>>());
-    if (gateType == "X") {
-        mat[0].assign({{0, 0}, {1, 0}});
-        mat[1].assign({{1, 0}, {0, 0}});
-    } else if (gateType == "Y") {
-        mat[0].assign({{0, 0}, {0, -1}});
-        mat[1].assign({{0, 1}, {0, 0}});
-    } else if (gateType == "Z") {
-        mat[0].assign({{1, 0}, {0, 0}});
-        mat[1].assign({{0, 0}, {-1, 0}});
-    } else if (gateType == "H") {
-        mat[0].assign({{1 / sqrt(2), 0}, {1 / sqrt(2), 0}});
-        mat[1].assign({{1 / sqrt(2), 0}, {-1 / sqrt(2), 0}});
-    } else if (gateType == "RX") {
-        mat[0].assign({{cos(params[0] / 2), 0}, {0, -sin(params[0] / 2)}});
-        mat[1].assign({{0, -sin(params[0] / 2)}, {cos(params[0] / 2), 0}});
-    } else if (gateType == "RY") {
-        mat[0].assign({{cos(params[0] / 2), 0}, {-sin(params[0] / 2), 0}});
-        mat[1].assign({{sin(params[0] / 2), 0}, {cos(params[0] / 2), 0}});
-    } else if (gateType == "RZ") {
-        mat[0].assign({{cos(params[0] / 2), -sin(params[0] / 2)}, {0, 0}});
-        mat[1].assign({{0, 0}, {cos(params[0] / 2), sin(params[0] / 2)}});
-    } else if (gateType == "I2") {
-        mat[0].assign({{1, 0}, {0, 0}});
-        mat[1].assign({{0, 0}, {1, 0}});
-    } else if (gateType == "U1") {
+/* Return the matrix of a non-diagonal 1-qubit gate */
+Mat2 gateMatrix(Op op, const double *params) {
+    if (op == Op::X) {
+        return {{{0, 0}, {1, 0}, {1, 0}, {0, 0}}};
+    } else if (op == Op::Y) {
+        return {{{0, 0}, {0, -1}, {0, 1}, {0, 0}}};
+    } else if (op == Op::H) {
+        return {{{1 / sqrt(2), 0},
+                 {1 / sqrt(2), 0},
+                 {1 / sqrt(2), 0},
+                 {-1 / sqrt(2), 0}}};
+    } else if (op == Op::RX) {
+        return {{{cos(params[0] / 2), 0},
+                 {0, -sin(params[0] / 2)},
+                 {0, -sin(params[0] / 2)},
+                 {cos(params[0] / 2), 0}}};
+    } else if (op == Op::RY) {
+        return {{{cos(params[0] / 2), 0},
+                 {-sin(params[0] / 2), 0},
+                 {sin(params[0] / 2), 0},
+                 {cos(params[0] / 2), 0}}};
+    } else if (op == Op::U1) {
         double theta = params[0];
         double phi = params[1];
         double lamda = params[2];
-        mat[0].assign(
-            {{cos(theta / 2), 0},
-             {-sin(theta / 2) * cos(lamda), -sin(theta / 2) * sin(lamda)}});
-        mat[1].assign({{sin(theta / 2) * cos(phi), sin(theta / 2) * sin(phi)},
-                       {cos(theta / 2) * cos(phi + lamda),
-                        cos(theta / 2) * sin(phi + lamda)}});
-    } else {
-        std::cerr << gateType << " gate doesn't support!\n";
-        exit(1);
+        return {{{cos(theta / 2), 0},
+                 {-sin(theta / 2) * cos(lamda), -sin(theta / 2) * sin(lamda)},
+                 {sin(theta / 2) * cos(phi), sin(theta / 2) * sin(phi)},
+                 {cos(theta / 2) * cos(phi + lamda),
+                  cos(theta / 2) * sin(phi + lamda)}}};
     }
-    return mat;
+    std::cerr << opInfo(op).name << " gate doesn't support!\n";
+    exit(1);
 }
 
-Matrix tensorProduct(const Matrix &matA, const Matrix &matB) {
-    int resRow = matA.size() * matB.size();
-    int resCol = matA[0].size() * matB[0].size();
-    Matrix resMat(resRow, std::vector<std::complex<double>>(resCol, {0, 0}));
-
-    for (int rowA = 0; rowA < matA.size(); rowA++) {
-        for (int colA = 0; colA < matA[0].size(); colA++) {
-            std::complex<double> elemA = matA[rowA][colA];
-            for (int rowB = 0; rowB < matB.size(); rowB++) {
-                for (int colB = 0; colB < matB[0].size(); colB++) {
-                    std::complex<double> elemB = matB[rowB][colB];
-                    int newRow = rowA * matB.size() + rowB;
-                    int newCol = colA * matB[0].size() + colB;
-                    resMat[newRow][newCol] = elemA * elemB;
-                }
-            }
-        }
+/* Return the diagonal of a diagonal gate, bit k of its index is the k-th
+ * qubit of gate.qubits() */
+std::vector<complex_t> gateDiagonal(const Gate &gate) {
+    const double *params = gate.params();
+    if (gate.op == Op::Z) {
+        return {1, -1};
+    } else if (gate.op == Op::RZ) {
+        return {{cos(params[0] / 2), -sin(params[0] / 2)},
+                {cos(params[0] / 2), sin(params[0] / 2)}};
+    } else if (gate.op == Op::CZ) {
+        return {1, 1, 1, -1};
+    } else if (gate.op == Op::CP) {
+        return {1, 1, 1, {cos(params[0]), sin(params[0])}};
+    } else if (gate.op == Op::RZZ) {
+        complex_t even = {cos(params[0] / 2), -sin(params[0] / 2)};
+        complex_t odd = {cos(params[0] / 2), sin(params[0] / 2)};
+        return {even, odd, odd, even};
+    } else if (gate.op == Op::D) {
+        std::vector<complex_t> diag(size_t(1) << gate.numQubits);
+        for (size_t i = 0; i < diag.size(); ++i)
+            diag[i] = {params[i * 2], params[i * 2 + 1]};
+        return diag;
+    }
+    std::cerr << gate.name() << " gate isn't diagonal!\n";
+    exit(1);
+}
+
+// bit of qubit in the row index of a gate fused on fusedQubits
+inline int localQubit(qubit_size_t qubit, qubit_mask_t fusedQubits) {
+    return std::popcount(fusedQubits & ((qubit_mask_t(1) << qubit) - 1));
+}
+
+/* Multiply diag, the diagonal of a gate on fusedQubits, by the diagonal
+ * gate: O(2^n) */
+void multiplyDiagonal(const Gate &gate, qubit_mask_t fusedQubits,
+                      std::vector<complex_t> &diag) {
+    const std::vector<complex_t> gateDiag = gateDiagonal(gate);
+    std::vector<int> bits;
+    for (auto qubit : gate.qubits())
+        bits.push_back(localQubit(qubit, fusedQubits));
+    for (size_t i = 0; i < diag.size(); ++i) {
+        size_t index = 0;
+        for (size_t k = 0; k < bits.size(); ++k)
+            index |= (i >> bits[k] & 1) << k;
+        diag[i] = cmul(gateDiag[index], diag[i]);
     }
-    return resMat;
 }
 
-/* Expand the size of gate to specific size */
-Matrix gateExpansion(const Gate &targetGate,
-                     const std::set<qubit_size_t> &sortedQubits) {
-    Matrix resMat, rhsMat;
-    std::vector<std::string> expandedGateList;
-    /* If targetGate two-qubit gate like CX, CZ and CP, get the expanded matrix
-     * from twoQubitsGateMat().(Because they can't be simply expanded from
-     * tensor product.) */
-    if (targetGate.gateType[0] == 'C' || targetGate.gateType == "RZZ" ||
-        targetGate.gateType[0] == 'D')
-        return twoQubitsGateMat(targetGate, sortedQubits);
-
-    for (auto &qubit : sortedQubits) {
-        if (!targetGate.sortedQubits.contains(qubit))
-            expandedGateList.push_back("I2");
-        else
-            expandedGateList.push_back(targetGate.gateType);
-    }
-    /* Use tensor product to expand a gate. Notice that we have to calculate it
-     * from MSB to LSB */
-    for (int i = expandedGateList.size() - 1; i >= 0; i--) {
-        rhsMat = gateMatrix(expandedGateList[i], targetGate.params);
-        if (i == expandedGateList.size() - 1)
-            resMat = rhsMat;
-        else {
-            resMat = tensorProduct(resMat, rhsMat);
+/* Calculate the diagonal of a fusion of diagonal gates */
+std::vector<complex_t>
+calculateFusionDiagonal(std::span<const gate_size_t> subGateList,
+                        const std::vector<Gate> &gates,
+                        qubit_mask_t sortedQubits) {
+    std::vector<complex_t> diag(size_t(1) << std::popcount(sortedQubits), 1);
+    for (auto gid : subGateList)
+        multiplyDiagonal(gates[gid], sortedQubits, diag);
+    return diag;
+}
+
+/* Calculate the result matrix of gate fusion. The gates are applied to the
+ * identity in order, so the result of H, X, Y is Y * X * H. */
+Matrix calculateFusionGate(std::span<const gate_size_t> subGateList,
+                           const std::vector<Gate> &gates,
+                           qubit_mask_t sortedQubits) {
+    Matrix resGate(std::popcount(sortedQubits));
+    std::vector<complex_t> diag;
+    for (auto gid : subGateList) {
+        const Gate &gate = gates[gid];
+        if (gate.isDiagonal()) {
+            diag.assign(resGate.size(), 1);
+            multiplyDiagonal(gate, sortedQubits, diag);
+            resGate.applyDiagonal(diag.data());
+        } else if (gate.op == Op::CX) {
+            resGate.applyCX(localQubit(gate.q[0], sortedQubits),
+                            localQubit(gate.q[1], sortedQubits));
+        } else {
+            resGate.apply1(localQubit(gate.q[0], sortedQubits),
+                           gateMatrix(gate.op, gate.params()));
         }
     }
-    return resMat;
+    return resGate;
 }
 
-/* Implement the matrix multiplication */
-Matrix matrixMul(const Matrix &matA, const Matrix &matB) {
-    Matrix resMat(matA.size(),
-                  std::vector<std::complex<double>>(matB[0].size(), {0, 0}));
-    if (matA[0].size() != matB.size()) {
-        std::cerr << "The size of first matrix row is not equal to second "
-                     "matrix column, matA[0] = "
-                  << matA[0].size() << " ,matB.size = " << matB.size()
-                  << std::endl;
-        exit(1);
+/* Fuse gates[subGateList] into one D<n> (all diagonal) or U<n> gate on the
+ * union of their qubits; its params are appended to pool */
+Gate fuseGates(std::span<const gate_size_t> subGateList,
+               const std::vector<Gate> &gates, std::vector<double> &pool) {
+    qubit_mask_t sortedQubits = 0;
+    bool isDiagonal = true;
+    for (auto gid : subGateList) {
+        sortedQubits |= gates[gid].mask;
+        if (!gates[gid].isDiagonal())
+            isDiagonal = false;
     }
-    for (int i = 0; i < matA.size(); i++) {
-        for (int j = 0; j < matB[0].size(); j++) {
-            std::complex<double> tmp(0, 0);
-            for (int k = 0; k < matB.size(); k++) {
-                tmp += (matA[i][k] * matB[k][j]);
+    Gate fusedGate(isDiagonal ? Op::D : Op::U, sortedQubits);
+
+    fusedGate.param = pool.size();
+    if (isDiagonal) {
+        for (const auto elem :
+             calculateFusionDiagonal(subGateList, gates, sortedQubits)) {
+            pool.push_back(elem.real());
+            pool.push_back(elem.imag());
+        }
+    } else {
+        Matrix fusedGateMat =
+            calculateFusionGate(subGateList, gates, sortedQubits);
+        for (size_t matRow = 0; matRow < fusedGateMat.size(); matRow++) {
+            for (size_t matCol = 0; matCol < fusedGateMat.size(); matCol++) {
+                pool.push_back(fusedGateMat[matRow][matCol].real());
+                pool.push_back(fusedGateMat[matRow][matCol].imag());
             }
-            resMat[i][j] = tmp;
         }
     }
-    return resMat;
+    fusedGate.numParams = pool.size() - fusedGate.param;
+    return fusedGate;
 }
 
-/* Calculate the result matrix of gate fusion */
-Matrix calculateFusionGate(const std::vector<Gate> &subGateList,
-                           const std::set<qubit_size_t> &sortedQubits) {
-    Matrix resGate;
-    Matrix expandedGate;
-    /* We have to multiply these gates reversly. For example, if the subGateList
-     * is H, X, Y, we should reverse the multiplication, it would be Y * X * H.
-     */
-    for (int i = subGateList.size() - 1; i >= 0; i--) {
-        expandedGate = gateExpansion(subGateList[i], sortedQubits);
-        if (i == subGateList.size() - 1) {
-            resGate = expandedGate;
-            continue;
-        }
-        resGate = matrixMul(resGate, expandedGate);
-    }
-    return resGate;
+/* Output line of the fused gate, its params are not kept */
+std::string fusedGateStr(std::span<const gate_size_t> subGateList) {
+    std::vector<double> params;
+    return fuseGates(subGateList, gGates, params).str(params);
 }
 
-void showFusionGateList(const std::vector<std::vector<Gate>> &fusionGateList,
-                        const int start, const int end) {
+void showFusionGateList(const FusionGateList &fusionGateList, const int start,
+                        const int end) {
     std::cout << "showFusionGateList\n";
     for (int i = start - 1; i < end; ++i) {
         std::cout << "Number of fusion qubits: " << i + 1 << "\n";
         for (const auto &gate : fusionGateList[i]) {
             std::cout << std::string(40, '=') << "\n";
             gate.dump();
-            for (const auto &subgate : gate.subGateList) {
-                subgate.dump();
-                std::cout << subgate.str() << "\n";
+            for (auto gid : gate.members()) {
+                std::cout << gid << " (" << cost(gGates[gid]) << ") "
+                          << gGates[gid].str() << "\n";
             }
         }
         std::cout << "\n";
@@ -442,195 +559,332 @@ void showFinfoList(const std::vector<Finfo> &finfoList) {
     std::cout << "\n";
 }
 
-/* Check if the gate has dependency, scheduled gates are excluded */
-// note: dependencyList is needed to copy
-inline bool hasDependency(const std::set<int> &gateIndex,
-                          std::vector<std::set<int>> dependencyList,
-                          const std::set<int> &scheduledGates) {
+/* Check if the gates have dependency, excluded gates (e.g. scheduled gates or
+ * the gates themselves) are ignored */
+template <typename Indexes, typename Excluded>
+inline bool hasDependency(const Indexes &gateIndex,
+                          const std::vector<std::set<int>> &dependencyList,
+                          Excluded isExcluded) {
     for (int i : gateIndex) {
-        for (int gate : scheduledGates)
-            dependencyList[i].erase(gate);
-        if (!dependencyList[i].empty())
-            return true;
+        for (int gate : dependencyList[i])
+            if (!isExcluded(gate))
+                return true;
     }
     return false;
 }
 
-// note: fusionGateList and dependencyList is modedified and wrapper is
-// needed to copy
-void deleteRelatedNode(std::vector<std::vector<Gate>> &fusionGateList,
-                       std::vector<std::set<int>> &dependencyList,
-                       const Gate wrapper) {
-    // delete node in dependency list
-    for (const auto &subgate : wrapper.subGateList)
-        for (auto &dependencyList_i : dependencyList) {
-            dependencyList_i.erase(subgate.finfo.fid);
-        }
-
-    // delete node in fusionGate list
-    for (auto &fusionList_i : fusionGateList) {
-        for (size_t index = 0; index < fusionList_i.size(); ++index) {
-            int flag = 0;
-            for (const auto &subgate_i : fusionList_i[index].subGateList) {
-                for (const auto &subgate_j : wrapper.subGateList)
-                    if (subgate_i.finfo.fid == subgate_j.finfo.fid) {
-                        flag = 1;
-                        break;
-                    }
-                if (flag)
-                    break;
-            }
-            if (flag) {
-                fusionList_i.erase(fusionList_i.begin() + index);
-                index--;
-            }
-        }
-    }
-}
-
-/* Construct dependency gate set for each gate */
+/* Construct dependency gate set for each gate, indexed by fid(gate, position)
+ */
+template <typename GateType, typename Fid>
 inline std::vector<std::set<int>>
-constructDependencyList(const std::vector<Gate> &gates) {
+constructDependencyList(const std::vector<GateType> &gates, Fid fid) {
     std::vector<int> gateOnQubit(gQubits, -1); // record the last gate on qubit
-    unsigned short maxIndex = 0;
-    for (const auto &gate : gates)
-        maxIndex = std::max(maxIndex, gate.finfo.fid);
+    int maxIndex = 0;
+    for (size_t i = 0; i < gates.size(); ++i)
+        maxIndex = std::max(maxIndex, int(fid(gates[i], i)));
     std::vector<std::set<int>> dependencyList(maxIndex + 1);
-    for (const auto &gate : gates) {
-        for (int qubit : gate.sortedQubits) {
+    for (size_t i = 0; i < gates.size(); ++i) {
+        const int gid = fid(gates[i], i);
+        for (qubit_mask_t m = gates[i].mask; m; m &= m - 1) {
+            int qubit = std::countr_zero(m);
             if (gateOnQubit[qubit] != -1) // the first gate on qubit is ignored
-                dependencyList[gate.finfo.fid].insert(gateOnQubit[qubit]);
-            gateOnQubit[qubit] = gate.finfo.fid;
+                dependencyList[gid].insert(gateOnQubit[qubit]);
+            gateOnQubit[qubit] = gid;
         }
     }
     return dependencyList;
 }
 
-double cost(const std::string &gateType,
-            const std::set<qubit_size_t> &sortedQubits) {
-    const int qSize = sortedQubits.size();
+double cost(size_t key, qubit_mask_t qubits) {
+    const int qSize = std::popcount(qubits);
     if (gMethod < 4 || gMethod == 5) { // mode 4,6,7,8 need dynamic cost
         return pow(gCostFactor, (double)std::max(qSize - 1, 1));
     }
-    int targetQubit = *sortedQubits.begin();
+    int targetQubit = std::countr_zero(qubits);
     if (gMethod != 7 and gMethod != 8) {
         // In Aer simulator, the second dimension represents the
         // target qubit. However, this is unnecessary in Quokka or
         // Queen simulators, so a value of 0 is used.
         targetQubit = 0;
     }
-    if (gGateTime.contains(gateType)) {
-        return gGateTime[gateType][targetQubit];
+    if (!gGateTime[key].empty()) {
+        return gGateTime[key][targetQubit];
     } else { // gate type not in gGateTime, we use the number of target qubits
              // to estimate
-        return gGateTime["U1"][targetQubit] * qSize;
+        return gGateTime[size_t(Op::U1)][targetQubit] * qSize;
     }
     throw std::runtime_error("Should not reach here.");
     return 0;
 }
 
+using gate_mask_t = uint64_t; // bit i is gate i of a small circuit
+constexpr size_t kMaxSmallCircuitSize = 64;
+// small circuits below this size are searched exhaustively, larger ones by
+// the shortest path of their DAG
+constexpr size_t kSmallCircuitDFSSize = 32;
+// search nodes per small circuit before falling back to the shortest path
+constexpr size_t kSmallCircuitDFSBudget = 100000;
+
+/* The small circuit searched by getSmallWeight. Its 1-qubit fusion gates are
+ * the bits of a gate_mask_t, and each fusion gate is kept with the bits of its
+ * members and of the gates they wait for, so a search state is only the set of
+ * scheduled gates. */
+class SmallCircuit {
+  public:
+    struct Candidate {
+        Finfo finfo;
+        gate_mask_t members;
+        gate_mask_t dependency; // other gates to be scheduled first
+        double weight;          // cost of the gate it outputs
+        double share;           // lower bound of weight, see minShare
+    };
+    std::vector<std::vector<Candidate>> fusionGateList;
+    gate_mask_t allGates;
+    // A gate costs at least the smallest weight per member of the candidates
+    // containing it, so the unscheduled gates bound the remaining weight.
+    std::vector<double> minShare;
+    double totalShare = 0;
+    std::atomic<size_t> visited = 0;
+
+    SmallCircuit(const FusionGateList &subFusionGateList) {
+        const auto &gates = subFusionGateList[0];
+        if (gates.size() > kMaxSmallCircuitSize)
+            throw std::runtime_error("small circuit should not have more "
+                                     "than 64 gates");
+        allGates = gates.size() == kMaxSmallCircuitSize
+                       ? ~gate_mask_t(0)
+                       : (gate_mask_t(1) << gates.size()) - 1;
+
+        std::unordered_map<int, int> gateBit; // fid -> bit
+        for (size_t i = 0; i < gates.size(); ++i)
+            gateBit[gates[i].finfo.fid] = i;
+        std::vector<std::set<int>> dependencyList = constructDependencyList(
+            gates, [](const FusionGate &, size_t position) { return position; });
+        std::vector<gate_mask_t> dependency(gates.size(), 0);
+        for (size_t i = 0; i < gates.size(); ++i)
+            for (int gate : dependencyList[i])
+                dependency[i] |= gate_mask_t(1) << gate;
+
+        for (const auto &level : subFusionGateList) {
+            auto &candidates = fusionGateList.emplace_back();
+            for (const auto &fusionGate : level) {
+                Candidate candidate{fusionGate.finfo, 0, 0,
+                                    cost(fusionGate.head()), 0};
+                bool isDiagonal = true;
+                for (auto gid : fusionGate.members()) {
+                    int bit = gateBit.at(gid);
+                    candidate.members |= gate_mask_t(1) << bit;
+                    candidate.dependency |= dependency[bit];
+                    isDiagonal &= gGates[gid].isDiagonal();
+                }
+                candidate.dependency &= ~candidate.members;
+                if (fusionGate.count > 1) // output as one fused gate
+                    candidate.weight =
+                        cost(costKey(isDiagonal ? Op::D : Op::U,
+                                     std::popcount(fusionGate.mask)),
+                             fusionGate.mask);
+                candidates.push_back(candidate);
+            }
+        }
+
+        minShare.assign(gates.size(), DBL_MAX);
+        for (const auto &candidates : fusionGateList)
+            for (const auto &candidate : candidates)
+                for (gate_mask_t m = candidate.members; m; m &= m - 1) {
+                    double &share = minShare[std::countr_zero(m)];
+                    share = std::min(share, candidate.weight /
+                                                std::popcount(candidate.members));
+                }
+        for (auto &candidates : fusionGateList)
+            for (auto &candidate : candidates)
+                for (gate_mask_t m = candidate.members; m; m &= m - 1)
+                    candidate.share += minShare[std::countr_zero(m)];
+        for (double share : minShare)
+            totalShare += share;
+    }
+
+    bool exhausted() const { return visited > kSmallCircuitDFSBudget; }
+};
+
+// search tree nodes at this depth are searched as separate tasks
+constexpr int kSmallCircuitForkDepth = 2;
+
 class SmallWeightNode {
   public:
-    SmallWeightNode *parent = nullptr;
     Finfo finfo = {0, 0};
     double weight = 0;
+    double share = 0;
+    gate_mask_t members = 0;
     SmallWeightNode() = default; // root node
-    SmallWeightNode(SmallWeightNode *parent, const Finfo &finfo,
-                    std::string gateType,
-                    const std::set<qubit_size_t> &sortedQubits)
-        : parent(parent), finfo(finfo), weight(cost(gateType, sortedQubits)) {}
-
-    void getSmallWeight(std::vector<std::vector<Gate>> fusionGateList,
-                        std::vector<std::set<int>> dependencyList,
-                        double nowWeight, std::atomic<double> &smallWeight,
-                        std::vector<Finfo> nowGateList,
-                        std::vector<Finfo> &finalGateList, ThreadPool &pool,
-                        std::mutex &mutex, int depth = 0) {
-
-        gDFSCounter++;
+    SmallWeightNode(const SmallCircuit::Candidate &candidate)
+        : finfo(candidate.finfo), weight(candidate.weight),
+          share(candidate.share), members(candidate.members) {}
+
+    // the best schedule of a search, only lighter ones than weight are kept
+    struct Best {
+        double weight = DBL_MAX;
+        std::vector<Finfo> gateList;
+        size_t earlyStops = 0;
+    };
+    // a subtree left for a task, with the state and path before its node
+    struct Fork {
+        const SmallCircuit::Candidate *candidate;
+        gate_mask_t scheduledGates;
+        double nowWeight, restWeight;
+        std::vector<Finfo> gateList;
+    };
+
+    // Fusion gates overlapping scheduledGates are removed and the others wait
+    // only for unscheduled gates, so scheduledGates is the whole search state.
+    // nowGateList is restored before returning. restWeight is the lower bound
+    // of the weight still to be added. With forks, the nodes at
+    // kSmallCircuitForkDepth and the leaves above it are not searched but
+    // appended to forks in search order.
+    void getSmallWeight(const SmallCircuit::Candidate *candidate,
+                        SmallCircuit &circuit, gate_mask_t scheduledGates,
+                        double nowWeight, double restWeight, Best &best,
+                        std::vector<Finfo> &nowGateList,
+                        std::vector<Fork> *forks = nullptr, int depth = 0) {
+
+        if (forks && (depth == kSmallCircuitForkDepth ||
+                      (scheduledGates | members) == circuit.allGates)) {
+            forks->push_back({candidate, scheduledGates, nowWeight, restWeight,
+                              nowGateList});
+            return;
+        }
+        if (++circuit.visited > kSmallCircuitDFSBudget)
+            return; // give up, the caller uses the shortest path instead
         nowWeight += weight;
-        // early stop if nowWeight > smallWeight
-        if (nowWeight > smallWeight.load()) {
-            gEarlyStopCounter++;
+        restWeight -= share;
+        // early stop if nowWeight + restWeight > best.weight
+        if (nowWeight + restWeight > best.weight) {
+            best.earlyStops++;
             return;
         }
 
         nowGateList.push_back(finfo);
-        if (parent != nullptr)
-            [[likely]] {
-                auto &currentFusionList = fusionGateList[finfo.size - 1];
-                auto it = std::find_if(currentFusionList.begin(),
-                                       currentFusionList.end(),
-                                       [this](const Gate &gate) {
-                                           return gate.finfo.fid == finfo.fid;
-                                       });
-                if (it != currentFusionList.end()) {
-                    deleteRelatedNode(fusionGateList, dependencyList, *it);
-                }
-            }
-        else
+        scheduledGates |= members;
+        if (depth == 0 && forks)
             [[unlikely]] {
-                DEBUG_SECTION(
-                    DEBUG_getSmallWeight, std::cout << "getSmallWeight\n"
-                                                    << std::string(40, 'O')
-                                                    << "\n";
-                    showFusionGateList(fusionGateList, 1, gMaxFusionSize););
+                DEBUG_SECTION(DEBUG_getSmallWeight,
+                              std::cout << "getSmallWeight\n"
+                                        << std::string(40, 'O') << "\n";);
             }
 
-        if (fusionGateList[0].empty()) {
+        if (scheduledGates == circuit.allGates) {
             DEBUG_SECTION(DEBUG_getSmallWeight, showFinfoList(nowGateList););
-            std::unique_lock<std::mutex> lock(mutex);
-            if (nowWeight < smallWeight) {
-                smallWeight = nowWeight;
-                finalGateList = nowGateList;
+            if (nowWeight < best.weight) {
+                best.weight = nowWeight;
+                best.gateList = nowGateList;
                 DEBUG_SECTION(DEBUG_getSmallWeight, std::cout << "update\n";);
             }
+            nowGateList.pop_back();
             return;
         }
 
-        std::vector<std::future<void>> futures;
-
         for (int fSize = gMaxFusionSize - 1; fSize >= 0; --fSize) {
-            for (const auto &fusionGate : fusionGateList[fSize]) {
+            for (const auto &candidate : circuit.fusionGateList[fSize]) {
+                if (candidate.members & scheduledGates)
+                    continue; // deleted by a scheduled fusion gate
                 if (finfo.size == fSize + 1 &&
-                    finfo.fid > fusionGate.finfo.fid &&
+                    finfo.fid > candidate.finfo.fid &&
                     (gMethod != 0 && gMethod != 2))
                     break;
 
-                std::set<int> gateIndexes;
-                for (const auto &subgate : fusionGate.subGateList)
-                    gateIndexes.insert(subgate.finfo.fid);
-
-                if (!hasDependency(gateIndexes, dependencyList,
-                                   gateIndexes)) { // pruning
-                    SmallWeightNode nextNode(
-                        this, fusionGate.finfo,
-                        fusionGate.subGateList[0].gateType,
-                        fusionGate.subGateList[0].sortedQubits);
-
-                    auto task = [&, nextNode, nowGateList,
-                                 nowWeight]() mutable {
-                        nextNode.getSmallWeight(fusionGateList, dependencyList,
-                                                nowWeight, smallWeight,
-                                                nowGateList, finalGateList,
-                                                pool, mutex, depth + 1);
-                    };
-
-                    if (depth < 2) { // You may change this value to 0 in
-                                     // DEBUG_getSmallWeight
-                        futures.emplace_back(pool.enqueue(task));
-                    } else {
-                        task(); // sequential
-                    }
+                if (!(candidate.dependency & ~scheduledGates)) { // pruning
+                    SmallWeightNode(candidate).getSmallWeight(
+                        &candidate, circuit, scheduledGates, nowWeight, restWeight, best,
+                        nowGateList, forks, depth + 1);
                 }
             }
         }
 
-        for (auto &f : futures)
-            f.get();
+        nowGateList.pop_back();
     }
 };
 
+// Build a queue of gate indices for each qubit
+// for each gate, a qubit is pushed as a pair (gate, qubit)
+template <typename GateType>
+std::vector<std::queue<int>>
+buildQubitGateQueues(const std::vector<GateType> &gates) {
+    std::vector<std::queue<int>> qubitGateQueues(gQubits);
+    for (size_t gateIdx = 0; gateIdx < gates.size(); ++gateIdx) {
+        const qubit_mask_t qubits = gates[gateIdx].mask;
+        int prevQubit = -1;
+        int firstQubit = std::countr_zero(qubits);
+        // Add the gate to each involved qubit's queue in reverse order
+        for (int qubit = kMaxQubits - 1; qubit >= 0; --qubit) {
+            if (!(qubits >> qubit & 1))
+                continue;
+            qubitGateQueues[qubit].push(gateIdx);
+            if (prevQubit == -1) {
+                qubitGateQueues[qubit].push(firstQubit);
+            } else {
+                qubitGateQueues[qubit].push(prevQubit);
+            }
+            prevQubit = qubit;
+        }
+    }
+    return qubitGateQueues;
+}
+
+/* Reorder gates so that a qubit's gates are visited before moving on to the
+ * related qubit; used for circuit gates and for each fusion gate list */
+template <typename GateType>
+std::vector<GateType> schedule(const std::vector<GateType> &gates) {
+    std::vector<GateType> reorderedGates;
+    std::vector<int> waitingGates;
+    std::vector<bool> scheduledGates(gates.size());
+    auto isScheduled = [&](int gid) { return bool(scheduledGates[gid]); };
+    int currentQubit = 0;
+    std::vector<std::set<int>> dependencyList = constructDependencyList(
+        gates, [](const GateType &, size_t position) { return position; });
+    std::vector<std::queue<int>> qubitGateQueues = buildQubitGateQueues(gates);
+
+    while (true) {
+        // Skip empty qubit queues
+        while (currentQubit < gQubits &&
+               qubitGateQueues[currentQubit].empty()) {
+            ++currentQubit;
+        }
+
+        if (currentQubit == gQubits)
+            break; // All gates processed
+
+        // Extract gate index and its partner qubit
+        int gateIdx = qubitGateQueues[currentQubit].front();
+        qubitGateQueues[currentQubit].pop();
+        int partnerQubit = qubitGateQueues[currentQubit].front();
+        qubitGateQueues[currentQubit].pop();
+
+        if (currentQubit >= partnerQubit) {
+            if (!hasDependency(std::array{gateIdx}, dependencyList,
+                               isScheduled)) {
+                reorderedGates.push_back(gates[gateIdx]);
+                scheduledGates[gateIdx] = true;
+            } else {
+                waitingGates.push_back(gateIdx);
+            }
+        }
+
+        // Try to schedule waiting gates whose dependencies are now resolved
+        for (auto it = waitingGates.begin(); it != waitingGates.end();) {
+            int pendingIdx = *it;
+            if (!hasDependency(std::array{pendingIdx}, dependencyList,
+                               isScheduled)) {
+                reorderedGates.push_back(gates[pendingIdx]);
+                scheduledGates[pendingIdx] = true;
+                it = waitingGates.erase(it); // Remove and advance
+            } else {
+                ++it;
+            }
+        }
+        currentQubit = partnerQubit; // Continue with the next related qubit
+    }
+    return reorderedGates;
+}
+
 class Circuit {
   public:
     std::vector<Gate> gates;
@@ -639,99 +893,30 @@ class Circuit {
     Circuit(const std::vector<Gate> &gates) : gates(gates) {}
     Circuit(const std::string &fileName) {
         std::ifstream tmpInputFile(fileName);
-        std::string line;
-        for (size_t gateIndex = 0; getline(tmpInputFile, line); ++gateIndex) {
-            gates.emplace_back(line, gateIndex);
-        }
+        read(tmpInputFile);
         tmpInputFile.close();
     }
 
-    Gate &operator[](size_t index) { return gates[index]; }
-    gate_size_t size() const { return gates.size(); }
-
-    Gate fusedToGate() const {
-        Gate fusedGate(Finfo{0, 0}); // dummy
-        bool isDiagonal = true;
-        for (const auto &subgate : gates) {
-            fusedGate.sortedQubits.insert(subgate.sortedQubits.begin(),
-                                          subgate.sortedQubits.end());
-            if (!isDiagonalGate(subgate.gateType))
-                isDiagonal = false;
-        }
-        fusedGate.qubits = std::vector(fusedGate.sortedQubits.begin(),
-                                       fusedGate.sortedQubits.end());
-        fusedGate.gateType = (isDiagonal ? "D" : "U") +
-                             std::to_string(fusedGate.sortedQubits.size());
-
-        Matrix fusedGateMat =
-            calculateFusionGate(gates, fusedGate.sortedQubits);
-        if (isDiagonal) {
-            for (size_t i = 0; i < fusedGateMat.size(); i++) {
-                fusedGate.params.push_back(fusedGateMat[i][i].real());
-                fusedGate.params.push_back(fusedGateMat[i][i].imag());
-            }
-        } else {
-            for (size_t matRow = 0; matRow < fusedGateMat.size(); matRow++) {
-                for (const auto elem : fusedGateMat[matRow]) {
-                    fusedGate.params.push_back(elem.real());
-                    fusedGate.params.push_back(elem.imag());
-                }
+    /* Append at most maxGates gates from input, false if it has no more */
+    bool read(std::istream &input,
+              size_t maxGates = std::numeric_limits<size_t>::max()) {
+        std::string line;
+        for (size_t i = 0; i < maxGates && getline(input, line); ++i) {
+            if (gates.size() == std::numeric_limits<gate_size_t>::max()) {
+                std::cerr << "Error: more than " << gates.size()
+                          << " gates, build with a larger GATE_INDEX_BITS "
+                             "or fuse the circuit in windows\n";
+                exit(1);
             }
+            gates.emplace_back(line);
         }
-        return fusedGate;
+        return input.peek() != std::istream::traits_type::eof();
     }
 
-    Circuit schedule() const {
-        Circuit reorderedCircuit;
-        std::vector<Gate> waitingGates;
-        std::set<int> scheduledGates;
-        int currentQubit = 0;
-        std::vector<std::set<int>> dependencyList =
-            constructDependencyList(gates);
-        std::vector<std::queue<int>> qubitGateQueues = buildQubitGateQueues();
-
-        while (true) {
-            // Skip empty qubit queues
-            while (currentQubit < gQubits &&
-                   qubitGateQueues[currentQubit].empty()) {
-                ++currentQubit;
-            }
-
-            if (currentQubit == gQubits)
-                break; // All gates processed
-
-            // Extract gate index and its partner qubit
-            int gateIdx = qubitGateQueues[currentQubit].front();
-            qubitGateQueues[currentQubit].pop();
-            int partnerQubit = qubitGateQueues[currentQubit].front();
-            qubitGateQueues[currentQubit].pop();
-
-            if (currentQubit >= partnerQubit) {
-                if (!hasDependency({gates[gateIdx].finfo.fid}, dependencyList,
-                                   scheduledGates)) {
-                    reorderedCircuit.gates.push_back(gates[gateIdx]);
-                    scheduledGates.insert(gates[gateIdx].finfo.fid);
-                } else {
-                    waitingGates.push_back(gates[gateIdx]);
-                }
-            }
+    Gate &operator[](size_t index) { return gates[index]; }
+    gate_size_t size() const { return gates.size(); }
 
-            // Try to schedule waiting gates whose dependencies are now resolved
-            for (auto it = waitingGates.begin(); it != waitingGates.end();) {
-                int pendingIdx = (*it).finfo.fid;
-                if (!hasDependency({pendingIdx}, dependencyList,
-                                   scheduledGates)) {
-                    reorderedCircuit.gates.push_back(gates[pendingIdx]);
-                    scheduledGates.insert(pendingIdx);
-                    it = waitingGates.erase(it); // Remove and advance
-                } else {
-                    ++it;
-                }
-            }
-            currentQubit = partnerQubit; // Continue with the next related qubit
-        }
-        return reorderedCircuit;
-    }
+    Circuit schedule() const { return Circuit(::schedule(gates)); }
 
     std::string str() const {
         std::stringstream ss;
@@ -742,42 +927,14 @@ class Circuit {
     }
 
     void dump() const {
-        for (const auto &gate : gates) {
-            std::cout << "gids: ";
-            for (int gid : gate.gids)
-                std::cout << gid << " ";
-            std::cout << ", fid: " << gate.finfo.fid << " ";
-            std::cout << gate.str() << "\n";
+        for (size_t i = 0; i < gates.size(); ++i) {
+            std::cout << "gid: " << i << " " << gates[i].str() << "\n";
         }
     }
-
-  private:
-    // Build a queue of gate indices for each qubit
-    // for each gate, a qubit is pushed as a pair (gate, qubit)
-    std::vector<std::queue<int>> buildQubitGateQueues() const {
-        std::vector<std::queue<int>> qubitGateQueues(gQubits);
-        for (size_t gateIdx = 0; gateIdx < gates.size(); ++gateIdx) {
-            const auto &qubits = gates[gateIdx].sortedQubits;
-            int prevQubit = -1;
-            int firstQubit = *qubits.begin();
-            // Add the gate to each involved qubit's queue in reverse order
-            for (auto it = qubits.rbegin(); it != qubits.rend(); ++it) {
-                int qubit = *it;
-                qubitGateQueues[qubit].push(gateIdx);
-                if (prevQubit == -1) {
-                    qubitGateQueues[qubit].push(firstQubit);
-                } else {
-                    qubitGateQueues[qubit].push(prevQubit);
-                }
-                prevQubit = qubit;
-            }
-        }
-        return qubitGateQueues;
-    }
 };
 
 void outputFusionCircuit(const std::string &outputFileName,
-                         const std::vector<std::vector<Gate>> &fusionGateList,
+                         const FusionGateList &fusionGateList,
                          const std::vector<Finfo> &finalGateList) {
     std::ofstream outputFile(outputFileName, std::ios_base::app);
     for (const auto &finfo : finalGateList) {
@@ -785,12 +942,11 @@ void outputFusionCircuit(const std::string &outputFileName,
             continue;
         } else {
             const auto &wrapper = fusionGateList[finfo.size - 1][finfo.fid];
-            if (wrapper.subGateList.size() == 1) { // no fusion
-                outputFile << wrapper.subGateList[0].str() << "\n";
+            if (wrapper.count == 1) { // no fusion
+                outputFile << wrapper.head().str() << "\n";
                 continue;
             }
-            outputFile << Circuit(wrapper.subGateList).fusedToGate().str()
-                       << "\n";
+            outputFile << fusedGateStr(wrapper.members()) << "\n";
         }
     }
     outputFile.close();
@@ -817,36 +973,29 @@ class DAG {
         edge[source].push_back(std::make_pair(destination, weight));
         return true;
     }
-    void constructDAG(const std::vector<Gate> &gateList) {
+    void constructDAG(const std::vector<FusionGate> &gateList) {
         DEBUG_SECTION(
             DEBUG_shortestPath, std::cout << "constructDAG\n";
-            for (auto gate
-                 : gateList) {
-                std::cout << gate.subGateList[0].str() << "\n";
-            });
+            for (const auto &gate
+                 : gateList) { std::cout << gate.head().str() << "\n"; });
         fidOffset = gateList[0].finfo.fid;
         for (size_t i = 0; i < gateList.size(); ++i) {
             // one qubit fusion edge
-            addEdge(i, i + 1,
-                    cost(gateList[i].subGateList[0].gateType,
-                         gateList[i].subGateList[0].sortedQubits));
+            addEdge(i, i + 1, cost(gateList[i].head()));
             // muti qubit fusion edge
             for (size_t fSize = 2; fSize <= gMaxFusionSize; ++fSize) {
-                std::set<qubit_size_t> qubit;
+                qubit_mask_t qubit = 0;
                 size_t j = i;
-                // note: We cannot use fusedToGate() here because we want to
-                // reuse the testQubit. This avoids calling fusedToGate(),
+                // note: We cannot use fuseGates() here because we want to
+                // reuse the testQubit. This avoids calling fuseGates(),
                 // which is expensive and involves redundant loops.
                 bool isDiagonal = true;
                 while (j < gateList.size()) {
-                    const auto &subgate = gateList[j].subGateList[0];
-                    std::set<qubit_size_t> testQubit = qubit;
-                    // note: diagonal gate's subgate has sorted qubits
-                    testQubit.insert(subgate.sortedQubits.begin(),
-                                     subgate.sortedQubits.end());
-                    if (testQubit.size() <=
+                    const auto &subgate = gateList[j].head();
+                    qubit_mask_t testQubit = qubit | subgate.mask;
+                    if (size_t(std::popcount(testQubit)) <=
                         fSize) { // test if the fusion is valid
-                        if (!isDiagonalGate(subgate.gateType))
+                        if (!subgate.isDiagonal())
                             isDiagonal = false;
                         qubit = testQubit; // update fused qubits
                         j++;
@@ -854,14 +1003,15 @@ class DAG {
                         break;
                 }
                 if (j > i + 1) { // means more than one gate to be fused
-                    std::string gateType =
-                        (isDiagonal ? "D" : "U") + std::to_string(qubit.size());
-                    bool isAdded = addEdge(i, j, cost(gateType, qubit));
+                    size_t key = costKey(isDiagonal ? Op::D : Op::U,
+                                         std::popcount(qubit));
+                    bool isAdded = addEdge(i, j, cost(key, qubit));
                     DEBUG_SECTION(
                         DEBUG_shortestPath, if (isAdded) {
                             std::cout << "Add edge: " << i << " -> " << j
-                                      << " : " << gateType << " "
-                                      << cost(gateType, qubit) << "\n";
+                                      << " : " << (isDiagonal ? "D" : "U")
+                                      << std::popcount(qubit) << " "
+                                      << cost(key, qubit) << "\n";
                         });
                 } else {
                     addEdge(i, -1, DBL_MAX);
@@ -870,7 +1020,7 @@ class DAG {
         }
     }
 
-    void shortestPath(const std::vector<Gate> &gateList,
+    void shortestPath(const std::vector<FusionGate> &gateList,
                       const std::string &outputFileName) {
         struct DAGNode {
             int predecessor = -1;
@@ -905,22 +1055,20 @@ class DAG {
         while (idx > 0) {
             if (nodeList[idx].fSize >
                 1) { // means more than one gate to be fused
-                Circuit gatesToFused;
+                std::vector<gate_size_t> gatesToFused;
                 for (int i = nodeList[idx].predecessor; i < idx; ++i) {
                     DEBUG_SECTION(DEBUG_shortestPath,
-                                  std::cout << "↓ "
-                                            << gateList[i].subGateList[0].str()
+                                  std::cout << "↓ " << gateList[i].head().str()
                                             << "\n";);
-                    gatesToFused.gates.push_back(gateList[i].subGateList[0]);
+                    gatesToFused.push_back(gateList[i].members()[0]);
                 }
-                std::string tmpStr = gatesToFused.fusedToGate().str();
+                std::string tmpStr = fusedGateStr(gatesToFused);
                 DEBUG_SECTION(DEBUG_shortestPath,
                               std::cout << "Merge to -> " << tmpStr << "\n";);
                 outputStr.push_back(tmpStr);
             } else {
                 int predecessorIndex = nodeList[idx].predecessor;
-                std::string tmpStr =
-                    gateList[predecessorIndex].subGateList[0].str();
+                std::string tmpStr = gateList[predecessorIndex].head().str();
                 DEBUG_SECTION(DEBUG_shortestPath,
                               std::cout << "Single -> " << tmpStr << "\n";);
                 outputStr.push_back(tmpStr);
@@ -986,111 +1134,98 @@ class DAG {
 class FusionList {
   public:
     struct Info {
-        Info(gate_size_t gateIndex, const std::set<qubit_size_t> &sortedQubits)
+        Info(gate_size_t gateIndex, qubit_mask_t sortedQubits)
             : gateIndex(gateIndex), sortedQubits(sortedQubits) {}
 
         gate_size_t gateIndex;
         int maxGateNumber = 0;
-        std::set<qubit_size_t> sortedQubits;
-        std::set<qubit_size_t> relatedQubits;
+        qubit_mask_t sortedQubits;
+        qubit_mask_t relatedQubits = 0;
     };
 
     std::vector<Info> infoList;
 
     FusionList(const std::vector<Gate> &gateList) {
-        for (const auto &gate : gateList) {
-            infoList.emplace_back(gate.finfo.fid,
-                                  gate.subGateList[0].sortedQubits);
+        for (size_t i = 0; i < gateList.size(); ++i) {
+            infoList.emplace_back(i, gateList[i].mask);
         }
     }
-    // copy assignment operator
-    FusionList &operator=(const FusionList &rhs) {
-        infoList = rhs.infoList;
-        return *this;
-    }
-    // copy constructor
-    FusionList(const FusionList &rhs) { infoList = rhs.infoList; }
 
+    // relatedQubits: the qubits connected to the gate through the gates so
+    // far; maxGateNumber: the number of gates on them
     void reNewList() {
-        std::vector<std::vector<int>> qubitDependency(gQubits);
-        std::vector<std::unordered_set<int>> preGate(gQubits);
+        std::array<qubit_mask_t, kMaxQubits> qubitDependency{};
+        std::array<int, kMaxQubits> gateNumber{}; // by lowest related qubit
         for (auto &info : infoList) {
-            info.relatedQubits = info.sortedQubits;
-            for (int element : info.sortedQubits) {
-                info.relatedQubits.insert(qubitDependency[element].begin(),
-                                          qubitDependency[element].end());
-            }
-            std::unordered_set<int> allPreGate;
-            for (int element : info.relatedQubits) {
-                qubitDependency[element].assign(info.relatedQubits.begin(),
-                                                info.relatedQubits.end());
-                preGate[element].insert(&info - &infoList[0]);
-                allPreGate.insert(preGate[element].begin(),
-                                  preGate[element].end());
+            qubit_mask_t merged = 0;
+            int number = 1;
+            for (qubit_mask_t m = info.sortedQubits; m; m &= m - 1) {
+                qubit_mask_t related = qubitDependency[std::countr_zero(m)];
+                if (related & ~merged) {
+                    merged |= related;
+                    number += gateNumber[std::countr_zero(related)];
+                }
             }
-            info.maxGateNumber = static_cast<int>(allPreGate.size());
+            info.relatedQubits = info.sortedQubits | merged;
+            for (qubit_mask_t m = info.relatedQubits; m; m &= m - 1)
+                qubitDependency[std::countr_zero(m)] = info.relatedQubits;
+            gateNumber[std::countr_zero(info.relatedQubits)] = number;
+            info.maxGateNumber = number;
         }
     }
 
-    std::vector<int> getFusedGate(size_t fSize) {
-        std::vector<int> gateToFused;
-
-        if (infoList[0].sortedQubits.size() > fSize) {
+    // append the gates of the next fusion gate to gateToFused
+    void getFusedGate(size_t fSize, std::vector<gate_size_t> &gateToFused) {
+        if (size_t(std::popcount(infoList[0].sortedQubits)) > fSize) {
             gateToFused.push_back(infoList[0].gateIndex);
             infoList.erase(infoList.begin());
-            return gateToFused;
+            return;
         }
 
         while (fSize) {
             int nowMaxGateNumber = 0;
-            std::set<qubit_size_t> tmpFusionQubit;
+            qubit_mask_t tmpFusionQubit = 0;
             for (const auto &info : infoList) {
                 if (info.maxGateNumber > nowMaxGateNumber &&
-                    info.relatedQubits.size() <= fSize) {
+                    size_t(std::popcount(info.relatedQubits)) <= fSize) {
                     nowMaxGateNumber = info.maxGateNumber;
                     tmpFusionQubit = info.relatedQubits;
                 }
             }
-            fSize -= tmpFusionQubit.size();
-
-            for (auto it = infoList.begin(); it != infoList.end();) {
-                if (includes(tmpFusionQubit.begin(), tmpFusionQubit.end(),
-                             it->relatedQubits.begin(),
-                             it->relatedQubits.end())) {
-                    gateToFused.push_back(it->gateIndex);
-                    it = infoList.erase(it);
-                } else {
-                    ++it;
-                }
+            fSize -= std::popcount(tmpFusionQubit);
+
+            size_t kept = 0;
+            for (const auto &info : infoList) {
+                if (tmpFusionQubit && !(info.relatedQubits & ~tmpFusionQubit))
+                    gateToFused.push_back(info.gateIndex);
+                else
+                    infoList[kept++] = info;
             }
-            if (tmpFusionQubit.empty())
+            infoList.erase(infoList.begin() + kept, infoList.end());
+            if (!tmpFusionQubit)
                 break;
         }
-        return gateToFused;
     }
 
     void dump() const {
+        auto dumpQubits = [](qubit_mask_t qubits) {
+            for (qubit_mask_t m = qubits; m; m &= m - 1) {
+                if (m != qubits)
+                    std::cout << ", ";
+                std::cout << std::countr_zero(m);
+            }
+        };
         for (const auto &inf : infoList) {
             std::cout << inf.gateIndex << "|";
-            if (!inf.sortedQubits.empty()) {
+            if (inf.sortedQubits) {
                 std::cout << " t{";
-                for (auto it = inf.sortedQubits.begin();
-                     it != inf.sortedQubits.end(); ++it) {
-                    if (it != inf.sortedQubits.begin())
-                        std::cout << ", ";
-                    std::cout << *it;
-                }
+                dumpQubits(inf.sortedQubits);
                 std::cout << "} ";
             }
             std::cout << "|";
-            if (!inf.relatedQubits.empty()) {
+            if (inf.relatedQubits) {
                 std::cout << " r{";
-                for (auto it = inf.relatedQubits.begin();
-                     it != inf.relatedQubits.end(); ++it) {
-                    if (it != inf.relatedQubits.begin())
-                        std::cout << ", ";
-                    std::cout << *it;
-                }
+                dumpQubits(inf.relatedQubits);
                 std::cout << "}";
             }
             std::cout << " | " << inf.maxGateNumber << "\n";
@@ -1099,196 +1234,242 @@ class FusionList {
 };
 
 void DoDiagonalFusion(Circuit &circuit) {
-    std::set<qubit_size_t> targetQubits;
-    int addFlag = 0;
-    std::vector<Gate> subGateList;
-    for (size_t i = 0; i < circuit.size(); ++i) {
+    qubit_mask_t targetQubits = 0;
+    std::vector<gate_size_t> subGateList;
+    std::vector<Gate> gates;
+    auto addFusedGate = [&]() {
+        if (subGateList.size() == 1) {
+            // revert the conversion due to only one gate
+            gates.push_back(circuit[subGateList[0]]);
+        } else {
+            gates.push_back(fuseGates(subGateList, circuit.gates, gParams));
+        }
+        subGateList.clear();
+        targetQubits = 0;
+    };
+    for (gate_size_t i = 0; i < circuit.size(); ++i) {
         const auto &subgate = circuit[i];
-        if (subgate.gateType == "RZ") {
-            bool firstInset = targetQubits.contains(subgate.qubits[0]);
-            if (firstInset && targetQubits.size() <= gMaxFusionSize) {
-                subGateList.push_back(subgate);
-                circuit.gates.erase(circuit.gates.begin() + i);
-                i--;
-            } else if (!firstInset &&
-                       targetQubits.size() <= gMaxFusionSize - 1) {
-                targetQubits.insert(subgate.qubits[0]);
-                subGateList.push_back(subgate);
-                circuit.gates.erase(circuit.gates.begin() + i);
-                i--;
-            } else {
-                addFlag++;
-            }
-        } else if (subgate.gateType == "CZ" || subgate.gateType == "CP" ||
-                   subgate.gateType == "RZZ") {
-            bool firstInset = targetQubits.contains(subgate.qubits[0]);
-            bool secondInset = targetQubits.contains(subgate.qubits[1]);
-            if (!firstInset && !secondInset &&
-                targetQubits.size() <= gMaxFusionSize - 2) {
-                targetQubits.insert(subgate.qubits[0]);
-                targetQubits.insert(subgate.qubits[1]);
-                subGateList.push_back(subgate);
-                circuit.gates.erase(circuit.gates.begin() + i);
-                i--;
-            } else if (firstInset && !secondInset &&
-                       targetQubits.size() <= gMaxFusionSize - 1) {
-                targetQubits.insert(subgate.qubits[1]);
-                subGateList.push_back(subgate);
-                circuit.gates.erase(circuit.gates.begin() + i);
-                i--;
-            } else if ((firstInset ^ secondInset) &&
-                       targetQubits.size() <= gMaxFusionSize - 1) {
-                targetQubits.insert(subgate.qubits[firstInset ? 1 : 0]);
-                subGateList.push_back(subgate);
-                circuit.gates.erase(circuit.gates.begin() + i);
-                i--;
-            } else {
-                addFlag++;
+        // a gate which doesn't fit ends the diagonal gate and is tried again
+        while (true) {
+            int qubitNumber = std::popcount(targetQubits);
+            qubit_mask_t first = qubit_mask_t(1) << subgate.q[0];
+            qubit_mask_t second = qubit_mask_t(1) << subgate.q[1];
+            bool added = false;
+            if (subgate.op == Op::RZ) {
+                bool firstInset = targetQubits & first;
+                if (firstInset && qubitNumber <= gMaxFusionSize) {
+                    added = true;
+                } else if (!firstInset && qubitNumber <= gMaxFusionSize - 1) {
+                    targetQubits |= first;
+                    added = true;
+                }
+            } else if (subgate.op == Op::CZ || subgate.op == Op::CP ||
+                       subgate.op == Op::RZZ) {
+                bool firstInset = targetQubits & first;
+                bool secondInset = targetQubits & second;
+                if (!firstInset && !secondInset &&
+                    qubitNumber <= gMaxFusionSize - 2) {
+                    targetQubits |= first | second;
+                    added = true;
+                } else if ((firstInset ^ secondInset) &&
+                           qubitNumber <= gMaxFusionSize - 1) {
+                    targetQubits |= first | second;
+                    added = true;
+                }
             }
-        } else if (targetQubits.size() > 0)
-            addFlag++;
-        if (addFlag && targetQubits.size() > 0) {
-            Gate newGate("D", targetQubits, subGateList);
-            circuit.gates.insert(circuit.gates.begin() + i, newGate);
-            subGateList.clear();
-            addFlag = 0;
-            targetQubits.clear();
-        }
-    }
-    if (!targetQubits.empty()) {
-        Gate newGate("D", targetQubits, subGateList);
-        circuit.gates.push_back(newGate);
-    }
-    for (auto &gate : circuit.gates) {
-        if (gate.gateType == "D") {
-            if (gate.subGateList.size() == 1) {
-                // revert the conversion due to only one gate
-                gate = gate.subGateList[0];
-                continue;
+            if (added) {
+                subGateList.push_back(i);
+                break;
             }
-
-            gate.finfo.fid = gate.subGateList[0].gids[0];
-            for (const auto &subgate : gate.subGateList) { // collect gids
-                gate.gids.push_back(subgate.gids[0]);
+            if (!targetQubits) {
+                gates.push_back(subgate);
+                break;
             }
-
-            Gate tmpGate = Circuit(gate.subGateList).fusedToGate();
-            gate.gateType = std::move(tmpGate.gateType);
-            gate.qubits = std::move(tmpGate.qubits);
-            gate.sortedQubits = std::move(tmpGate.sortedQubits);
-            gate.params = std::move(tmpGate.params);
-            gate.subGateList.clear();
+            addFusedGate();
         }
     }
+    if (targetQubits)
+        addFusedGate();
+    circuit.gates = std::move(gates);
 }
 
-std::vector<std::vector<Gate>> GetPGFS(const Circuit &circuit) {
-    std::vector<std::vector<Gate>> fusionGateList;
+FusionGateList GetPGFS(const std::vector<Gate> &gates) {
+    FusionGateList fusionGateList;
     // Step 1: construct 1-qubit fusion list (sequential, fast)
-    std::vector<Gate> NQubitFusionList;
-    for (gate_size_t gateIndex = 0; gateIndex < circuit.size(); gateIndex++) {
-        const Gate &gate = circuit.gates[gateIndex];
-        Gate wrapper(gate.gateType, gate.sortedQubits, {1, gateIndex},
-                     gate.gids);
-        Gate innerGate({1, gateIndex}, gate);
-        wrapper.subGateList.push_back(innerGate);
-        NQubitFusionList.push_back(wrapper);
+    std::vector<FusionGate> NQubitFusionList;
+    gMembers.resize(gates.size());
+    std::iota(gMembers.begin(), gMembers.end(), 0);
+    for (gate_size_t gateIndex = 0; gateIndex < gates.size(); gateIndex++) {
+        NQubitFusionList.push_back(
+            {{1, gateIndex}, gates[gateIndex].mask, gateIndex, 1});
     }
     fusionGateList.push_back(NQubitFusionList);
 
-    // Step 2: parallel generation of multi-qubit fusion lists
-    std::vector<std::future<std::vector<Gate>>> futures;
-    FusionList fusionList(fusionGateList[0]);
-    const auto &fusionGateList0 = fusionGateList[0];
+    // Step 2: parallel generation of multi-qubit fusion lists, each with its
+    // own member array
+    struct Level {
+        std::vector<FusionGate> list;
+        std::vector<gate_size_t> members;
+    };
+    std::vector<Level> levels(gMaxFusionSize > 1 ? gMaxFusionSize - 1 : 0);
+    FusionList fusionList(gates);
+    TaskScheduler::TaskGroup group(gScheduler);
     for (qubit_size_t fSize = 2; fSize <= gMaxFusionSize; ++fSize) {
-        futures.push_back(std::async(std::launch::async, [fSize, fusionList,
-                                                          fusionGateList0]() {
-            std::vector<Gate> nQubitFusionList;
-            FusionList nowFusionList = fusionList; // Assume copy is cheap
+        group.run([fSize, &level = levels[fSize - 2], &fusionList, &gates]() {
+            FusionList nowFusionList = fusionList;
             nowFusionList.reNewList();
             gate_size_t gateIndex = 0;
             while (!nowFusionList.infoList.empty()) {
-                Gate wrapper({fSize, gateIndex++});
-                std::vector<int> gateToFused =
-                    nowFusionList.getFusedGate(fSize);
-                // note: we don't need to check if the fused gate is diagonal
-                // and set the gateType of warpper here
-                for (int index : gateToFused) {
-                    auto &subgate = fusionGateList0[index].subGateList[0];
-                    wrapper.subGateList.push_back(subgate);
-                    wrapper.sortedQubits.insert(subgate.sortedQubits.begin(),
-                                                subgate.sortedQubits.end());
-                }
-                nQubitFusionList.push_back(wrapper);
+                FusionGate wrapper{{fSize, gateIndex++},
+                                   0,
+                                   member_size_t(level.members.size()),
+                                   0};
+                nowFusionList.getFusedGate(fSize, level.members);
+                wrapper.count = level.members.size() - wrapper.first;
+                // note: we don't need to check if the fused gate is
+                // diagonal here
+                for (size_t i = wrapper.first; i < level.members.size(); ++i)
+                    wrapper.mask |= gates[level.members[i]].mask;
+                level.list.push_back(wrapper);
                 nowFusionList.reNewList();
             }
-            return nQubitFusionList;
-        }));
+        });
     }
+    group.wait();
 
     // Step 3: collect results in order
-    for (auto &future : futures) {
-        fusionGateList.push_back(future.get());
+    for (auto &level : levels) {
+        member_size_t offset = gMembers.size();
+        gMembers.insert(gMembers.end(), level.members.begin(),
+                        level.members.end());
+        for (auto &wrapper : level.list)
+            wrapper.first += offset;
+        fusionGateList.push_back(std::move(level.list));
     }
     return fusionGateList;
 }
 
-void searchAndOutputFusionCircuit(
+void shortestPathAndOutputFusionCircuit(
     const std::string &outputFileName,
-    const std::vector<std::vector<Gate>> &subFusionGateList,
-    const std::vector<std::vector<Gate>> &fusionGateList) {
+    const std::vector<FusionGate> &smallCircuit) {
+    gShortestPathCounter++;
+    DAG subDAG(smallCircuit.size());
+    subDAG.constructDAG(smallCircuit);
+    subDAG.shortestPath(smallCircuit, outputFileName);
+    DEBUG_SECTION(
+        DEBUG_shortestPath, for (const auto &gate
+                                 : smallCircuit) {
+            std::cout << "fid: " << gate.finfo.fid << " " << gate.head().str()
+                      << "\n";
+        });
+    DEBUG_SECTION(DEBUG_shortestPath, subDAG.dump(););
+    DEBUG_SECTION(DEBUG_shortestPath, subDAG.dumpDot(););
+}
+
+void searchAndOutputFusionCircuit(const std::string &outputFileName,
+                                  const FusionGateList &subFusionGateList,
+                                  const FusionGateList &fusionGateList) {
+    // modes 0 and 1 pass the whole circuit, too large for the search
+    if (subFusionGateList[0].size() >= kSmallCircuitDFSSize) {
+        shortestPathAndOutputFusionCircuit(outputFileName,
+                                           subFusionGateList[0]);
+        return;
+    }
+    SmallCircuit smallCircuit(subFusionGateList);
+
+    // The top of the search tree is split into forks. The first fork is
+    // searched alone, then the others in parallel, each bounded by the best
+    // of the first fork and its own only. So the nodes a fork visits, and
+    // with them the give-up decision and the result (the first lightest
+    // schedule in search order), don't depend on the threads.
+    using Best = SmallWeightNode::Best;
+    using Fork = SmallWeightNode::Fork;
+    std::vector<Fork> forks;
+    Best top;
+    std::vector<Finfo> nowGateList;
+    SmallWeightNode().getSmallWeight(nullptr, smallCircuit, 0, 0,
+                                     smallCircuit.totalShare, top, nowGateList,
+                                     &forks);
+    std::vector<Best> best(forks.size());
+    TaskScheduler::TaskGroup search(gScheduler);
+    auto searchFork = [&](size_t i) {
+        Fork &fork = forks[i];
+        SmallWeightNode(*fork.candidate)
+            .getSmallWeight(fork.candidate, smallCircuit, fork.scheduledGates,
+                            fork.nowWeight, fork.restWeight, best[i],
+                            fork.gateList, nullptr, kSmallCircuitForkDepth);
+        if (smallCircuit.exhausted())
+            search.cancel();
+    };
+    if (!forks.empty())
+        searchFork(0);
+    for (size_t i = 1; i < forks.size(); ++i) {
+        best[i].weight = best[0].weight;
+        search.run([&searchFork, i]() { searchFork(i); });
+    }
+    search.wait();
+
+    const Best *lightest = &top;
+    size_t earlyStops = top.earlyStops;
+    for (const Best &fork : best) {
+        if (lightest == &top || fork.weight < lightest->weight)
+            lightest = &fork;
+        earlyStops += fork.earlyStops;
+    }
+    // no complete schedule found, never output a partial one
+    if (smallCircuit.exhausted() || lightest->weight == DBL_MAX) {
+        shortestPathAndOutputFusionCircuit(outputFileName,
+                                           subFusionGateList[0]);
+        return;
+    }
+    // counted for finished searches only, the others stop at any node
     gSmallCircuitCounter++;
-    std::atomic<double> smallWeight = DBL_MAX;
-    std::vector<std::set<int>> dependencyList =
-        constructDependencyList(subFusionGateList[0]);
-    std::vector<Finfo> finalGateList, nowGateList;
-    SmallWeightNode().getSmallWeight(subFusionGateList, dependencyList, 0,
-                                     smallWeight, nowGateList, finalGateList,
-                                     gPool, gMutex, 0);
-    outputFusionCircuit(outputFileName, fusionGateList, finalGateList);
+    gDFSCounter += smallCircuit.visited;
+    gEarlyStopCounter += earlyStops;
+    outputFusionCircuit(outputFileName, fusionGateList, lightest->gateList);
 }
 
+/* Append the fused circuit to outputFileName. If openGates is given, the
+ * gates of the last small circuit, which could still fuse with the gates
+ * after them, are returned there instead of output. */
 void GetOptimalGFS(const std::string &outputFileName,
-                   const std::vector<std::vector<Gate>> &fusionGateList) {
+                   const FusionGateList &fusionGateList,
+                   std::vector<gate_size_t> *openGates = nullptr) {
     // find best fusion conbination
     // execute small gate block one by one to reduce execution time
     // because the getSmallWeight and shortestPath use different file output
     // system, the output logic cannot be decoupled
-    const std::string cmd = "rm " + outputFileName + " > /dev/null 2>&1";
-    [[maybe_unused]] auto sysinfo = system(cmd.c_str());
-
     [[unlikely]] if (gMethod <= 1) { // legacy; not tested
         searchAndOutputFusionCircuit(outputFileName, fusionGateList,
                                      fusionGateList);
         return;
     }
-    std::vector<std::vector<Gate>> subFusionGateList(gMaxFusionSize);
+    FusionGateList subFusionGateList(gMaxFusionSize);
     std::vector<std::vector<int>> recordIndex(gMaxFusionSize);
     for (const auto &maxFGate : fusionGateList[gMaxFusionSize - 1]) {
-        for (const auto &subgate : maxFGate.subGateList) {
-            subFusionGateList[0].push_back(
-                fusionGateList[0][subgate.finfo.fid]);
+        for (auto gid : maxFGate.members()) {
+            subFusionGateList[0].push_back(fusionGateList[0][gid]);
             for (size_t i = 0; i < gMaxFusionSize; ++i)
-                recordIndex[i].push_back(subgate.finfo.fid);
+                recordIndex[i].push_back(gid);
         }
         for (qubit_size_t fSize = 1; fSize < gMaxFusionSize - 1; ++fSize) {
             for (const auto &wrapper : fusionGateList[fSize]) {
                 int flag = 1;
                 std::vector<int> reIndex;
-                for (const auto &subgate : wrapper.subGateList) {
+                for (auto gid : wrapper.members()) {
                     // Check if all fusion indices of the sub-gates are a
                     // subset of the recordIndex for this fusion size.
                     if (find(recordIndex[fSize].begin(),
                              recordIndex[fSize].end(),
-                             subgate.finfo.fid) == recordIndex[fSize].end()) {
+                             gid) == recordIndex[fSize].end()) {
                         flag = 0;
                         recordIndex[fSize].insert(recordIndex[fSize].end(),
                                                   reIndex.begin(),
                                                   reIndex.end());
                         break;
                     }
-                    reIndex.push_back(subgate.finfo.fid);
-                    std::erase(recordIndex[fSize], subgate.finfo.fid);
+                    reIndex.push_back(gid);
+                    std::erase(recordIndex[fSize], gid);
                 }
                 if (flag)
                     subFusionGateList[fSize].push_back(wrapper);
@@ -1307,18 +1488,12 @@ void GetOptimalGFS(const std::string &outputFileName,
             DEBUG_SECTION(DEBUG_shortestPath || DEBUG_getSmallWeight,
                           std::cout << "smallCircuitSize: " << smallCircuitSize
                                     << std::endl;);
-            if (smallCircuitSize < 10) {
+            if (smallCircuitSize < kSmallCircuitDFSSize) {
                 searchAndOutputFusionCircuit(outputFileName, subFusionGateList,
                                              fusionGateList);
             } else {
-                gShortestPathCounter++;
-                DAG subDAG(smallCircuitSize);
-                subDAG.constructDAG(subFusionGateList[0]);
-                subDAG.shortestPath(subFusionGateList[0], outputFileName);
-                DEBUG_SECTION(DEBUG_shortestPath,
-                              Circuit(subFusionGateList[0]).dump(););
-                DEBUG_SECTION(DEBUG_shortestPath, subDAG.dump(););
-                DEBUG_SECTION(DEBUG_shortestPath, subDAG.dumpDot(););
+                shortestPathAndOutputFusionCircuit(outputFileName,
+                                                   subFusionGateList[0]);
             }
             for (size_t i = 0; i < gMaxFusionSize; ++i) {
                 subFusionGateList[i].clear();
@@ -1326,18 +1501,41 @@ void GetOptimalGFS(const std::string &outputFileName,
             }
         }
     }
-    if (subFusionGateList[0].size() >= 10)
-        throw std::runtime_error(
-            "subFusionGateList[0].size() should not >= 10");
+    if (subFusionGateList[0].size() >= kSmallCircuitDFSSize)
+        throw std::runtime_error("subFusionGateList[0].size() should not >= "
+                                 "kSmallCircuitDFSSize");
     if (std::any_of(subFusionGateList.begin(), subFusionGateList.end(),
-                    [](const std::vector<Gate> &v) { return !v.empty(); })) {
+                    [](const std::vector<FusionGate> &v) {
+                        return !v.empty();
+                    })) {
         // The subFusionGateList is not empty; however, it is being ignored
         // because smallCircuitSize is less than 6.
+        if (openGates) {
+            for (const auto &gate : subFusionGateList[0])
+                openGates->push_back(gate.members()[0]);
+            return;
+        }
         searchAndOutputFusionCircuit(outputFileName, subFusionGateList,
                                      fusionGateList);
     }
 }
 
+/* A circuit of the open gates of gGates, their params are moved to a new
+ * gParams */
+Circuit carryOver(const std::vector<gate_size_t> &openGates) {
+    Circuit circuit;
+    std::vector<double> params;
+    for (auto gid : openGates) {
+        Gate gate = gGates[gid];
+        gate.param = params.size();
+        params.insert(params.end(), gGates[gid].params(),
+                      gGates[gid].params() + gate.numParams);
+        circuit.gates.push_back(gate);
+    }
+    gParams = std::move(params);
+    return circuit;
+}
+
 std::string getEnvVariable(const std::string &var_name) {
     const char *var_value_cstr = std::getenv(var_name.c_str());
     if (var_value_cstr == nullptr) {
@@ -1352,7 +1550,7 @@ int main(int argc, char *argv[]) {
         std::cerr << "Usage: " << argv[0]
                   << " [Input File] [Output File] [Max Fusion Qubits] "
                      "[Total Qubits] "
-                     "[Mode]"
+                     "[Mode] [Window Gates]"
                   << "\n";
         return 1;
     }
@@ -1363,8 +1561,23 @@ int main(int argc, char *argv[]) {
     std::string outputFileName = argv[2];
     gMaxFusionSize = atoi(argv[3]);
     gQubits = atoi(argv[4]);
-    if (argc == 6)
+    if (argc >= 6)
         gMethod = atoi(argv[5]);
+    size_t windowGates = std::numeric_limits<size_t>::max();
+    if (argc >= 7)
+        windowGates = std::stoull(argv[6]);
+    if (windowGates == 0) {
+        std::cerr << "Error: a window needs at least one gate\n";
+        return 1;
+    }
+    if (gMaxFusionSize < 2) {
+        std::cerr << "Error: fusion needs at least 2 qubits per gate\n";
+        return 1;
+    }
+    if (gQubits > kMaxQubits) {
+        std::cerr << "Error: at most " << kMaxQubits << " qubits\n";
+        return 1;
+    }
 
     if (gMethod == 3) {
         gCostFactor = 4.0; // calibraction: 1.8 / (1287/1277) * (390/174)
@@ -1381,61 +1594,82 @@ int main(int argc, char *argv[]) {
             return 1;
         }
         // the cost table format: gate, target_qubit (or chunk_size), time
+        // rows of gates this tool doesn't know are skipped
         for (std::string line; getline(gateTimeFile, line);) {
             std::stringstream ss(line);
             std::string gateType, target_qubit, time;
             getline(ss, gateType, ',');
             getline(ss, target_qubit, ',');
             getline(ss, time, ',');
-            gGateTime[gateType].push_back(stod(time));
+            Op op;
+            qubit_size_t numQubits;
+            if (parseOpName(gateType, op, numQubits))
+                gGateTime[costKey(op, numQubits)].push_back(stod(time));
         }
     }
 
-    // reorder
-    auto time_start = std::chrono::steady_clock::now();
-    Circuit circuit(inputFileName);
-
-    Circuit newCircuit = circuit.schedule();
-
-    auto time_end = std::chrono::steady_clock::now();
-    timers["reorder"] =
-        std::chrono::duration<double>(time_end - time_start).count();
-
-    // diagonal fusion
-    time_start = std::chrono::steady_clock::now();
-    if (gMethod > 4 && gMethod != 7) {
-        DoDiagonalFusion(newCircuit);
-    }
-
-    time_end = std::chrono::steady_clock::now();
-    timers["diagonal"] =
-        std::chrono::duration<double>(time_end - time_start).count();
-
-    time_start = std::chrono::steady_clock::now();
-    std::vector<std::vector<Gate>> fusionGateList = GetPGFS(newCircuit);
-    time_end = std::chrono::steady_clock::now();
-
-    timers["GetPGFS"] =
-        std::chrono::duration<double>(time_end - time_start).count();
-
-    // do reorder
-    time_start = std::chrono::steady_clock::now();
-    for (size_t fSize = 1; fSize < gMaxFusionSize; ++fSize) {
-        Circuit cc(fusionGateList[fSize]); // build circuit of fSize
-        fusionGateList[fSize] = cc.schedule().gates;
-        gate_size_t index = 0;
-        for (auto &wrapper : fusionGateList[fSize])
-            wrapper.finfo.fid = index++;
+    // The circuit is fused one window at a time: the gates the previous
+    // window left open and the next windowGates gates of the input, so only
+    // a window is kept in memory. Without windowGates it is one window.
+    const std::string cmd = "rm " + outputFileName + " > /dev/null 2>&1";
+    [[maybe_unused]] auto sysinfo = system(cmd.c_str());
+    std::ifstream inputFile(inputFileName);
+    Circuit circuit;
+    try {
+        for (bool moreGates = true; moreGates;) {
+            // reorder
+            auto time_start = std::chrono::steady_clock::now();
+            moreGates = circuit.read(inputFile, windowGates);
+
+            Circuit newCircuit = circuit.schedule();
+
+            auto time_end = std::chrono::steady_clock::now();
+            timers["reorder"] +=
+                std::chrono::duration<double>(time_end - time_start).count();
+
+            // diagonal fusion
+            time_start = std::chrono::steady_clock::now();
+            if (gMethod > 4 && gMethod != 7) {
+                DoDiagonalFusion(newCircuit);
+            }
+            gGates = std::move(newCircuit.gates);
+
+            time_end = std::chrono::steady_clock::now();
+            timers["diagonal"] +=
+                std::chrono::duration<double>(time_end - time_start).count();
+
+            time_start = std::chrono::steady_clock::now();
+            FusionGateList fusionGateList = GetPGFS(gGates);
+            time_end = std::chrono::steady_clock::now();
+
+            timers["GetPGFS"] +=
+                std::chrono::duration<double>(time_end - time_start).count();
+
+            // do reorder
+            time_start = std::chrono::steady_clock::now();
+            for (size_t fSize = 1; fSize < gMaxFusionSize; ++fSize) {
+                fusionGateList[fSize] = schedule(fusionGateList[fSize]);
+                gate_size_t index = 0;
+                for (auto &wrapper : fusionGateList[fSize])
+                    wrapper.finfo.fid = index++;
+            }
+            time_end = std::chrono::steady_clock::now();
+            timers["reorder2"] +=
+                std::chrono::duration<double>(time_end - time_start).count();
+
+            time_start = std::chrono::steady_clock::now();
+            std::vector<gate_size_t> openGates;
+            GetOptimalGFS(outputFileName, fusionGateList,
+                          moreGates ? &openGates : nullptr);
+            circuit = carryOver(openGates);
+            time_end = std::chrono::steady_clock::now();
+            timers["GetOptimalGFS"] +=
+                std::chrono::duration<double>(time_end - time_start).count();
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
     }
-    time_end = std::chrono::steady_clock::now();
-    timers["reorder2"] =
-        std::chrono::duration<double>(time_end - time_start).count();
-
-    time_start = std::chrono::steady_clock::now();
-    GetOptimalGFS(outputFileName, fusionGateList);
-    time_end = std::chrono::steady_clock::now();
-    timers["GetOptimalGFS"] =
-        std::chrono::duration<double>(time_end - time_start).count();
     auto total_time_end = std::chrono::steady_clock::now();
     timers["total"] =
         std::chrono::duration<double>(total_time_end - total_time_start)
@@ -0,0 +1,44 @@
+import glob
+import os
+import re
+import statistics
+import subprocess
+import sys
+
+# Thread scaling of ./fusion over ./circuit/*.txt
+# usage: python python/scaling_benchmark.py [max_fusion_qubit] [mode] [repeat]
+max_fusion_qubits = int(sys.argv[1]) if len(sys.argv) > 1 else 4
+mode = sys.argv[2] if len(sys.argv) > 2 else "3"
+repeat = int(sys.argv[3]) if len(sys.argv) > 3 else 3
+thread_list = [1, 2, 4, 8, 16, 32, 64]
+phases = ["GetPGFS", "GetOptimalGFS", "total"]
+
+
+def run_fusion(circuit, total_qubit, threads):
+    # stdout line 0: reorder, diagonal, reorder2, GetPGFS, GetOptimalGFS, total
+    env = dict(os.environ, FUSION_THREADS=str(threads))
+    out = subprocess.run(["./fusion", circuit, "./tmp/scaling.txt", str(max_fusion_qubits), str(total_qubit), mode],
+                         capture_output=True, text=True, env=env, check=True)
+    times = [float(t) for t in out.stdout.splitlines()[0].split(",")]
+    return times[3:]
+
+
+if __name__ == '__main__':
+    os.makedirs("./tmp", exist_ok=True)
+    print("circuit, phase, " + ", ".join("%dT" % t for t in thread_list) + ", speedup")
+    sums = {phase: [0.0] * len(thread_list) for phase in phases}
+    for circuit in sorted(glob.glob("./circuit/*.txt")):
+        name = os.path.basename(circuit)
+        total_qubit = int(re.search(r"(\d+)\.txt$", name).group(1))
+        median = []
+        for threads in thread_list:
+            runs = [run_fusion(circuit, total_qubit, threads) for _ in range(repeat)]
+            median.append([statistics.median(r[i] for r in runs) for i in range(len(phases))])
+        for i, phase in enumerate(phases):
+            row = [m[i] for m in median]
+            for j, t in enumerate(row):
+                sums[phase][j] += t
+            print("%s, %s, %s, %.2f" % (name, phase, ", ".join("%.4f" % t for t in row), row[0] / max(min(row), 1e-9)))
+    for phase in phases:
+        row = sums[phase]
+        print("all, %s, %s, %.2f" % (phase, ", ".join("%.4f" % t for t in row), row[0] / max(min(row), 1e-9)))
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#include "ini.h"
+#include "common.h"
+#include "gate.h"
+#include "io_engine.h"
+#include "checkpoint.h"
+
+int ckpt_restore;
+unsigned int resume_gate;
+
+static int **ckpt_fd;           // ckpt_fd[slot][set*num_file + f]
+static int ckpt_slot = 1;       // 最後一次完成的slot，下一次寫另一個
+static int ckpt_due[2];         // thread 0決定，barrier後所有thread讀 (兩個輪流用)
+static int ckpt_round;
+#pragma omp threadprivate(ckpt_round)
+
+static double run_start;        // 第一個step開始的時間
+static double last_end;         // 上一次checkpoint結束的時間
+static double ckpt_time;        // checkpoint花掉的總時間
+static double ckpt_cost = -1;   // 上一次checkpoint的時間 (秒)，-1: 還沒有
+static ull num_step;            // 開始到現在經過的檢查點數量
+static unsigned int hash;       // circuit_hash()
+
+static char *meta_path(const char *name){
+    char *p = (char *)malloc(max_path + 32);
+    snprintf(p, max_path + 32, "%s/%s", CheckpointPath, name);
+    return p;
+}
+
+// 最後的gate陣列 (fusion, remap之後) 及qubit設定的hash，resume時要一樣
+static unsigned int circuit_hash(){
+    unsigned int h = 2166136261u;
+    #define MIX(x) do { unsigned long long v_ = (x); \
+        for (int b_ = 0; b_ < 8; b_++){ h ^= (v_ >> (8*b_)) & 0xff; h *= 16777619u; } } while(0)
+    MIX(N); MIX(file_segment); MIX(thread_segment); MIX(chunk_segment);
+    MIX(IsDensity); MIX(StateFormat); MIX(SetOfSaveState); MIX(total_gate);
+    for (unsigned int i = 0; i < total_gate; i++){
+        gate *g = &gateMap[i];
+        MIX(g->gate_ops); MIX(g->numCtrls); MIX(g->numTargs); MIX(g->val_num);
+        for (int j = 0; j < g->numCtrls; j++) MIX(g->ctrls[j]);
+        for (int j = 0; j < g->numTargs; j++) MIX(g->targs[j]);
+        for (int j = 0; j < g->val_num; j++){
+            double r = g->real_matrix[j], m = g->imag_matrix[j];
+            unsigned long long u;
+            memcpy(&u, &r, 8); MIX(u);
+            memcpy(&u, &m, 8); MIX(u);
+        }
+    }
+    #undef MIX
+    return h;
+}
+
+/*
+set_all時 (set_state_files之前) 呼叫: 開checkpoint file，resume時讀 checkpoint.ini 決定從哪裡繼續
+*/
+void checkpoint_init(){
+    resume_gate = 0;
+    ckpt_restore = 0;
+    if(!Checkpoint && !Resume)
+        return;
+    hash = circuit_hash();
+
+    mk_dir(CheckpointPath);
+    int num = SetOfSaveState*num_file;
+    ckpt_fd = (int **)malloc(2*sizeof(int *));
+    char name[64];
+    for (int slot = 0; slot < 2; slot++){
+        ckpt_fd[slot] = (int *)malloc(num*sizeof(int));
+        for (int i = 0; i < num; i++){
+            snprintf(name, sizeof(name), "slot%d_%d", slot, i);
+            char *p = meta_path(name);
+            ckpt_fd[slot][i] = open(p, O_RDWR|O_CREAT, 0666);
+            if(ckpt_fd[slot][i] < 0){
+                printf("[CHECKPOINT]: cannot open %s\n", p);
+                exit(1);
+            }
+            free(p);
+        }
+    }
+    if(!Resume)
+        return;
+
+    char *meta = meta_path("checkpoint.ini");
+    if(!file_exists(meta)){
+        printf("[CHECKPOINT]: no checkpoint in %s, start from gate 0\n", CheckpointPath);
+        free(meta);
+        return;
+    }
+    int gate_idx = read_profile_int("checkpoint", "gate", -1, meta);
+    int slot = read_profile_int("checkpoint", "slot", -1, meta);
+    unsigned int meta_hash = (unsigned int)read_profile_int("checkpoint", "hash", 0, meta);
+    if(gate_idx < 0 || gate_idx > total_gate || (slot != 0 && slot != 1)){
+        printf("[CHECKPOINT]: broken %s\n", meta);
+        exit(1);
+    }
+    if(meta_hash != hash){
+        printf("[CHECKPOINT]: %s was taken with another circuit or qubit setting\n", meta);
+        exit(1);
+    }
+    free(meta);
+
+    resume_gate = gate_idx;
+    ckpt_slot = slot;
+    ckpt_restore = 1;
+}
+
+/*
+set_state_files之後: resume時把checkpoint的state寫回 (每條thread自己那段)
+*/
+void checkpoint_restore(){
+    if(!ckpt_restore)
+        return;
+
+    #pragma omp parallel num_threads(num_thread)
+    {
+        int t = omp_get_thread_num();
+        void *buf = thread_settings[t].rd;
+        int f = t/num_thread_per_file;
+        int td = t%num_thread_per_file;
+        for (int set = 0; set < SetOfSaveState; set++){
+            int src = ckpt_fd[ckpt_slot][set*num_file + f];
+            for (ull off = td*thread_size; off < (td+1)*thread_size; off += chunk_size){
+                if(pread(src, buf, chunk_size, off) != (ssize_t)chunk_size){
+                    printf("[CHECKPOINT]: short checkpoint file (slot %d, set %d, file %d)\n", ckpt_slot, set, f);
+                    exit(1);
+                }
+                io_pwrite(fd_arr_set[set][f], buf, chunk_size, off);
+            }
+        }
+    }
+    printf("[CHECKPOINT]: resume from gate %u (slot %d)\n", resume_gate, ckpt_slot);
+}
+
+// (thread 0) 距離上一次checkpoint夠久了嗎
+static int checkpoint_due(){
+    double now = omp_get_wtime();
+    if(!num_step++){
+        run_start = last_end = now;
+        return 0;
+    }
+    double cost = ckpt_cost;
+    if(cost < 0)
+        cost = (now - run_start - ckpt_time) / (num_step-1) * SetOfSaveState;
+    double interval = CheckpointInterval > 0 ? CheckpointInterval : sqrt(2 * cost * CheckpointMtbf);
+    return now - last_end >= interval;
+}
+
+// (thread 0) fsync完checkpoint file才換掉 checkpoint.ini
+static void write_meta(unsigned int g, int slot){
+    int num = SetOfSaveState*num_file;
+    for (int i = 0; i < num; i++)
+        fsync(ckpt_fd[slot][i]);
+
+    char *tmp = meta_path("checkpoint.ini.tmp");
+    char *meta = meta_path("checkpoint.ini");
+    FILE *fp = fopen(tmp, "w");
+    if(!fp){
+        printf("[CHECKPOINT]: cannot write %s\n", tmp);
+        exit(1);
+    }
+    fprintf(fp, "[checkpoint]\ngate=%u\nslot=%d\nhash=%d\n", g, slot, (int)hash);
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    rename(tmp, meta);
+
+    int dir = open(CheckpointPath, O_RDONLY);
+    if(dir >= 0){
+        fsync(dir);
+        close(dir);
+    }
+    free(tmp);
+    free(meta);
+}
+
+/*
+(所有thread一起呼叫) gate g 之前: 必要時把目前的state存成checkpoint。
+取代原本這裡的barrier。
+*/
+void checkpoint_point(unsigned int g){
+    int t = omp_get_thread_num();
+    int k = ckpt_round++ & 1;
+
+    if(t == 0)
+        ckpt_due[k] = checkpoint_due();
+    #pragma omp barrier
+    if(!ckpt_due[k])
+        return;
+
+    double start = omp_get_wtime();
+    int slot = ckpt_slot ^ 1;
+    void *buf = thread_settings[t].rd;
+    int f = t/num_thread_per_file;
+    int td = t%num_thread_per_file;
+    for (int set = 0; set < SetOfSaveState; set++){
+        int dst = ckpt_fd[slot][set*num_file + f];
+        for (ull off = td*thread_size; off < (td+1)*thread_size; off += chunk_size){
+            io_pread(fd_arr_set[set][f], buf, chunk_size, off);
+            if(pwrite(dst, buf, chunk_size, off));
+        }
+    }
+    #pragma omp barrier
+    if(t == 0){
+        write_meta(g, slot);
+        ckpt_slot = slot;
+        last_end = omp_get_wtime();
+        ckpt_cost = last_end - start;
+        ckpt_time += ckpt_cost;
+        printf("[CHECKPOINT]: gate %u saved to slot %d, %.3f s\n", g, slot, ckpt_cost);
+        fflush(stdout);
+    }
+    #pragma omp barrier
+}
@@ -0,0 +1,37 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+/*===================================================================
+checkpoint guide
+
+在ini的[system]設定:
+    checkpoint=1              定期把state存到checkpoint_path
+    checkpoint_path=./ckpt    checkpoint的資料夾
+    checkpoint_interval=0     兩次checkpoint間隔的秒數，0: 依I/O成本自動決定
+    checkpoint_mtbf=3600      自動決定時，預估多久會中斷一次 (秒)
+    resume=1                  從checkpoint_path最後一次完成的checkpoint繼續
+
+checkpoint時每條thread把自己那段thread_state (每一組set_of_save_state) 複製到checkpoint file，
+fsync之後才寫入 checkpoint.ini (gate編號, slot)，寫tmp再rename，所以中途中斷時上一次的checkpoint仍然完整。
+checkpoint file有兩組 (slot 0/1) 輪流使用。
+
+只在gate之間、所有thread都停下來的地方 (本來就有barrier的step) 檢查要不要checkpoint，
+exec_plan太久沒有barrier時每 CKPT_MAX_GAP 個step補一個。
+自動間隔用 Young/Daly 的 sqrt(2 * C * MTBF)，C是一次checkpoint的時間:
+第一次checkpoint前以目前兩個檢查點之間的平均時間 * set_of_save_state 估計 (複製state跟一個gate一樣讀寫一次)，
+之後用實際量到的時間。
+
+resume時檢查circuit (gate數量及內容的hash) 及qubit設定跟checkpoint相同，
+把checkpoint的state寫回state file (不再初始化成 |0...0>)，從記錄的gate繼續執行。
+===================================================================*/
+
+#define CKPT_MAX_GAP 64
+
+extern int ckpt_restore;            // resume: state由checkpoint寫回，set_state_files不用初始化
+extern unsigned int resume_gate;    // 從第幾個gate開始執行
+
+void checkpoint_init();
+void checkpoint_restore();
+void checkpoint_point(unsigned int g);
+
+#endif
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "gate.h"
+#include "init.h"
+#include "circuit_bin.h"
+
+/*
+load_circuit_bin(path): path是binary circuit時載入gateMap並回傳1，不是 (文字格式) 回傳0
+*/
+int load_circuit_bin(char *path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        printf("no circuit file.\n");
+        exit(1);
+    }
+
+    circuit_bin_header h;
+    if(read(fd, &h, sizeof(h)) != sizeof(h) || memcmp(h.magic, CIRCUIT_BIN_MAGIC, 4)){
+        close(fd);
+        return 0;
+    }
+    if(h.version != CIRCUIT_BIN_VERSION || h.record_size != sizeof(circuit_bin_gate)){
+        printf("%s: unsupported binary circuit (version %u, record %u bytes)\n", path, h.version, h.record_size);
+        exit(1);
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    size_t pool_off = sizeof(h) + (size_t)h.num_gate * sizeof(circuit_bin_gate);
+    size_t len = pool_off + h.num_param * sizeof(double);
+    if((size_t)st.st_size < len){
+        printf("%s: truncated binary circuit (%lld bytes, expect %zu)\n", path, (long long)st.st_size, len);
+        exit(1);
+    }
+
+    // MAP_PRIVATE: rotate_axis, remap改寫參數時不會寫回file
+    void *map = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        perror("mmap circuit");
+        exit(1);
+    }
+    circuit_bin_gate *rec = (circuit_bin_gate *)((char *)map + sizeof(h));
+    double *pool = (double *)((char *)map + pool_off);
+
+    // Acc_t不是double時整個pool轉一次 (仍然只malloc一次)
+    Acc_t *param = (Acc_t *)pool;
+    if(sizeof(Acc_t) != sizeof(double)){
+        param = (Acc_t *)malloc(h.num_param * sizeof(Acc_t));
+        for (ull k = 0; k < h.num_param; k++)
+            param[k] = pool[k];
+    }
+
+    total_gate = h.num_gate;
+    gateMap = (gate *)malloc(total_gate * sizeof(gate));
+    for (unsigned int i = 0; i < total_gate; i++){
+        circuit_bin_gate *r = &rec[i];
+        gate *g = &gateMap[i];
+        g->gate_ops = r->gate_ops;
+        g->numCtrls = r->numCtrls;
+        g->numTargs = r->numTargs;
+        g->val_num = r->val_num;
+        check_gate(i, g);
+        if(r->val_num < 0 || (ull)r->param + 2*(ull)r->val_num > h.num_param){
+            printf("gate %u (op %d): parameters out of the pool\n", i, g->gate_ops);
+            exit(1);
+        }
+        for (int j = 0; j < g->numCtrls; j++)
+            g->ctrls[j] = r->ctrls[j];
+        for (int j = 0; j < g->numTargs; j++)
+            g->targs[j] = r->targs[j];
+        g->real_matrix = param + r->param;
+        g->imag_matrix = param + r->param + r->val_num;
+
+        normalize_gate(g);
+        g->action = 1;
+    }
+
+    printf("[CIRCUIT]: %u gates, %llu parameters (binary)\n", total_gate, (ull)h.num_param);
+    return 1;
+}
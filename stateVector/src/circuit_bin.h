@@ -0,0 +1,50 @@
+#ifndef CIRCUIT_BIN_H_
+#define CIRCUIT_BIN_H_
+
+#include <stdint.h>
+
+/*===================================================================
+binary circuit guide
+
+文字格式 (circuit/ops.txt) 每個gate都要fscanf，real/imag各malloc一次，
+gate數量還受ini的max_depth限制。-c 給的file開頭是 "QCB1" 時改用binary格式:
+
+    header            circuit_bin_header (32 bytes)
+    gate records      num_gate 個 circuit_bin_gate (32 bytes)
+    parameter pool    num_param 個double
+
+gate的real在pool的 [param, param+val_num)，imag緊接在後 [param+val_num, param+2*val_num)。
+相同的參數 (例如重複的角度、matrix) 可以指到pool的同一段 (op 21, 31, 32 除外，
+載入及remap時會直接改寫這些gate的參數)。所有數值都是little-endian。
+
+載入時整個file用mmap (MAP_PRIVATE) 讀進來，gateMap只malloc一次，
+Acc_t是double時gate的real_matrix/imag_matrix直接指到pool，不需要每個gate malloc，
+也沒有max_depth的限制。文字格式可以用 circuit_to_bin.py 轉換。
+===================================================================*/
+
+#define CIRCUIT_BIN_MAGIC   "QCB1"
+#define CIRCUIT_BIN_VERSION 1
+
+typedef struct circuit_bin_header {
+    char magic[4];          // CIRCUIT_BIN_MAGIC
+    uint32_t version;       // CIRCUIT_BIN_VERSION
+    uint32_t record_size;   // sizeof(circuit_bin_gate)
+    uint32_t num_gate;
+    uint64_t num_param;     // pool內double的數量
+    uint64_t reserved;
+} circuit_bin_header;
+
+typedef struct circuit_bin_gate {
+    int16_t gate_ops;
+    uint8_t numCtrls;
+    uint8_t numTargs;
+    int32_t val_num;
+    int32_t ctrls[3];       // measure, copy 的 set, shots 也放在這裡
+    int16_t targs[3];
+    uint16_t reserved;
+    uint32_t param;         // real在pool的起點，imag在 param+val_num
+} circuit_bin_gate;
+
+int load_circuit_bin(char *path);
+
+#endif
@@ -0,0 +1,53 @@
+# usage:
+# python3 circuit_to_bin.py circuit.txt circuit.qcb
+#
+# 把文字格式的circuit (circuit/ops.txt) 轉成binary格式 (circuit_bin.h)，
+# qSim.out -c 直接給轉好的file即可。相同的參數在pool內只存一次。
+
+import argparse
+import struct
+
+HEADER = struct.Struct("<4sIIIQQ")
+GATE = struct.Struct("<hBBi3i3hHI")
+VERSION = 1
+NO_SHARE = (21, 31, 32)  # 載入/remap時會改寫參數的op
+
+parser = argparse.ArgumentParser()
+parser.add_argument("input")
+parser.add_argument("output")
+args = parser.parse_args()
+
+with open(args.input) as f:
+    tok = f.read().split()
+it = iter(tok)
+num_gate = int(next(it))
+
+records = []
+pool = []
+shared = {}
+for i in range(num_gate):
+    op, nc, nt, nv = (int(next(it)) for _ in range(4))
+    if nc > 3 or nt > 3:
+        raise SystemExit(f"gate {i} (op {op}): at most 3 controls and 3 targets")
+    ctrls = [int(next(it)) for _ in range(nc)]
+    targs = [int(next(it)) for _ in range(nt)]
+    val = [float(next(it)) for _ in range(2 * nv)]  # real..., imag...
+
+    key = tuple(val)
+    if op not in NO_SHARE and key in shared:
+        param = shared[key]
+    else:
+        param = len(pool)
+        pool.extend(val)
+        if op not in NO_SHARE:
+            shared[key] = param
+    records.append(GATE.pack(op, nc, nt, nv,
+                             *(ctrls + [0] * (3 - nc)), *(targs + [0] * (3 - nt)), 0, param))
+
+with open(args.output, "wb") as f:
+    f.write(HEADER.pack(b"QCB1", VERSION, GATE.size, num_gate, len(pool), 0))
+    for r in records:
+        f.write(r)
+    f.write(struct.pack(f"<{len(pool)}d", *pool))
+
+print(f"{args.input}: {num_gate} gates, {len(pool)} parameters -> {args.output}")
@@ -10,6 +10,12 @@
 #include "common.h"
 #include "gate.h"
 #include "measure.h"
+#include "diag.h"
+#include "gate_mc.h"
+#include "checkpoint.h"
+#include "plan.h"
+#include "density.h"
+#include "expect.h"
 
 unsigned int N;
 unsigned int thread_segment;
@@ -23,6 +29,9 @@ unsigned int max_depth; // 最多一千的 gates
 char **state_paths;
 int **fd_arr_set; //int fd_arr_set [set][num_file];
 int *fd_arr; //int fd_arr [num_file];
+char **stripe_paths;
+int *stripe_fd; //int stripe_fd [num_stripe];
+int num_stripe;
 int **multi_res;
 int *single_res;
 
@@ -44,6 +53,30 @@ Type *q_read;
 int IsDensity;
 int SkipInithread_state;
 int SetOfSaveState;
+int IoEngine;
+int IoDepth;
+int MultiGate;
+int Remap;
+int RemapWindow;
+int Simd;
+int SimdCheck;
+int StateFormat;
+int MemDump;
+int StripeWorkers;
+int ZeroChunk;
+int DirectIo;
+int IoAdvice;
+int DiagFusion;
+int Sampling;
+int Fusion;
+int FusionMaxQubit;
+int ExecPlan;
+int Checkpoint;
+int CheckpointInterval;
+int CheckpointMtbf;
+int Resume;
+char *CheckpointPath;
+char *Observable;
 
 inline int file_exists(char *filename) {
     struct stat buffer;
@@ -69,172 +102,253 @@ void run_simulator (){
 
     // call gates
     srand(time(NULL));
+    if(ExecPlan){
+        plan_run();
+        return;
+    }
     #pragma omp parallel
     {
-        int t = omp_get_thread_num();
-
-        for (int i = 0; i < total_gate; i++){
-            gate *g = gateMap+i;
-            real = g->real_matrix;
-            imag = g->imag_matrix;
-
-            switch(g->gate_ops){
-                case 0: // H
-                case 1: // S
-                case 2: // T
-                case 3: // X
-                case 4: // Y
-                case 5: // Z
-                case 6: // Phase
-                case 7: // Unitary 1-qubit gate
-                    single_gate (g->targs[0]+N/2*IsDensity, g->gate_ops, 0);
-                    break;
-
-                case 8:     // CX
-                case 9:     // CY
-                case 10:    // CZ
-                case 11:    // CPhase
-                case 12:    // Control-Unitary 1-qubit gate
-                    control_gate(g->ctrls[0]+N/2*IsDensity, g->targs[0]+N/2*IsDensity, g->gate_ops, 0);
-                    break;
-
-                case 13:
-                    SWAP (g->targs[0]+N/2*IsDensity, g->targs[1]+N/2*IsDensity, 0);
-                    break;
-                
-                // case 14:
-                //     Toffoli (g.ctrls[0], g.ctrls[1], g.targs[0], q_read, q_write, fd_1, fd_2, fd_arr); 
-                //     break;
-
-                case 14:
-                    break;
-
-                case 20: // measure one qubit
-                    if(t==0){
-                        single_res = (int*)malloc(g->ctrls[2]*sizeof(int));
-                    }
-                    for(int shot = 0; shot < g->ctrls[2]; shot++){
-                        save_state(g->ctrls[0], g->ctrls[1]);
-                #pragma omp barrier
+        for (int i = resume_gate; i < total_gate; i++){
+            if(Checkpoint)
+                checkpoint_point(i);
+            i += run_gate(gateMap+i, total_gate-i) - 1;
+        }
+    }
+}
 
-                        measure(g->targs[0], g->ctrls[1]);
-                #pragma omp barrier
+/*
+gate_run: 從g開始 (後面還有num個gate) 這一步要怎麼執行，回傳這一步用掉的gate數量
+    RUN_DIAG:  連續的diagonal gate合併成一次pass，multi_gate能合併更多gate時讓給multi_gate
+    RUN_MULTI: 連續的local gate (multi_gate)
+    RUN_ONE:   一個gate
+*/
+int gate_run(gate *g, int num, int *kind){
+    if(DiagFusion){
+        int n = diag_run(g, num);
+        if(n > 0 && !(MultiGate && !IsDensity && local_run(g, num) > n)){
+            *kind = RUN_DIAG;
+            return n;
+        }
+    }
 
-                        if(t==0) single_res[shot] = real[1];
-                    }
+    if(MultiGate && !IsDensity){
+        int n = local_run(g, num);
+        if(n > 1){
+            *kind = RUN_MULTI;
+            return n;
+        }
+    }
 
-                    if(t == 0){
-                        for(int shot = 0; shot < g->ctrls[2]; shot++){
-                            printf("[MEASURE]: %d\n", single_res[shot]);
-                        }
-                        fflush(stdout);
-                        free(single_res);
-                    }
+    *kind = RUN_ONE;
+    return 1;
+}
 
-                    break;
+/*
+run_gate: (所有thread一起呼叫) 執行從g開始的一步，回傳用掉的gate數量
+*/
+int run_gate(gate *g, int num){
+    int t = omp_get_thread_num();
+    int kind;
+    int n = gate_run(g, num, &kind);
+
+    if(kind == RUN_DIAG){
+        diag_gate(g, n);
+        #pragma omp barrier
+        return n;
+    }
 
-                case 21: // measure multi qubits
-                    if(t==0){
-                        multi_res = (int**)malloc(g->ctrls[2]*sizeof(int*));
-                        for(int shot = 0; shot < g->ctrls[2]; shot++){
-                            multi_res[shot] = (int*)malloc(g->val_num*sizeof(int));
-                        }
-                    }
-                    for(int shot = 0; shot < g->ctrls[2]; shot++){
-                        save_state(g->ctrls[0], g->ctrls[1]);
-                #pragma omp barrier
+    if(kind == RUN_MULTI){
+        multi_gate(g, n, NULL);
+        #pragma omp barrier
+        return n;
+    }
 
-                        for(int q = 0; q < g->val_num; q++){
-                            measure((int)(g->imag_matrix[q]), g->ctrls[1]);
-                #pragma omp barrier
+    real = g->real_matrix;
+    imag = g->imag_matrix;
+
+    switch(g->gate_ops){
+        case 0: // H
+        case 1: // S
+        case 2: // T
+        case 3: // X
+        case 4: // Y
+        case 5: // Z
+        case 6: // Phase
+        case 7: // Unitary 1-qubit gate
+            single_gate (g->targs[0]+N/2*IsDensity, g->gate_ops, 0);
+            break;
+
+        case 8:     // CX
+        case 9:     // CY
+        case 10:    // CZ
+        case 11:    // CPhase
+        case 12:    // Control-Unitary 1-qubit gate
+            control_gate(g->ctrls[0]+N/2*IsDensity, g->targs[0]+N/2*IsDensity, g->gate_ops, 0);
+            break;
+
+        case 13:
+            SWAP (g->targs[0]+N/2*IsDensity, g->targs[1]+N/2*IsDensity, 0);
+            break;
+        
+        case 14:    // MCX (Toffoli)
+        case 15:    // MCZ
+        case 16:    // MCPhase
+        case 17:    // MCU 1-qubit gate
+            mc_gate(g, 0);
+            break;
+
+        case 20: // measure one qubit
+            if(t==0){
+                single_res = (int*)malloc(g->ctrls[2]*sizeof(int));
+            }
+            // 一次從state抽出所有shot (measure.c的sampling)
+            if(Sampling && !IsDensity){
+                ull *idx = sample_states(g->ctrls[0], g->ctrls[2]);
+                if(t==0)
+                    for(int shot = 0; shot < g->ctrls[2]; shot++)
+                        single_res[shot] = (idx[shot] >> (N-1-g->targs[0])) & 1;
+            }
+            else
+            for(int shot = 0; shot < g->ctrls[2]; shot++){
+                save_state(g->ctrls[0], g->ctrls[1]);
+        #pragma omp barrier
 
-                            if(t==0) multi_res[shot][q] = real[1];
-                        }
-                    }
+                measure(g->targs[0], g->ctrls[1]);
+        #pragma omp barrier
 
-                    if(t == 0){
-                        for(int shot = 0; shot < g->ctrls[2]; shot++){
-                            printf("[MEASURE]: ");
-                            for(int q = 0; q < g->val_num; q++){
-                                printf("%d", multi_res[shot][q]);
-                            }
-                            printf("\n");
-                        }
-                        fflush(stdout);
-                        for(int shot = 0; shot < g->ctrls[2]; shot++){
-                            free(multi_res[shot]);
-                        }
-                        free(multi_res);
-                    }
+                if(t==0) single_res[shot] = real[1];
+            }
 
-                    break;
-                
-                case 22: // copy
-                    save_state(g->ctrls[0], g->ctrls[1]);
-                    break;
+            if(t == 0){
+                for(int shot = 0; shot < g->ctrls[2]; shot++){
+                    printf("[MEASURE]: %d\n", single_res[shot]);
+                }
+                fflush(stdout);
+                free(single_res);
+            }
 
-                case 31: // Unitary 2-qubit gate
-                    unitary4x4 (g->targs[0]+N/2*IsDensity, g->targs[1]+N/2*IsDensity, 0);
-                    break;
+            break;
 
-                case 32: // Unitary 3-qubit gate
-                    unitary8x8 (g->targs[0]+N/2*IsDensity, g->targs[1]+N/2*IsDensity, g->targs[2]+N/2*IsDensity, 0);
-                    break;
+        case 21: // measure multi qubits
+            if(t==0){
+                multi_res = (int**)malloc(g->ctrls[2]*sizeof(int*));
+                for(int shot = 0; shot < g->ctrls[2]; shot++){
+                    multi_res[shot] = (int*)malloc(g->val_num*sizeof(int));
+                }
+            }
+            if(Sampling && !IsDensity){
+                ull *idx = sample_states(g->ctrls[0], g->ctrls[2]);
+                if(t==0)
+                    for(int shot = 0; shot < g->ctrls[2]; shot++)
+                        for(int q = 0; q < g->val_num; q++)
+                            multi_res[shot][q] = (idx[shot] >> (N-1-(int)(g->imag_matrix[q]))) & 1;
+            }
+            else
+            for(int shot = 0; shot < g->ctrls[2]; shot++){
+                save_state(g->ctrls[0], g->ctrls[1]);
+        #pragma omp barrier
+
+                for(int q = 0; q < g->val_num; q++){
+                    measure((int)(g->imag_matrix[q]), g->ctrls[1]);
+        #pragma omp barrier
 
-                default:
-                    printf("no such gate.\n");
-                    exit(1);
+                    if(t==0) multi_res[shot][q] = real[1];
+                }
             }
 
-            #pragma omp barrier
-            
-            if(IsDensity){
-                switch(g->gate_ops){
-                    case 0: // H
-                    case 1: // S
-                    case 2: // T
-                    case 3: // X
-                    case 4: // Y
-                    case 5: // Z
-                    case 6: // Phase
-                    case 7: // Unitary 1-qubit gate
-                        single_gate(g->targs[0], g->gate_ops, 1);
-                        break;
-
-                    case 8:     // CX
-                    case 9:     // CY
-                    case 10:    // CZ
-                    case 11:    // CPhase
-                    case 12:    // Control-Unitary 1-qubit gate
-                        control_gate(g->ctrls[0], g->targs[0], g->gate_ops, 1);
-                        break;
-
-                    case 13:
-                        SWAP (g->targs[0], g->targs[1], 1);
-                        break;
-
-                    // case 14:
-                    //     Toffoli (g.ctrls[0], g.ctrls[1], g.targs[0], q_read, q_write, fd_1, fd_2, fd_arr);
-                    //     break;
-
-                    case 14:
-                        break;
-
-                    case 31: // Unitary 2-qubit gate
-                        unitary4x4 (g->targs[0], g->targs[1], 1);
-                        break;
-
-                    case 32: // Unitary 3-qubit gate
-                        unitary8x8 (g->targs[0], g->targs[1], g->targs[2], 0);
-                        break;
-
-                    default:
-                        printf("no such gate.\n");
-                        exit(1);
+            if(t == 0){
+                for(int shot = 0; shot < g->ctrls[2]; shot++){
+                    printf("[MEASURE]: ");
+                    for(int q = 0; q < g->val_num; q++){
+                        printf("%d", multi_res[shot][q]);
+                    }
+                    printf("\n");
                 }
-                #pragma omp barrier
+                fflush(stdout);
+                for(int shot = 0; shot < g->ctrls[2]; shot++){
+                    free(multi_res[shot]);
+                }
+                free(multi_res);
             }
 
+            break;
+        
+        case 22: // copy
+            save_state(g->ctrls[0], g->ctrls[1]);
+            break;
+
+        case 23: // qubit swap (remap)
+            qubit_swap(g);
+            break;
+
+        case 26: // expectation value of the observable
+            expect(g->ctrls[0]);
+            break;
+
+        case 31: // Unitary 2-qubit gate
+            unitary4x4 (g->targs[0]+N/2*IsDensity, g->targs[1]+N/2*IsDensity, 0);
+            break;
+
+        case 32: // Unitary 3-qubit gate
+            unitary8x8 (g->targs[0]+N/2*IsDensity, g->targs[1]+N/2*IsDensity, g->targs[2]+N/2*IsDensity, 0);
+            break;
+
+        case DENSITY_SUPEROP: // density matrix: (q, q+N/2) 的superoperator，conj那一半已經算在裡面
+            unitary4x4 (g->targs[0], g->targs[1], 0);
+            break;
+
+        default:
+            printf("no such gate.\n");
+            exit(1);
+    }
+
+    #pragma omp barrier
+    
+    if(IsDensity && g->gate_ops != DENSITY_SUPEROP){
+        switch(g->gate_ops){
+            case 0: // H
+            case 1: // S
+            case 2: // T
+            case 3: // X
+            case 4: // Y
+            case 5: // Z
+            case 6: // Phase
+            case 7: // Unitary 1-qubit gate
+                single_gate(g->targs[0], g->gate_ops, 1);
+                break;
+
+            case 8:     // CX
+            case 9:     // CY
+            case 10:    // CZ
+            case 11:    // CPhase
+            case 12:    // Control-Unitary 1-qubit gate
+                control_gate(g->ctrls[0], g->targs[0], g->gate_ops, 1);
+                break;
+
+            case 13:
+                SWAP (g->targs[0], g->targs[1], 1);
+                break;
+
+            case 14:    // MCX (Toffoli)
+            case 15:    // MCZ
+            case 16:    // MCPhase
+            case 17:    // MCU 1-qubit gate
+                mc_gate(g, 1);
+                break;
+
+            case 31: // Unitary 2-qubit gate
+                unitary4x4 (g->targs[0], g->targs[1], 1);
+                break;
+
+            case 32: // Unitary 3-qubit gate
+                unitary8x8 (g->targs[0], g->targs[1], g->targs[2], 1);
+                break;
+
+            default:
+                printf("no such gate.\n");
+                exit(1);
         }
+        #pragma omp barrier
     }
+    return 1;
 }
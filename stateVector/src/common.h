@@ -4,7 +4,24 @@
 
 // typedef
 typedef unsigned long long ull;
+/*
+precision (build time): make PRECISION=double|mixed|float
+    double: state與kernel運算都用double (default)
+    mixed:  state (file及buffer) 存float，kernel內用double運算
+    float:  都用float
+Type_t 是state的型態，Acc_t 是kernel內運算及gate matrix的型態
+*/
+#if defined(PRECISION_FLOAT)
+typedef float Type_t;
+typedef float Acc_t;
+#elif defined(PRECISION_MIXED)
+typedef float Type_t;
+typedef double Acc_t;
+#else
+#define PRECISION_DOUBLE
 typedef double Type_t;
+typedef double Acc_t;
+#endif
 typedef struct {
     Type_t real;
     Type_t imag;
@@ -22,11 +39,38 @@ extern unsigned int max_depth; // 最多一千的 gates
 extern char **state_paths;
 extern int *fd_arr; //int fd_arr [num_file];
 extern int **fd_arr_set; //int fd_arr_set [set][num_file];
+extern char **stripe_paths; // io_engine=4: one file per device
+extern int *stripe_fd; //int stripe_fd [num_stripe];
+extern int num_stripe;
 extern Type *q_read;
 // extern Type *q_write;
 extern int IsDensity;
 extern int SkipInithread_state;
 extern int SetOfSaveState;
+extern int IoEngine; // 0: sync, 1: POSIX AIO, 2: io_uring, 3: memory, 4: stripe
+extern int IoDepth; // chunk groups in flight per thread
+extern int MultiGate; // apply runs of local gates per chunk load
+extern int Remap; // insert qubit swaps to keep gates on local qubits
+extern int RemapWindow; // lookahead (gates) of the remap pass
+extern int Simd; // 0: scalar, 1: best available, 2: up to AVX2
+extern int SimdCheck; // compare SIMD kernels with scalar ones at startup
+extern int StateFormat; // 0: interleaved {real, imag}, 1: SoA planes per chunk
+extern int MemDump; // memory/stripe engine: write the state to state_paths at the end
+extern int StripeWorkers; // I/O worker threads per device of the stripe engine
+extern int ZeroChunk; // track all-zero chunks, skip their I/O and the gates on them (zchunk.h)
+extern int DirectIo; // open state files with O_DIRECT (bypass the page cache)
+extern int IoAdvice; // posix_fadvise policy of state files in buffered mode
+extern int DiagFusion; // fuse runs of diagonal gates, skip chunks they leave unchanged
+extern int Sampling; // op 20/21: draw all shots from one pass instead of copy + measure per shot
+extern int Fusion; // fuse neighbouring 1-3 qubit gates into one dense gate while loading the circuit
+extern int FusionMaxQubit; // max qubits of a fused gate (1-3)
+extern int ExecPlan; // run gates from the execution plan built at load time (plan.h)
+extern int Checkpoint; // save the state periodically (checkpoint.h)
+extern int CheckpointInterval; // seconds between checkpoints, 0: from the estimated checkpoint cost
+extern int CheckpointMtbf; // expected seconds between failures for the automatic interval
+extern int Resume; // restart from the last checkpoint
+extern char *CheckpointPath;
+extern char *Observable; // Pauli strings evaluated by op 26 (expect.h)
 
 extern ull num_file; // for extending to more devices
 extern ull num_thread; // number of thread
@@ -46,6 +90,13 @@ extern ull buffer_size; // buffer_size for each thread
 // usually use
 #define PI 3.14159265358979
 
+// io_advice (buffered mode only)
+#define IO_ADVICE_NONE       0
+#define IO_ADVICE_SEQUENTIAL 1 // larger readahead window
+#define IO_ADVICE_RANDOM     2 // no readahead
+#define IO_ADVICE_WILLNEED   3 // prefetch the whole file (skip_init_state)
+#define DIRECT_ALIGN 4096 // buffer alignment, must be a multiple of the logical block size
+
 // time measure
 #define MEASURET_START \
     struct timeval start; \
@@ -65,8 +116,16 @@ extern ull buffer_size; // buffer_size for each thread
 #define isMiddle(target) ((target >= thread_segment) && (target < N-chunk_segment) ? 1 : 0)
 #define isLocal(target) ((target >= N - chunk_segment) ? 1 : 0)
 
+// gate_run kind
+#define RUN_ONE   0
+#define RUN_DIAG  1 // diag_fusion
+#define RUN_MULTI 2 // multi_gate
+
 int file_exists(char *filename);
 int mk_dir(char *dir);
 void run_simulator();
+struct gate;
+int gate_run(struct gate *g, int num, int *kind);
+int run_gate(struct gate *g, int num);
 
 #endif
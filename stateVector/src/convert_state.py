@@ -0,0 +1,41 @@
+# usage:
+# python3 convert_state.py --local_qbit NLQB --to soa state/state00 state/state01 ...
+# python3 convert_state.py --local_qbit NLQB --to aos state/state00 state/state01 ...
+#
+# 在 interleaved ({real, imag}) 與 SoA (每個chunk內 [real...][imag...]) 兩種
+# state file格式之間互轉 (in-place)。NLQB 要跟ini的 local_qbit 相同。
+
+import argparse
+from array import array
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--local_qbit", type=int, required=True)
+parser.add_argument("--to", choices=["soa", "aos"], required=True)
+parser.add_argument("--type", choices=["d", "f"], default="d", help="d: double, f: float")
+parser.add_argument("files", nargs="+")
+args = parser.parse_args()
+
+chunk_state = 1 << args.local_qbit
+
+for path in args.files:
+    with open(path, "r+b") as f:
+        off = 0
+        while True:
+            f.seek(off)
+            buf = array(args.type)
+            try:
+                buf.fromfile(f, 2 * chunk_state)
+            except EOFError:
+                if len(buf):
+                    raise SystemExit(f"{path}: size is not a multiple of the chunk size")
+                break
+            if args.to == "soa":
+                out = buf[0::2] + buf[1::2]
+            else:
+                out = array(args.type, [0]) * (2 * chunk_state)
+                out[0::2] = buf[:chunk_state]
+                out[1::2] = buf[chunk_state:]
+            f.seek(off)
+            out.tofile(f)
+            off += 2 * chunk_state * buf.itemsize
+    print(f"{path}: converted to {args.to}")
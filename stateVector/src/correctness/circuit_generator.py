@@ -49,6 +49,10 @@ def CPhase(circuit, control, target, angle):
 def CU1(circuit, control, target, real:list, imag:list):
     circuit.append(f"12 1 1 4  {control} {target} {' '.join(map(str, real))} {' '.join(map(str, imag))}")
 
+# density matrix only, real/imag: k個row-major 2x2 Kraus matrix接在一起
+def KrausChannel(circuit, qbit, real:list, imag:list):
+    circuit.append(f"24 0 1 {len(real)}  {qbit} {' '.join(map(str, real))} {' '.join(map(str, imag))}")
+
 def SWAP(circuit, target1, target2):
     circuit.append(f'13 0 2 0 {target1} {target2}')
 
@@ -63,6 +67,14 @@ def U2(circuit, q0, q1, real:list, imag:list):
 def CCX_true(circuit, ctrl0, ctrl1, targ):
     circuit.append(f"14 2 1 0  {ctrl0} {ctrl1} {targ}")
 
+# multi-controlled gate, ctrls: 1~3 control qubits
+def MCZ(circuit, ctrls:list, targ):
+    circuit.append(f"15 {len(ctrls)} 1 0  {' '.join(map(str, ctrls))} {targ}")
+def MCPhase(circuit, ctrls:list, targ, angle):
+    circuit.append(f"16 {len(ctrls)} 1 1  {' '.join(map(str, ctrls))} {targ} {angle} 0")
+def MCU1(circuit, ctrls:list, targ, real:list, imag:list):
+    circuit.append(f"17 {len(ctrls)} 1 4  {' '.join(map(str, ctrls))} {targ} {' '.join(map(str, real))} {' '.join(map(str, imag))}")
+
 def CCX(circuit, ctrl0, ctrl1, targ):
     if ctrl0 == ctrl1 or ctrl0 == targ or ctrl1 == targ:
         print(f"c0:{ctrl0}, c1:{ctrl1}, t:{targ} must not be the same qubit.")
@@ -169,6 +181,10 @@ def U3(circuit, q0, q1, q2, real:list, imag:list):
 def COPY(circuit, set_src, set_dst):
     circuit.append(f"22 2 0 0 {set_src} {set_dst}")
 
+# 印出ini的observable在set_src上的期望值
+def EXPECT(circuit, set_src = 0):
+    circuit.append(f"26 1 0 0 {set_src}")
+
 def inverse_qft_phase_on_work_section(circuit,work_section):
     H(circuit,work_section[0])
     for id in range(1,len(work_section)):
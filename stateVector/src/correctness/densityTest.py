@@ -0,0 +1,90 @@
+from circuit_generator import *
+from ini_generator import *
+from test_util import *
+
+# Test for density matrix: Kraus channel (op 24) and 1-qubit gates as single pass superoperator
+
+# n    =  6 (total_qbit = 2n)
+# NGQB =  1
+# NSQB =  2
+# NLQB =  7
+# column qubit q: Global 0, Thread 1, Middle 2-4, Local 5 (row qubit q+n 都是local)
+
+class densityTest:
+    def __init__(self):
+        self.setting = {'total_qbit':'12',
+                        'global_qbit':'1',
+                        'thread_qbit':'2',
+                        'local_qbit':'7',
+                        'max_qbit':'38',
+                        'is_density':'1',
+                        'state_paths':'./state/path1,./state/path2,./state/path3,./state/path4,./state/path5,./state/path6,./state/path7,./state/path8,./state/path9,./state/path10,./state/path11,./state/path12,./state/path13,./state/path14,./state/path15,./state/path16'}
+        self.ini_path='test.ini'
+        self.cir_path='cir_test'
+
+        self.n    =  6
+        self.NGQB =  1
+
+        self.qubit_type = ["Global", "Thread", "Middle", "Local"]
+        self.range_type = [range(1), range(1, 2), range(2, 5), range(5, 6)]
+        self.rng = np.random.default_rng(24)
+
+    def _random_u1(self, circuit, qbit):
+        q, r = np.linalg.qr(self.rng.normal(size=(2, 2)) + 1j*self.rng.normal(size=(2, 2)))
+        u = (q * (np.diag(r) / np.abs(np.diag(r)))).reshape(-1)
+        U1(circuit, qbit, list(u.real), list(u.imag))
+
+    def _channel(self, circuit, channel, qbit):
+        if channel == "amplitude damping":
+            gamma = self.rng.uniform(0.1, 0.9)
+            KrausChannel(circuit, qbit, [1, 0, 0, sqrt(1-gamma), 0, sqrt(gamma), 0, 0], [0]*8)
+        if channel == "depolarizing":
+            p = self.rng.uniform(0.1, 0.9)
+            a, b = sqrt(1-3*p/4), sqrt(p/4)
+            # I, X, Y, Z
+            KrausChannel(circuit, qbit, [a, 0, 0, a,  0, b, b, 0,  0, 0, 0, 0,  b, 0, 0, -b],
+                                        [0, 0, 0, 0,  0, 0, 0, 0,  0, -b, b, 0,  0, 0, 0, 0])
+
+    def _test(self, name, x_range):
+        flag = True
+        for x in x_range:
+            for channel in ["amplitude damping", "depolarizing"]:
+                circuit=get_circuit()
+                for i in range(self.n):
+                    H(circuit, i)
+                    self._random_u1(circuit, i)
+                S(circuit, x)
+                T(circuit, x)
+                Y(circuit, x)
+                self._channel(circuit, channel, x)
+                self._random_u1(circuit, x)
+                self._channel(circuit, channel, x)
+                create_circuit(circuit, self.cir_path)
+
+                os.system(f"../qSim.out -i {self.ini_path} -c {self.cir_path} >> /dev/null")
+                fd_state = read_state("../path/set7.txt", 2*self.n, self.NGQB)
+                flag = flag and check(fd_state, set_density_matrix(self.cir_path, self.n), 2*self.n, self.NGQB)
+                if(not flag):
+                    print("[x]", f"{channel} {name}", "not pass under 1e-9", flush=True)
+                    break
+            if(not flag): break
+
+        if(not flag):
+            print("[X]", name, ": not pass under 1e-9", flush=True)
+            print("===========================")
+        return flag
+
+    def test(self):
+        create_ini(self.setting, self.ini_path)
+        flag = True
+        for i in range(4):
+            test_name = f"{self.qubit_type[i]}"
+            flag = self._test(test_name, self.range_type[i])
+            if not flag:    break
+
+        if(flag):
+            print("[PASS]", "densityTest", ": match with qiskit under 1e-9", flush=True)
+        else:
+            print("[x]", "densityTest", ": not pass under 1e-9", flush=True)
+        print("===========================")
+        return flag
@@ -0,0 +1,106 @@
+from circuit_generator import *
+from ini_generator import *
+from test_util import *
+from qiskit.quantum_info import Statevector, SparsePauliOp
+
+# Test for expectation value (op 26)
+
+# N    = 12
+# NGQB =  2
+# NSQB =  4
+# NLQB =  5
+
+class expectTest:
+    def __init__(self):
+        self.setting = {'total_qbit':'12',
+                        'global_qbit':'2',
+                        'thread_qbit':'4',
+                        'local_qbit':'5',
+                        'max_qbit':'38',
+                        'observable':'./obs_test',
+                        'state_paths':'./state/path1,./state/path2,./state/path3,./state/path4,./state/path5,./state/path6,./state/path7,./state/path8,./state/path9,./state/path10,./state/path11,./state/path12,./state/path13,./state/path14,./state/path15,./state/path16'}
+        self.ini_path='test.ini'
+        self.cir_path='cir_test'
+        self.obs_path='obs_test'
+
+        self.N    = 12
+        self.NGQB =  2
+        self.NSQB =  4
+        self.NLQB =  5
+
+        self.qubit_type = ["Global", "Thread", "Middle", "Local"]
+        self.range_type = [range(2), range(2, 4), range(4, 7), range(7, 12)]
+        self.rng = np.random.default_rng(26)
+
+    def _random_u1(self, circuit, qbit):
+        q, r = np.linalg.qr(self.rng.normal(size=(2, 2)) + 1j*self.rng.normal(size=(2, 2)))
+        u = (q * (np.diag(r) / np.abs(np.diag(r)))).reshape(-1)
+        U1(circuit, qbit, list(u.real), list(u.imag))
+
+    # Pauli string: {qubit: 'X'|'Y'|'Z'}
+    def _random_term(self, paulis):
+        for q in self.rng.permutation(self.N)[0:2]:
+            if q not in paulis:
+                paulis[int(q)] = self.rng.choice(['X', 'Y', 'Z'])
+        return paulis
+
+    def _test(self, name, x_range, y_range):
+        # X/Y on a qubit of each type, the rest random
+        terms = [{}]
+        for _ in range(4):
+            x = int(self.rng.choice(x_range))
+            y = int(self.rng.choice([q for q in y_range if q != x]))
+            terms.append(self._random_term({x: self.rng.choice(['X', 'Y']), y: self.rng.choice(['X', 'Y'])}))
+        terms.append(self._random_term({}))
+        coefs = self.rng.uniform(-1, 1, len(terms))
+
+        f = open(self.obs_path, 'w')
+        for coef, paulis in zip(coefs, terms):
+            print(coef, *[f"{p}{q}" for q, p in sorted(paulis.items())], file=f)
+        f.close()
+
+        circuit=get_circuit()
+        for i in range(12):
+            H(circuit, i)
+            self._random_u1(circuit, i)
+        for i in range(11):
+            CX(circuit, i, i+1)
+        for i in range(12):
+            self._random_u1(circuit, i)
+        EXPECT(circuit)
+        create_circuit(circuit, self.cir_path)
+
+        out = os.popen(f"../qSim.out -i {self.ini_path} -c {self.cir_path}").read()
+        # [EXPECT]: <P_k> = ... 照file的順序，最後是 <H>
+        values = [float(v) for v in re.findall(r"\[EXPECT\]: <.*> = (\S+)", out)]
+
+        state = Statevector(qiskit_init_state_vector(set_circuit(self.cir_path, self.N)))
+        labels = []
+        for paulis in terms:
+            # Qiskit label: 最左邊是 qubit N-1 (= 本模擬器的 qubit 0)
+            labels.append("".join(paulis.get(q, 'I') for q in range(self.N)))
+        expected = [state.expectation_value(SparsePauliOp(label)).real for label in labels]
+        expected.append(state.expectation_value(SparsePauliOp.from_list(list(zip(labels, coefs)))).real)
+
+        flag = len(values) == len(expected) and np.allclose(values, expected, rtol=0, atol=1e-9)
+        if(not flag):
+            print("[X]", name, ": not pass under 1e-9", flush=True)
+            print("===========================")
+        return flag
+
+    def test(self):
+        create_ini(self.setting, self.ini_path)
+        flag = True
+        for i in range(4):
+            for j in range(i, 4):
+                test_name = f"{self.qubit_type[i]}-{self.qubit_type[j]}"
+                flag = self._test(test_name, self.range_type[i], self.range_type[j])
+                if not flag:    break
+            if not flag:    break
+
+        if(flag):
+            print("[PASS]", "expectTest", ": match with qiskit under 1e-9", flush=True)
+        else:
+            print("[x]", "expectTest", ": not pass under 1e-9", flush=True)
+        print("===========================")
+        return flag
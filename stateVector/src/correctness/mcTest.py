@@ -0,0 +1,106 @@
+from circuit_generator import *
+from ini_generator import *
+from test_util import *
+
+# Test for multi-controlled gates: MCZ, MCPhase, MCU1 (op 15, 16, 17)
+
+# N    = 12
+# NGQB =  3
+# NSQB =  6
+# NLQB =  3
+
+class mcTest:
+    def __init__(self):
+        self.setting = {'total_qbit':'12',
+                        'global_qbit':'3',
+                        'thread_qbit':'6',
+                        'local_qbit':'3',
+                        'max_qbit':'38',
+                        'state_paths':'./state/path1,./state/path2,./state/path3,./state/path4,./state/path5,./state/path6,./state/path7,./state/path8,./state/path9,./state/path10,./state/path11,./state/path12,./state/path13,./state/path14,./state/path15,./state/path16'}
+        self.ini_path='test.ini'
+        self.cir_path='cir_test'
+
+        self.N    = 12
+        self.NGQB =  3
+        self.NSQB =  6
+        self.NLQB =  3
+
+        self.qubit_type = ["Global", "Thread", "Middle", "Local"]
+        self.range_type = [range(3), range(3, 6), range(6, 9), range(9, 12)]
+
+        self.real = [ 0.28632032, -0.47273926,
+                     -0.84618156, -0.08260835]
+        self.imag = [ 0.25736406, 0.79265503,
+                     -0.36845784, 0.37602054]
+
+    def _run(self, name, ctrls, targ):
+        flag = True
+        for gate in ["MCZ", "MCPhase", "MCU1"]:
+            circuit=get_circuit()
+            for i in range(12):
+                H(circuit, i)
+            if gate == "MCZ":
+                MCZ(circuit, ctrls, targ)
+            if gate == "MCPhase":
+                MCPhase(circuit, ctrls, targ, 0.7853981633974483)
+            if gate == "MCU1":
+                MCU1(circuit, ctrls, targ, self.real, self.imag)
+            create_circuit(circuit, self.cir_path)
+
+            os.system(f"../qSim.out -i {self.ini_path} -c {self.cir_path} >> /dev/null")
+            flag = flag and simple_test(f"{gate} {name}", False, self.cir_path, "../path/set7.txt", self.N, self.NGQB, True)
+            if(not flag): break
+        return flag
+
+    # 1 control: every control/target qubit pair of the given types
+    def _test1(self, name, c_range, t_range):
+        flag = True
+        for c in c_range:
+            for t in t_range:
+                if c==t: continue
+                flag = self._run(name, [c], t)
+                if(not flag): break
+            if(not flag): break
+
+        if(not flag):
+            print("[X]", name, ": not pass under 1e-9", flush=True)
+            print("===========================")
+        return flag
+
+    # 3 controls: the first unused qubit of each type in order
+    def _test3(self, name, types):
+        used = []
+        for t in types:
+            used.append([q for q in self.range_type[t] if q not in used][0])
+        flag = self._run(name, used[0:3], used[3])
+
+        if(not flag):
+            print("[X]", name, ": not pass under 1e-9", flush=True)
+            print("===========================")
+        return flag
+
+    def test(self):
+        create_ini(self.setting, self.ini_path)
+        flag = True
+        for i in range(4):
+            for j in range(4):
+                test_name = f"{self.qubit_type[i]}-{self.qubit_type[j]}"
+                flag = self._test1(test_name, self.range_type[i], self.range_type[j])
+                if not flag:    break
+            if not flag:    break
+
+        for i in range(4):
+            for j in range(i, 4):
+                for k in range(j, 4):
+                    for t in range(4):
+                        if not flag:    break
+                        if i == k == t: continue    # 只有3個同type的qubit
+                        test_name = "-".join(self.qubit_type[x] for x in [i, j, k, t])
+                        flag = self._test3(test_name, [i, j, k, t])
+
+        if(flag):
+            print("[PASS]", "mcTest", ": match with qiskit under 1e-9", flush=True)
+        else:
+            print("[x]", "mcTest", ": not pass under 1e-9", flush=True)
+        print("===========================")
+        return flag
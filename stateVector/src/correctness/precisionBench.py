@@ -0,0 +1,106 @@
+from circuit_generator import *
+from ini_generator import *
+from test_util import *
+import argparse
+import random
+import shutil
+import subprocess
+
+# Precision benchmark
+# 分別以 make PRECISION=double / mixed / float 編譯，跑同一份random circuit，
+# 跟Qiskit的結果比較誤差 (max abs error 及 fidelity)，並記錄執行時間與state file大小。
+# 結束後會重新以double編譯 ../qSim.out
+#
+# python3 precisionBench.py --N 16 --NGQB 2 --NSQB 4 --NLQB 8 --depth 10
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--N", type=int, default=16)
+parser.add_argument("--NGQB", type=int, default=2)
+parser.add_argument("--NSQB", type=int, default=4)
+parser.add_argument("--NLQB", type=int, default=8)
+parser.add_argument("--depth", type=int, default=10)
+parser.add_argument("--seed", type=int, default=0)
+parser.add_argument("--precisions", default="double,mixed,float")
+parser.add_argument("--extra", default="", help="additional ini lines, e.g. 'state_format=1'")
+args = parser.parse_args()
+
+N, NGQB = args.N, args.NGQB
+ini_path = "precision.ini"
+cir_path = "cir_precision"
+paths_path = "precision_paths.txt"
+state_paths = [f"./state/path{i+1}" for i in range(2 << NGQB)]
+
+def rand_unitary(n, rng, complex_entries):
+    # Qiskit checker (set_circuit) 的 U2/U3 只看real part，所以那兩種只用實數的orthogonal matrix
+    a = rng.standard_normal((n, n))
+    if complex_entries:
+        a = a + 1j * rng.standard_normal((n, n))
+    q, r = np.linalg.qr(a)
+    return q * (np.diag(r) / np.abs(np.diag(r)))
+
+def make_circuit():
+    rng = np.random.default_rng(args.seed)
+    random.seed(args.seed)
+    circuit = get_circuit()
+    for q in range(N):
+        H(circuit, q)
+    for _ in range(args.depth):
+        for q in range(N):
+            u = rand_unitary(2, rng, True)
+            U1(circuit, q, list(u.real.flatten()), list(u.imag.flatten()))
+        qs = random.sample(range(N), N - N % 2)
+        for i in range(0, len(qs), 2):
+            CX(circuit, qs[i], qs[i+1])
+        q0, q1, q2 = random.sample(range(N), 3)
+        u = rand_unitary(4, rng, False)
+        U2(circuit, q0, q1, list(u.flatten()), [0] * 16)
+        u = rand_unitary(8, rng, False)
+        U3(circuit, q0, q1, q2, list(u.flatten()), [0] * 64)
+    create_circuit(circuit, cir_path)
+
+def build(precision):
+    subprocess.run(f"make clean > /dev/null && make PRECISION={precision} > /dev/null", shell=True, cwd="..", check=True)
+    shutil.copy("../qSim.out", f"qSim_{precision}.out")
+
+def run(precision):
+    out = subprocess.run(["./qSim_" + precision + ".out", "-i", ini_path, "-c", cir_path],
+                         capture_output=True, text=True).stdout
+    m = re.search(r"Total: (\d+) \(us\)", out)
+    return int(m.group(1)) if m else -1
+
+setting = {'total_qbit': str(N),
+           'global_qbit': str(NGQB),
+           'thread_qbit': str(args.NSQB),
+           'local_qbit': str(args.NLQB),
+           'max_qbit': '38',
+           'max_depth': '100000',
+           'state_paths': ','.join(state_paths)}
+create_ini(setting, ini_path)
+if args.extra:
+    with open(ini_path, "a") as f:
+        print(args.extra.replace("\\n", "\n"), file=f)
+with open(paths_path, "w") as f:
+    print("\n".join(state_paths), file=f)
+
+make_circuit()
+print_header(N, NGQB, args.NSQB, args.NLQB, False)
+qiskit_state = np.array(qiskit_init_state_vector(set_circuit(cir_path, N)))
+
+print(f"{'precision':<10}{'bytes':>14}{'time (us)':>14}{'max err':>12}{'1-fidelity':>14}")
+for precision in args.precisions.split(","):
+    build(precision)
+    us = run(precision)
+    dtype = "d" if precision == "double" else "f"
+    if "state_format=1" in args.extra:
+        os.system(f"python3 ../convert_state.py --local_qbit {args.NLQB} --to aos --type {dtype} "
+                  f"{' '.join(state_paths[:1 << NGQB])} > /dev/null")
+    state = np.concatenate(read_state(paths_path, N, NGQB, dtype))
+    err = np.max(np.abs(state - qiskit_state))
+    fid = np.abs(np.vdot(qiskit_state, state)) ** 2
+    size = (1 << N) * 2 * struct.calcsize(dtype)
+    print(f"{precision:<10}{size:>14}{us:>14}{err:>12.2e}{1-fid:>14.2e}", flush=True)
+    os.system(f"rm qSim_{precision}.out")
+
+build("double")
+os.system(f"rm {ini_path} {cir_path} {paths_path} qSim_double.out")
+os.system("rm -r state")
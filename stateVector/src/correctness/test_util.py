@@ -1,5 +1,6 @@
 from qiskit import Aer, QuantumCircuit, transpile
 from qiskit.extensions import UnitaryGate
+from qiskit.quantum_info import DensityMatrix, Kraus, Operator
 from math import sqrt
 import numpy as np
 import sys
@@ -63,7 +64,8 @@ def qiskit_init_density_matrix(circ):
 
     return data['save'].T.reshape(-1)
 
-def read_state(path, N, NGQB):
+# dtype: "d" (double) 或 "f" (float, make PRECISION=mixed/float)
+def read_state(path, N, NGQB, dtype="d"):
     NUMFD = 1 << NGQB
     FILESIZE = 1<< (N-NGQB)
     with open(path, mode="r") as states_path:
@@ -79,10 +81,11 @@ def read_state(path, N, NGQB):
             try:
                 state = state_file.read()
                 k = 0
+                size = 2 * struct.calcsize(dtype)
                 for i in range(FILESIZE):
-                    (real, imag) = struct.unpack("dd", state[k:k+16])
+                    (real, imag) = struct.unpack(dtype*2, state[k:k+size])
                     f[i] = real+imag*1j
-                    k += 16
+                    k += size
             except:
                 print(f"read from {state_path}")
                 print(f"[ERROR]: error at reading {k}th byte")
@@ -148,6 +151,19 @@ def set_circuit(path, N):
         if op[0]==14:
             # control1 control2 targert
             circ.toffoli(reorder(op[4], N),reorder(op[5], N),reorder(op[6], N))
+        if op[0]==15 or op[0]==16 or op[0]==17:
+            # [k] controls then the target
+            k = int(op[1])
+            ctrls = [reorder(c, N) for c in op[4:4+k]]
+            targ = reorder(op[4+k], N)
+            if op[0]==15:
+                circ.mcp(np.pi, ctrls, targ)
+            if op[0]==16:
+                circ.mcp(float(op[5+k]), ctrls, targ)
+            if op[0]==17:
+                gate = UnitaryGate([[op[5+k]+op[9+k]*1j,  op[6+k]+op[10+k]*1j],
+                                    [op[7+k]+op[11+k]*1j, op[8+k]+op[12+k]*1j]])
+                circ.append(gate.control(k), ctrls+[targ])
 
         if op[0]==31: # 2 qubit UnitaryGate
             # gate = UnitaryGate([[op[6] +op[22]*i, op[7] +op[23]*i, op[8] +op[24]*i, op[9] +op[25]*i], 
@@ -175,6 +191,41 @@ def set_circuit(path, N):
     # print(circ)
     return circ
 
+# [density_matrix] 1-qubit gates (op 0-7) and Kraus channels (op 24) by qiskit DensityMatrix,
+# returned in the order of the state files: (column << N) | row
+def set_density_matrix(path, N):
+    with open(path,'r') as f:
+        lines = f.readlines()
+    ops = [[float(x) for x in line.split()] for line in lines[1:int(lines[0])+1]]
+
+    rho = DensityMatrix.from_label('0'*N)
+    for op in ops:
+        q = [reorder(op[4], N)]
+        if op[0]==0:
+            rho = rho.evolve(Operator(np.array([[1, 1], [1, -1]])/sqrt(2)), q)
+        if op[0]==1:
+            rho = rho.evolve(Operator(np.diag([1, 1j])), q)
+        if op[0]==2:
+            rho = rho.evolve(Operator(np.diag([1, np.exp(1j*np.pi/4)])), q)
+        if op[0]==3:
+            rho = rho.evolve(Operator(np.array([[0, 1], [1, 0]])), q)
+        if op[0]==4:
+            rho = rho.evolve(Operator(np.array([[0, -1j], [1j, 0]])), q)
+        if op[0]==5:
+            rho = rho.evolve(Operator(np.diag([1, -1])), q)
+        if op[0]==6:
+            rho = rho.evolve(Operator(np.diag([1, np.exp(1j*op[5])])), q)
+        if op[0]==7:
+            rho = rho.evolve(Operator(np.array([[op[5]+op[9]*1j,  op[6]+op[10]*1j],
+                                                [op[7]+op[11]*1j, op[8]+op[12]*1j]])), q)
+        if op[0]==24:
+            # k個row-major 2x2: [K_1 .. K_k real] [K_1 .. K_k imag]
+            num = int(op[3])
+            real = np.array(op[5:5+num])
+            imag = np.array(op[5+num:5+2*num])
+            rho = rho.evolve(Kraus(list((real+imag*1j).reshape(-1, 2, 2))), q)
+    return rho.data.T.reshape(-1)
+
 def check(fd_state, qiskit_state, N, NGQB):
     NUMFD = 1 << NGQB
     FILESIZE = 1<< (N-NGQB)
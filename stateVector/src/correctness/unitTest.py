@@ -10,6 +10,9 @@ from u1Test import u1Test
 from u2Test import u2Test
 from u3Test import u3Test
 from ccxTest import ccxTest
+from mcTest import mcTest
+from expectTest import expectTest
+from densityTest import densityTest
 
 # Test for all gates
 
@@ -18,7 +21,10 @@ tests = [singleGatesTest(),
         phaseTest(),
         swapTest(),
         u1Test(),   u2Test(),   u3Test(),
-        ccxTest()]
+        ccxTest(),
+        mcTest(),
+        expectTest(),
+        densityTest()]
 flag = True
 for test in tests:
     try:
@@ -30,5 +36,5 @@ if(flag):
     print("[PASS]", "ALL TEST", ": match with qiskit under 1e-9", flush=True)
     print("===========================")
 
-os.system("rm cir_test test.ini m.out")
+os.system("rm cir_test test.ini m.out obs_test")
 os.system("rm -r state")
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "gate.h"
+#include "scheduler_refine.h"
+#include "density.h"
+
+// S = sum_i conj(K_i) (x) K_i 加到 s_r, s_i (4x4, row-maj)，conj(K)在高位 (column qubit)
+static void add_superop(double *k_r, double *k_i, double *s_r, double *s_i){
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++){
+            int a = (r>>1)*2 + (c>>1);  // conj(K)
+            int b = (r&1)*2 + (c&1);    // K
+            s_r[r*4+c] += k_r[a]*k_r[b] + k_i[a]*k_i[b];
+            s_i[r*4+c] += k_r[a]*k_i[b] - k_i[a]*k_r[b];
+        }
+}
+
+/*
+set_all時 (fusion, remap之後) 呼叫: is_density=1 時把1-qubit gate (op 0-7) 及Kraus channel (op 24)
+換成作用在 (q, q+N/2) 的superoperator (op 25)，讓 U rho U^† 只走一次state。
+diag_fusion=1 時diagonal的1-qubit gate留給diag_fusion (已經是一次pass，還能跟相鄰的gate合併)。
+*/
+void density_lower(){
+    if(!IsDensity)
+        return;
+
+    int num = 0;
+    for (int i = 0; i < total_gate; i++){
+        gate *g = gateMap+i;
+        double s_r[16] = {0}, s_i[16] = {0};
+
+        if(g->gate_ops <= 7){
+            int q[3];
+            double u_r[4], u_i[4];
+            gate_matrix(g, q, u_r, u_i);
+            if(DiagFusion && !u_r[1] && !u_i[1] && !u_r[2] && !u_i[2])
+                continue;
+            add_superop(u_r, u_i, s_r, s_i);
+        }
+        else if(g->gate_ops == DENSITY_CHANNEL){
+            double k_r[4], k_i[4];
+            for (int k = 0; k < g->val_num; k += 4){
+                for (int j = 0; j < 4; j++){
+                    k_r[j] = g->real_matrix[k+j];
+                    k_i[j] = g->imag_matrix[k+j];
+                }
+                add_superop(k_r, k_i, s_r, s_i);
+            }
+        }
+        else
+            continue;
+
+        // 原本的matrix可能是mmap的circuit或其他gate共用的，換新的
+        g->real_matrix = (Acc_t *)malloc(16*sizeof(Acc_t));
+        g->imag_matrix = (Acc_t *)malloc(16*sizeof(Acc_t));
+        for (int k = 0; k < 16; k++){
+            g->real_matrix[k] = s_r[k];
+            g->imag_matrix[k] = s_i[k];
+        }
+        g->gate_ops = DENSITY_SUPEROP;
+        g->numCtrls = 0;
+        g->numTargs = 2;
+        g->val_num = 16;
+        g->targs[1] = g->targs[0] + N/2;
+        num++;
+    }
+    printf("[DENSITY]: %d gates -> single pass superoperator\n", num);
+}
@@ -0,0 +1,28 @@
+#ifndef DENSITY_H_
+#define DENSITY_H_
+
+/*===================================================================
+density matrix guide
+
+is_density=1 時total_qbit是2n，state的index為 (column << n) | row，
+gate作用在 row qubit q+N/2 (U) 及 column qubit q (conj(U))，即 rho -> U rho U^†。
+
+原本每個gate分兩次走過整個state (先U再conj(U)，中間barrier)。
+1-qubit gate (op 0-7) 載入時改成作用在 (q, q+N/2) 兩個qubit上的4x4 superoperator
+    S = conj(U) (x) U       (q是高位，跟op 31的matrix順序相同)
+用unitary4x4一次走完 (op 25，只在內部使用)，state只讀寫一次。
+
+op 24 是1-qubit的Kraus channel: rho -> sum_i K_i rho K_i^†
+    24 0 1 [4k] [target_qubit] [K_1 .. K_k real] [K_1 .. K_k imag]     (每個K_i是row-major 2x2)
+同樣轉成 S = sum_i conj(K_i) (x) K_i 一次走完，只能在 is_density=1 時使用。
+
+diagonal的superoperator (S, T, Z, Phase, dephasing channel) 可以跟其他diagonal gate一起diag_fusion。
+2, 3-qubit gate的superoperator超過kernel能處理的3個qubit，仍然分兩次 (conj那一半用conj的kernel)。
+===================================================================*/
+
+#define DENSITY_CHANNEL 24
+#define DENSITY_SUPEROP 25
+
+void density_lower();
+
+#endif
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_util.h"
+#include "gate_soa.h"
+#include "diag.h"
+#include "density.h"
+
+#define DIAG_LO_BITS 8
+
+// 一個diagonal gate: d[k] 乘在 q[0..nq-1] 的值為k的state上 (q[0]是最高位)
+typedef struct {
+    int nq;
+    int q[3];
+    Acc_t dr[8];
+    Acc_t di[8];
+} diag_term;
+
+static diag_term terms[2*DIAG_MAX_GATE];
+static int num_term;
+static int *local_terms, num_local;
+static int *mixed_terms, num_mixed;
+static int *global_terms, num_global;
+
+static int num_l;                   // local qubit數量 (phase table index的bit數)
+static int lpos[64];                // lpos[qubit]: 在table index的第幾個bit，不是local時為-1
+static unsigned short *lo_tab;      // chunk內index低 DIAG_LO_BITS bit 對應的table index
+static unsigned short *hi_tab;      // chunk內index其餘bit 對應的table index
+static int lo_bits;
+static Acc_t *loc_r, *loc_i;        // local term的乘積
+static int loc_trivial;             // local table全是1
+static ull sig_mask;                // table只跟chunk編號裡這些 (non-local qubit的) bit有關
+static Acc_t **tab_r, **tab_i;      // 每條thread目前chunk的phase table
+
+/*===================================================================
+找出可以合併的diagonal gate
+===================================================================*/
+static int all_zero(Acc_t *m, int k, int dim){
+    for (int i = 0; i < dim; i++)
+        if(i != k && m[i])
+            return 0;
+    return 1;
+}
+
+// matrix (dim x dim) 是否為對角
+static int is_diag_matrix(gate *g, int dim){
+    if(g->val_num < dim*dim)
+        return 0;
+    for (int r = 0; r < dim; r++)
+        if(!all_zero(g->real_matrix + r*dim, r, dim) || !all_zero(g->imag_matrix + r*dim, r, dim))
+            return 0;
+    return 1;
+}
+
+static int is_diag_gate(gate *g){
+    switch(g->gate_ops){
+        case 1: case 2: case 5: case 6:
+        case 10: case 11:
+            return 1;
+        case 7: case 12:
+            return is_diag_matrix(g, 2);
+        case 31: case DENSITY_SUPEROP:
+            return is_diag_matrix(g, 4);
+        case 32:
+            return is_diag_matrix(g, 8);
+        case 15: case 16: // MCZ, MCPhase (gate_mc.h)，term最多3個qubit
+            return g->numCtrls <= 2;
+        case 17:
+            return g->numCtrls <= 2 && is_diag_matrix(g, 2);
+        default:
+            return 0;
+    }
+}
+
+static int qubits_of(gate *g, int *q){
+    int n = 0;
+    for (int j = 0; j < g->numCtrls; j++)
+        q[n++] = g->ctrls[j];
+    for (int j = 0; j < g->numTargs; j++)
+        q[n++] = g->targs[j];
+    return n;
+}
+
+// 從g開始可以合併成一組的gate數量，g不是diagonal時為0
+int diag_run(gate *g, int num){
+    ull local = 0;
+    int cnt = 0;
+    while(cnt < num && cnt < DIAG_MAX_GATE && is_diag_gate(g+cnt)){
+        int q[6];
+        int n = qubits_of(g+cnt, q);
+        int shift = (g+cnt)->gate_ops == DENSITY_SUPEROP ? 0 : N/2*IsDensity;   // superop的targs已經是 (q, q+N/2)
+        ull l = local;
+        for (int j = 0; j < n; j++){
+            int p = q[j] + shift;
+            if(isLocal(p)) l |= 1ULL << p;
+            if(shift && isLocal(q[j])) l |= 1ULL << q[j];
+        }
+        if(__builtin_popcountll(l) > DIAG_MAX_LOCAL)
+            break;
+        local = l;
+        cnt++;
+    }
+    return cnt;
+}
+
+/*===================================================================
+setup (thread 0)
+===================================================================*/
+static void set_term(diag_term *d, gate *g, int shift, int conj){
+    Acc_t pr = 1, pi = 0;
+    switch(g->gate_ops){
+        case 1:  pr = 0;            pi = 1;            break;
+        case 2:  pr = cos(PI/4);    pi = sin(PI/4);    break;
+        case 5:  case 10: case 15: pr = -1;  pi = 0;   break;
+        case 6:  case 11: case 16: pr = cos(g->real_matrix[0]); pi = sin(g->real_matrix[0]); break;
+    }
+
+    d->nq = qubits_of(g, d->q);
+    for (int j = 0; j < d->nq; j++)
+        d->q[j] += shift;
+    int dim = 1 << d->nq;
+    for (int k = 0; k < dim; k++){
+        d->dr[k] = 1;
+        d->di[k] = 0;
+    }
+    switch(g->gate_ops){
+        case 7: case 12: case 17: // diag(u00, u11)，control的時候在最後兩項
+            d->dr[dim-2] = g->real_matrix[0]; d->di[dim-2] = g->imag_matrix[0];
+            d->dr[dim-1] = g->real_matrix[3]; d->di[dim-1] = g->imag_matrix[3];
+            break;
+        case 31: case 32: case DENSITY_SUPEROP:
+            for (int k = 0; k < dim; k++){
+                d->dr[k] = g->real_matrix[k*dim+k];
+                d->di[k] = g->imag_matrix[k*dim+k];
+            }
+            break;
+        default:
+            d->dr[dim-1] = pr; d->di[dim-1] = pi;
+            break;
+    }
+    if(conj)
+        for (int k = 0; k < dim; k++)
+            d->di[k] = -d->di[k];
+}
+
+// 把q[j]的bit組成term的index，local qubit從table index x取，其他從chunk開頭的state編號base取
+static inline int term_index(diag_term *d, ull base, int x){
+    int k = 0;
+    for (int j = 0; j < d->nq; j++){
+        int p = lpos[d->q[j]];
+        int b = p < 0 ? (base >> (N-1-d->q[j])) & 1 : (x >> p) & 1;
+        k = (k << 1) | b;
+    }
+    return k;
+}
+
+static void diag_setup(gate *g, int num){
+    if(!lo_tab){
+        lo_bits = chunk_segment < DIAG_LO_BITS ? chunk_segment : DIAG_LO_BITS;
+        lo_tab = (unsigned short *)malloc((1ULL << lo_bits) * sizeof(unsigned short));
+        hi_tab = (unsigned short *)malloc((1ULL << (chunk_segment-lo_bits)) * sizeof(unsigned short));
+        loc_r = (Acc_t *)malloc((1 << DIAG_MAX_LOCAL) * sizeof(Acc_t));
+        loc_i = (Acc_t *)malloc((1 << DIAG_MAX_LOCAL) * sizeof(Acc_t));
+        tab_r = (Acc_t **)malloc(num_thread * sizeof(Acc_t *));
+        tab_i = (Acc_t **)malloc(num_thread * sizeof(Acc_t *));
+        for (int t = 0; t < num_thread; t++){
+            tab_r[t] = (Acc_t *)malloc((1 << DIAG_MAX_LOCAL) * sizeof(Acc_t));
+            tab_i[t] = (Acc_t *)malloc((1 << DIAG_MAX_LOCAL) * sizeof(Acc_t));
+        }
+        local_terms = (int *)malloc(2*DIAG_MAX_GATE * sizeof(int));
+        mixed_terms = (int *)malloc(2*DIAG_MAX_GATE * sizeof(int));
+        global_terms = (int *)malloc(2*DIAG_MAX_GATE * sizeof(int));
+    }
+
+    // density: 先作用在 q+N/2 (U)，再作用在 q (conj(U))，跟 run_simulator 的順序相同
+    num_term = 0;
+    for (int i = 0; i < num; i++){
+        if(g[i].gate_ops == DENSITY_SUPEROP){
+            set_term(&terms[num_term++], g+i, 0, 0);
+            continue;
+        }
+        set_term(&terms[num_term++], g+i, N/2*IsDensity, 0);
+        if(IsDensity)
+            set_term(&terms[num_term++], g+i, 0, 1);
+    }
+
+    for (int q = 0; q < N; q++)
+        lpos[q] = -1;
+    num_l = 0;
+    for (int q = N-chunk_segment; q < N; q++)
+        for (int i = 0; i < num_term; i++)
+            for (int j = 0; j < terms[i].nq; j++)
+                if(terms[i].q[j] == q && lpos[q] < 0)
+                    lpos[q] = num_l++;
+
+    num_local = num_mixed = num_global = 0;
+    sig_mask = 0;
+    for (int i = 0; i < num_term; i++){
+        int l = 0;
+        for (int j = 0; j < terms[i].nq; j++){
+            l += lpos[terms[i].q[j]] >= 0;
+            if(lpos[terms[i].q[j]] < 0)
+                sig_mask |= 1ULL << (N-1-terms[i].q[j]);
+        }
+        if(l == terms[i].nq)
+            local_terms[num_local++] = i;
+        else if(l == 0)
+            global_terms[num_global++] = i;
+        else
+            mixed_terms[num_mixed++] = i;
+    }
+
+    // chunk內第i個state的table index = lo_tab[i低位] | hi_tab[i高位]
+    for (ull v = 0; v < (1ULL << lo_bits); v++){
+        lo_tab[v] = 0;
+        for (int q = N-lo_bits; q < N; q++)
+            if(lpos[q] >= 0 && ((v >> (N-1-q)) & 1))
+                lo_tab[v] |= 1 << lpos[q];
+    }
+    for (ull v = 0; v < (1ULL << (chunk_segment-lo_bits)); v++){
+        hi_tab[v] = 0;
+        for (int q = N-chunk_segment; q < N-lo_bits; q++)
+            if(lpos[q] >= 0 && ((v >> (N-1-q-lo_bits)) & 1))
+                hi_tab[v] |= 1 << lpos[q];
+    }
+
+    loc_trivial = 1;
+    for (int x = 0; x < (1 << num_l); x++){
+        Acc_t r = 1, i = 0;
+        for (int k = 0; k < num_local; k++){
+            diag_term *d = &terms[local_terms[k]];
+            int idx = term_index(d, 0, x);
+            Acc_t nr = r*d->dr[idx] - i*d->di[idx];
+            i = r*d->di[idx] + i*d->dr[idx];
+            r = nr;
+        }
+        loc_r[x] = r;
+        loc_i[x] = i;
+        if(r != 1 || i != 0)
+            loc_trivial = 0;
+    }
+}
+
+/*
+重建thread t在 (以base開頭的) chunk的phase table
+回傳0表示這個chunk完全不會變，不需要讀寫
+*/
+static int diag_rebuild(int t, ull base){
+    Acc_t sr = 1, si = 0;
+    for (int k = 0; k < num_global; k++){
+        diag_term *d = &terms[global_terms[k]];
+        int idx = term_index(d, base, 0);
+        Acc_t nr = sr*d->dr[idx] - si*d->di[idx];
+        si = sr*d->di[idx] + si*d->dr[idx];
+        sr = nr;
+    }
+
+    // 只留下在這個chunk不是identity的mixed term
+    int active[2*DIAG_MAX_GATE];
+    int num_active = 0;
+    for (int k = 0; k < num_mixed; k++){
+        diag_term *d = &terms[mixed_terms[k]];
+        for (int x = 0; x < (1 << num_l); x++){
+            int idx = term_index(d, base, x);
+            if(d->dr[idx] != 1 || d->di[idx] != 0){
+                active[num_active++] = mixed_terms[k];
+                break;
+            }
+        }
+    }
+    if(loc_trivial && !num_active && sr == 1 && si == 0)
+        return 0;
+
+    Acc_t *tr = tab_r[t], *ti = tab_i[t];
+    for (int x = 0; x < (1 << num_l); x++){
+        Acc_t r = sr*loc_r[x] - si*loc_i[x];
+        Acc_t i = sr*loc_i[x] + si*loc_r[x];
+        for (int k = 0; k < num_active; k++){
+            diag_term *d = &terms[active[k]];
+            int idx = term_index(d, base, x);
+            Acc_t nr = r*d->dr[idx] - i*d->di[idx];
+            i = r*d->di[idx] + i*d->dr[idx];
+            r = nr;
+        }
+        tr[x] = r;
+        ti[x] = i;
+    }
+    return 1;
+}
+
+/*===================================================================
+kernel: 每個state乘上自己的phase
+===================================================================*/
+static void Diag_gate(Type *q_rd){
+    int t = omp_get_thread_num();
+    Acc_t *tr = tab_r[t], *ti = tab_i[t];
+    ull lo_n = 1ULL << lo_bits;
+    ull hi_n = chunk_state >> lo_bits;
+
+    if(!num_l){
+        Acc_t cr = tr[0], ci = ti[0];
+        for (ull i = 0; i < chunk_state; i++){
+            Acc_t r = q_rd[i].real, m = q_rd[i].imag;
+            q_rd[i].real = r*cr - m*ci;
+            q_rd[i].imag = r*ci + m*cr;
+        }
+        return;
+    }
+    for (ull h = 0; h < hi_n; h++){
+        Type *q = q_rd + h*lo_n;
+        int hk = hi_tab[h];
+        for (ull l = 0; l < lo_n; l++){
+            int k = hk | lo_tab[l];
+            Acc_t r = q[l].real, m = q[l].imag;
+            q[l].real = r*tr[k] - m*ti[k];
+            q[l].imag = r*ti[k] + m*tr[k];
+        }
+    }
+}
+
+static void Diag_gate_soa(Type *q_rd){
+    int t = omp_get_thread_num();
+    Acc_t *tr = tab_r[t], *ti = tab_i[t];
+    Type_t *re = (Type_t *)q_rd;
+    Type_t *im = re + chunk_state;
+    ull lo_n = 1ULL << lo_bits;
+    ull hi_n = chunk_state >> lo_bits;
+
+    for (ull h = 0; h < hi_n; h++){
+        int hk = num_l ? hi_tab[h] : 0;
+        for (ull l = 0; l < lo_n; l++){
+            ull i = h*lo_n + l;
+            int k = num_l ? hk | lo_tab[l] : 0;
+            Acc_t r = re[i], m = im[i];
+            re[i] = r*tr[k] - m*ti[k];
+            im[i] = r*ti[k] + m*tr[k];
+        }
+    }
+}
+
+/*===================================================================
+diag_gate(g, num): 每條thread處理自己的thread_state，
+連續且table相同的chunk一起交給inner_loop (可以走io_engine的pipeline)，
+不會變的chunk直接跳過。
+===================================================================*/
+void diag_gate(gate *g, int num){
+    int t = omp_get_thread_num();
+    setStreamv2 *s = &thread_settings[t];
+
+    #pragma omp barrier
+    if(t == 0){
+        diag_setup(g, num);
+        gate_func = (StateFormat == STATE_SOA) ? Diag_gate_soa : Diag_gate;
+        gate_size = chunk_state;
+    }
+    #pragma omp barrier
+
+    int f = t/num_thread_per_file;
+    int td = t%num_thread_per_file;
+    ull base = f*file_state + td*thread_state;
+    ull t_off = td*thread_size;
+
+    ull run = 0, run_off = 0;
+    ull sig = ~0ULL;
+    int active = 0;
+    s->fd[0] = fd_arr[f];
+    for (ull c = 0; c < thread_state; c += chunk_state){
+        ull idx = base + c;
+        ull off = t_off + c*sizeof(Type);
+        if((idx & sig_mask) != sig){
+            if(run){
+                s->fd_off[0] = run_off;
+                inner_loop(run, s->rd, s->fd, s->fd_off);
+                run = 0;
+            }
+            sig = idx & sig_mask;
+            active = diag_rebuild(t, idx);
+        }
+        if(!active)
+            continue;
+        if(!run)
+            run_off = off;
+        run += chunk_state;
+    }
+    if(run){
+        s->fd_off[0] = run_off;
+        inner_loop(run, s->rd, s->fd, s->fd_off);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef DIAG_H_
+#define DIAG_H_
+
+/*===================================================================
+diagonal gate guide
+
+在ini的[system]設定 diag_fusion=1 之後，連續的diagonal gate
+(S, T, Z, Phase, CZ, CPhase，以及matrix是對角的 U1, CU1, U2, U3；
+2個control以內的 MCZ, MCPhase, 對角的MCU)
+會合併成一個phase table，整段gate只走過state file一次。
+
+每個gate依qubit位置分成:
+    local:  qubit全在chunk內，每個chunk都一樣，事先算進local table
+    global: qubit全不在chunk內，對一個chunk來說只是乘上一個常數
+    mixed:  兩者都有，依chunk編號決定要乘上哪一部分
+每個chunk的phase table = 常數 * local table * mixed的部分，
+整個table都是1的chunk (例如global control為0、global target Z的上半部)
+完全不讀也不寫。所有thread都各自處理自己那段thread_state。
+
+一組最多 DIAG_MAX_GATE 個gate，用到的local qubit最多 DIAG_MAX_LOCAL 個，
+超過就分成下一組。density matrix模式下每個gate展開成 U 及 conj(U) 兩項。
+===================================================================*/
+
+#define DIAG_MAX_GATE  64
+#define DIAG_MAX_LOCAL 10
+
+int diag_run(gate *g, int num);
+void diag_gate(gate *g, int num);
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <omp.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_soa.h"
+#include "io_engine.h"
+#include "expect.h"
+
+typedef struct pauli_term {
+    double coef;
+    ull x, z;       // state index上的bit mask (qubit q是bit N-1-q)
+    int ny;         // Y的數量
+    int id;         // 在file裡是第幾個term
+    char *str;
+} pauli_term;
+
+static pauli_term *terms;
+static int num_term;
+static ull *group_x;        // 每組的xhi
+static int *group_first;    // 第g組是 terms[group_first[g] .. group_first[g+1]-1]
+static int num_group;
+static char **term_name;    // 照file裡的順序
+static double *expect_acc;  // [num_thread][num_term]，最後一列是加總
+
+static int cmp_term(const void *a, const void *b){
+    ull x = ((const pauli_term *)a)->x >> chunk_segment;
+    ull y = ((const pauli_term *)b)->x >> chunk_segment;
+    return (x > y) - (x < y);
+}
+
+static void parse_term(char *line, int lineno){
+    pauli_term *p = &terms[num_term];
+    char *end;
+    p->coef = strtod(line, &end);
+    if(end == line){
+        printf("[EXPECT]: %s line %d: missing coefficient\n", Observable, lineno);
+        exit(1);
+    }
+    while(isspace((unsigned char)*end)) end++;
+    p->str = strdup(*end ? end : "I");
+    for (int n = strlen(p->str); n > 0 && isspace((unsigned char)p->str[n-1]); n--)
+        p->str[n-1] = 0;
+    p->x = p->z = 0;
+    p->ny = 0;
+    p->id = num_term;
+    for (char *tok = strtok(end, " \t\r\n"); tok != NULL; tok = strtok(NULL, " \t\r\n")){
+        char op = toupper(tok[0]);
+        char *qend;
+        long q = strtol(tok+1, &qend, 10);
+        if(!strchr("IXYZ", op) || qend == tok+1 || *qend || q < 0 || q >= N){
+            printf("[EXPECT]: %s line %d: bad Pauli \"%s\"\n", Observable, lineno, tok);
+            exit(1);
+        }
+        ull bit = 1ULL << (N-1-q);
+        if((p->x | p->z) & bit){
+            printf("[EXPECT]: %s line %d: qubit %ld appears twice\n", Observable, lineno, q);
+            exit(1);
+        }
+        if(op == 'X' || op == 'Y') p->x |= bit;
+        if(op == 'Z' || op == 'Y') p->z |= bit;
+        p->ny += op == 'Y';
+    }
+    num_term++;
+}
+
+/*
+set_all時呼叫: 讀observable file，term依xhi分組
+*/
+void expect_init(){
+    int used = 0;
+    for (int i = 0; i < total_gate; i++)
+        used |= gateMap[i].gate_ops == 26;
+    if(!used)
+        return;
+    FILE *fp;
+    if(!Observable[0] || (fp = fopen(Observable, "r")) == NULL){
+        printf("[EXPECT]: op 26 needs observable=<file> in the ini\n");
+        exit(1);
+    }
+
+    char line[4096];
+    int cap = 0, lineno = 0;
+    while(fgets(line, sizeof(line), fp)){
+        lineno++;
+        char *c = strchr(line, '#');
+        if(c) *c = 0;
+        char *s = line;
+        while(isspace((unsigned char)*s)) s++;
+        if(!*s)
+            continue;
+        if(num_term == cap){
+            cap = cap ? 2*cap : 64;
+            terms = (pauli_term *)realloc(terms, cap*sizeof(pauli_term));
+        }
+        parse_term(s, lineno);
+    }
+    fclose(fp);
+    if(!num_term){
+        printf("[EXPECT]: %s has no terms\n", Observable);
+        exit(1);
+    }
+
+    term_name = (char **)malloc(num_term*sizeof(char *));
+    for (int k = 0; k < num_term; k++)
+        term_name[k] = terms[k].str;
+    qsort(terms, num_term, sizeof(pauli_term), cmp_term);
+    group_x = (ull *)malloc(num_term*sizeof(ull));
+    group_first = (int *)malloc((num_term+1)*sizeof(int));
+    num_group = 0;
+    for (int k = 0; k < num_term; k++){
+        ull xhi = terms[k].x >> chunk_segment;
+        if(!num_group || group_x[num_group-1] != xhi){
+            group_x[num_group] = xhi;
+            group_first[num_group++] = k;
+        }
+    }
+    group_first[num_group] = num_term;
+    expect_acc = (double *)malloc((num_thread+1)*num_term*sizeof(double));
+    printf("[EXPECT]: %d Pauli terms, %d chunk pairings\n", num_term, num_group - (group_x[0] == 0));
+}
+
+static inline void amp(Type *q, ull i, double *re, double *im){
+    if(StateFormat == STATE_SOA){
+        *re = ((Type_t *)q)[i];
+        *im = ((Type_t *)q)[chunk_state+i];
+        return;
+    }
+    *re = q[i].real;
+    *im = q[i].imag;
+}
+
+// Re sum_i conj(b[i^xlo]) i^ny (-1)^{|(base+i)&z|} a[i]，a是state編號從base開始的chunk
+static double term_sum(pauli_term *p, Type *a, Type *b, ull base){
+    ull xlo = p->x & (chunk_state-1);
+    ull zlo = p->z & (chunk_state-1);
+    int zhi = __builtin_parityll(base & p->z);
+    double sr = 0, si = 0;
+    for (ull i = 0; i < chunk_state; i++){
+        double ar, ai, br, bi;
+        amp(a, i, &ar, &ai);
+        amp(b, i^xlo, &br, &bi);
+        double vr = br*ar + bi*ai;
+        double vi = br*ai - bi*ar;
+        if(__builtin_parityll(i & zlo) ^ zhi){
+            sr -= vr;
+            si -= vi;
+        }
+        else{
+            sr += vr;
+            si += vi;
+        }
+    }
+    switch(p->ny & 3){
+        case 0:  return sr;
+        case 1:  return -si;
+        case 2:  return -sr;
+        default: return si;
+    }
+}
+
+/*
+(所有thread一起呼叫) 印出fd_set那組state的 <H>
+每條thread處理自己那段thread_state的chunk，配對的chunk從任何file讀進來
+*/
+void expect(int fd_set){
+    int t = omp_get_thread_num();
+    setStreamv2 *s = &thread_settings[t];
+    int f = t/num_thread_per_file;
+    int td = t%num_thread_per_file;
+    ull file_chunk = file_state / chunk_state;
+    ull first_chunk = (f*file_state + td*thread_state) / chunk_state;
+    double *acc = expect_acc + t*num_term;
+    Type *a = (Type *)s->rd;
+    Type *b = (Type *)((char *)s->rd + chunk_size);
+
+    memset(acc, 0, num_term*sizeof(double));
+    for (ull k = 0; k < thread_state/chunk_state; k++){
+        ull c = first_chunk + k;
+        ull base = c * chunk_state;
+        io_pread(fd_arr_set[fd_set][f], a, chunk_size, td*thread_size + k*chunk_size);
+
+        for (int g = 0; g < num_group; g++){
+            ull xhi = group_x[g];
+            if(xhi){
+                // 一對 {c, c^xhi} 在xhi最低的bit m不同、bit 0相同 (m > 0)，剛好一個負責
+                int m = __builtin_ctzll(xhi);
+                if(m ? (((c >> m) ^ c) & 1) : (c & 1))
+                    continue;
+                ull p = c ^ xhi;
+                io_pread(fd_arr_set[fd_set][p/file_chunk], b, chunk_size, (p%file_chunk)*chunk_size);
+            }
+            for (int j = group_first[g]; j < group_first[g+1]; j++)
+                acc[j] += (xhi ? 2 : 1) * term_sum(&terms[j], a, xhi ? b : a, base);
+        }
+    }
+    #pragma omp barrier
+
+    // 照file裡的順序印出每個term的 <P_k>，最後是 <H>
+    if(t == 0){
+        double *e = expect_acc + num_thread*num_term;
+        double total = 0;
+        for (int j = 0; j < num_term; j++){
+            double v = 0;
+            for (int u = 0; u < num_thread; u++)
+                v += expect_acc[u*num_term + j];
+            e[terms[j].id] = v;
+            total += terms[j].coef * v;
+        }
+        for (int j = 0; j < num_term; j++)
+            printf("[EXPECT]: <%s> = %.15g\n", term_name[j], e[j]);
+        printf("[EXPECT]: <H> = %.15g\n", total);
+        fflush(stdout);
+    }
+    #pragma omp barrier
+}
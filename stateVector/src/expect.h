@@ -0,0 +1,33 @@
+#ifndef EXPECT_H_
+#define EXPECT_H_
+
+/*===================================================================
+expectation value guide
+
+在ini的[system]設定 observable=<file>，circuit裡的op 26會算出observable H = sum_k c_k P_k
+在某一組state上的期望值 <psi|H|psi>，不用measure很多個shot再估計，state只讀不寫也不複製。
+    26 1 0 0 [src_set]
+
+observable file每行一個Pauli string，係數在前 (實數)，沒有寫到的qubit是I，#之後是註解:
+    -1.0523
+    0.3979 Z0
+    0.1809 X0 X1
+    -0.0112 Y0 Z2 Y3
+
+P = i^{#Y} X^x Z^z，x, z是state index上的bit mask，P|b> = i^{#Y} (-1)^{|b&z|} |b^x>，所以
+    <psi|P|psi> = sum_b conj(psi[b^x]) i^{#Y} (-1)^{|b&z|} psi[b]
+x的local部分 (chunk內) 只是chunk內換位置；x的chunk部分 xhi 決定要跟哪個chunk配對:
+    xhi = 0   (只有Z，或X/Y都在local qubit上) 讀自己的chunk就可以算，所有這類term共用一次讀取
+    xhi != 0  chunk c跟 c^xhi 一對，P是Hermitian，兩邊的貢獻互為共軛，
+              由其中一個chunk讀進另一個，算一邊再乘2
+term依xhi分組，每個chunk讀一次，每個 xhi != 0 的組再讀一次配對的chunk (一對只讀一次)，
+所以整個state讀 1 + (xhi不同的組數)/2 次。配對由哪個chunk負責用xhi最低的bit跟chunk編號決定，
+每條thread分到的配對數量差不多。
+
+density matrix模式不支援。
+===================================================================*/
+
+void expect_init();
+void expect(int fd_set);
+
+#endif
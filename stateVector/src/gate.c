@@ -9,20 +9,20 @@
 #include "gate.h"
 #include "gate_util.h"
 #include "gate_chunk.h"
+#include "gate_soa.h"
+#include "io_engine.h"
+#include "zchunk.h"
 
 unsigned int total_gate;
 gate *gateMap; // gate gateMap [MAX_QUBIT*max_depth];
 // int **qubitTime; // int qubitTime [MAX_QUBIT][max_depth];
-Type_t *real;
-Type_t *imag;
-void (*gate_func)(Type*);
+Acc_t *real;
+Acc_t *imag;
+#pragma omp threadprivate(real, imag)
 
-void (*gate_func)(Type*);
-void (*inner_loop_func)(ull, void*, int*, ull*);
-ull loop_size;
-ull _outer;
-ull _half_outer;
-ull _half_outer_size;
+gate_ctx shared_ctx;
+gate_ctx *cur_ctx = &shared_ctx;
+#pragma omp threadprivate(cur_ctx)
 
 setStreamv2 *thread_settings;
 int *fd_pair;
@@ -78,6 +78,7 @@ void single_gate (int targ, int ops, int density) {
         gate_func = gate_ops[ops][density];
 
         loop_size = thread_state;
+        thread_split = (isGlobal(targ) || isThread(targ)) ? 2 : 1;
     
         if (isLocal(targ)){
             inner_loop_func = inner_loop;
@@ -116,9 +117,8 @@ void single_gate (int targ, int ops, int density) {
     /*------------------------------
     Applying gate
     ------------------------------*/
-    if ((isGlobal(targ) || isThread(targ)) && t >= half_num_thread){
-        return;
-    }
+    // 一對file/thread_state由 thread_split 條thread分著做 (thread split guide, gate_util.c)
+    t /= thread_split;
 
     if (isGlobal(targ)){ //case 1 跨檔案
         // Drazermega
@@ -212,6 +212,7 @@ void control_gate(int ctrl, int targ, int ops, int density){
 
     if(t == 0){
         assert(ctrl != targ);
+        thread_split = ((isGlobal(ctrl) || isThread(ctrl)) ? 2 : 1) * ((isGlobal(targ) || isThread(targ)) ? 2 : 1);
         ctrl_offset = 1ULL << (N-ctrl);
         half_ctrl_offset = ctrl_offset >> 1;
         targ_offset = 1ULL << (N-targ);
@@ -400,19 +401,10 @@ void control_gate(int ctrl, int targ, int ops, int density){
         N: num_thread
         H: half_num_thread
         Q: QuaterTD
+
+        每一組由 N/H (N/Q) 條thread分著做，所有thread都有工作 (thread split guide, gate_util.c)
     */
-    if(isGlobal(ctrl) || isThread(ctrl)){
-        if(isGlobal(targ) || isThread(targ)){
-            if(t >= quarter_num_thread)
-                return;
-        }
-        else if(t >= half_num_thread)
-                return;
-    }
-    if(isGlobal(targ) || isThread(targ)){
-        if(t >= half_num_thread)
-            return;
-    }
+    t /= thread_split;
 
     if (isGlobal(ctrl)){
         if(isGlobal(targ)){
@@ -688,7 +680,7 @@ void control_gate(int ctrl, int targ, int ops, int density){
     exit(0);
 }
 
-void unitary4x4(int q0, int q1, int density){
+static void group4x4(int q0, int q1, void (*func)(Type *)){
     // for (int i = 0; i < 4; i++){
     //     for(int j = 0; j < 4; j++){
     //         printf("%lf+",real[4*i+j]);
@@ -707,6 +699,7 @@ void unitary4x4(int q0, int q1, int density){
 
     if(t == 0){
         assert(q0 < q1);
+        thread_split = (isGlobal(q1) || isThread(q1)) ? 4 : (isGlobal(q0) || isThread(q0)) ? 2 : 1;
 
         set_up_lo(q0, q1);
 
@@ -718,7 +711,7 @@ void unitary4x4(int q0, int q1, int density){
             local                            v2
         */
 
-        gate_func = gate_ops[13][density];
+        gate_func = func;
 
         /*  inner loop view:
             q0/q1    global  thread  middle  local
@@ -883,15 +876,10 @@ void unitary4x4(int q0, int q1, int density){
         N: num_thread
         H: half_num_thread
         Q: QuaterTD
+
+        每一組由 N/H (N/Q) 條thread分著做，所有thread都有工作 (thread split guide, gate_util.c)
     */
-    if(isGlobal(q1) || isThread(q1)){
-        if(t >= quarter_num_thread)
-            return;
-    }
-    else if(isGlobal(q0) || isThread(q0)){
-        if(t >= half_num_thread)
-            return;
-    }
+    t /= thread_split;
 
     if (isGlobal(q0)){
         if(isGlobal(q1)){
@@ -1062,7 +1050,7 @@ void unitary4x4(int q0, int q1, int density){
             s->fd_off[3] = t4_off;
 
             for (ull i = 0; i < thread_state; i += large_offset){
-                _thread_CX2(s);
+                _thread_CX4(s);
                 s->fd_off[0] += half_large_offset*sizeof(Type);
                 s->fd_off[1] += half_large_offset*sizeof(Type);
                 s->fd_off[2] += half_large_offset*sizeof(Type);
@@ -1106,6 +1094,10 @@ void unitary4x4(int q0, int q1, int density){
     exit(0);
 }
 
+void unitary4x4(int q0, int q1, int density){
+    group4x4(q0, q1, gate_ops[13][density]);
+}
+
 void SWAP(int q0, int q1, int density){
     // for (int i = 0; i < 4; i++){
     //     for(int j = 0; j < 4; j++){
@@ -1125,6 +1117,7 @@ void SWAP(int q0, int q1, int density){
 
     if(t == 0){
         assert(q0 < q1);
+        thread_split = (isGlobal(q1) || isThread(q1)) ? 4 : (isGlobal(q0) || isThread(q0)) ? 2 : 1;
 
         set_up_lo(q0, q1);
 
@@ -1294,15 +1287,10 @@ void SWAP(int q0, int q1, int density){
         N: num_thread
         H: half_num_thread
         Q: QuaterTD
+
+        每一組由 N/H (N/Q) 條thread分著做，所有thread都有工作 (thread split guide, gate_util.c)
     */
-    if(isGlobal(q1) || isThread(q1)){
-        if(t >= quarter_num_thread)
-            return;
-    }
-    else if(isGlobal(q0) || isThread(q0)){
-        if(t >= half_num_thread)
-            return;
-    }
+    t /= thread_split;
 
     if (isGlobal(q0)){
         if(isGlobal(q1)){
@@ -1481,7 +1469,7 @@ void SWAP(int q0, int q1, int density){
     exit(0);
 }
 
-void unitary8x8(int q0, int q1, int q2, int density){
+static void group8x8(int q0, int q1, int q2, void (*func)(Type *)){
     /*----------------------------
     Setting up global variables.
     ----------------------------*/
@@ -1492,6 +1480,8 @@ void unitary8x8(int q0, int q1, int q2, int density){
     if(t == 0){
         assert(q0 < q1);
         assert(q1 < q2);
+        thread_split = ((isGlobal(q0) || isThread(q0)) ? 2 : 1) * ((isGlobal(q1) || isThread(q1)) ? 2 : 1)
+                     * ((isGlobal(q2) || isThread(q2)) ? 2 : 1);
 
         large_offset = 1ULL << (N-q0);
         middle_offset = 1ULL << (N-q1);
@@ -1500,7 +1490,7 @@ void unitary8x8(int q0, int q1, int q2, int density){
         half_middle_offset = middle_offset >> 1;
         half_small_offset = small_offset >> 1;
 
-        gate_func = gate_ops[15][density];
+        gate_func = func;
 
         /*  inner loop view:
             q0 = global
@@ -1787,16 +1777,10 @@ void unitary8x8(int q0, int q1, int q2, int density){
         H: half_num_thread
         Q: quarter_num_thread
         E: eighth_num_thread
+
+        每一組由 N/H (N/Q, N/E) 條thread分著做，所有thread都有工作 (thread split guide, gate_util.c)
     */
-    if(isGlobal(q0) || isThread(q0)){
-        if(t >= half_num_thread) return;
-        if(isGlobal(q1) || isThread(q1)){
-            if(t >= quarter_num_thread) return;
-            if(isGlobal(q2) || isThread(q2)){
-                if(t >= eighth_num_thread) return;
-            }
-        }
-    }
+    t /= thread_split;
 
     if (isGlobal(q0)){
         if (isGlobal(q1)){
@@ -2319,6 +2303,193 @@ void unitary8x8(int q0, int q1, int q2, int density){
     exit(0);
 }
 
+void unitary8x8(int q0, int q1, int q2, int density){
+    group8x8(q0, q1, q2, gate_ops[15][density]);
+}
+
+/*===================================================================
+qubit swap (op 23)
+
+一次pass同時交換多對qubit: (ctrls[k], targs[k]), k < numCtrls。
+一邊是non-local、一邊是local的pair最多三對一起做:
+non-local的qubit照group4x4/group8x8的方式決定buffer內的chunk編號，
+再由PSWAP_gate把chunk編號的bit跟chunk內的local bit互換。
+其他的pair (兩邊都是local或都不是local) 退回一般的SWAP。
+remap pass (remap.c) 用它把常用的qubit搬進local segment。
+===================================================================*/
+void qubit_swap(gate *g){
+    int t = omp_get_thread_num();
+    int a[3], b[3];
+    int cross = 0;
+
+    for (int k = 0; k < g->numCtrls; k++){
+        int q0 = g->ctrls[k] < g->targs[k] ? g->ctrls[k] : g->targs[k];
+        int q1 = g->ctrls[k] < g->targs[k] ? g->targs[k] : g->ctrls[k];
+        if(!isLocal(q0) && isLocal(q1)){
+            a[cross] = q0;
+            b[cross] = q1;
+            cross++;
+            continue;
+        }
+        SWAP(q0, q1, 0);
+        #pragma omp barrier
+    }
+
+    // 依non-local qubit排序，swap_mask[k] 對應chunk編號由高到低的第k個bit
+    for (int i = 1; i < cross; i++){
+        for (int j = i; j > 0 && a[j-1] > a[j]; j--){
+            int tmp = a[j]; a[j] = a[j-1]; a[j-1] = tmp;
+            tmp = b[j]; b[j] = b[j-1]; b[j-1] = tmp;
+        }
+    }
+    if(t == 0){
+        for (int k = 0; k < cross; k++)
+            swap_mask[k] = 1ULL << (N-b[k]-1);
+    }
+
+    switch(cross){
+        case 1:
+            SWAP(a[0], b[0], 0);
+            break;
+        case 2:
+            group4x4(a[0], a[1], (StateFormat == STATE_SOA) ? PSWAP_gate_soa : PSWAP_gate);
+            break;
+        case 3:
+            group8x8(a[0], a[1], a[2], (StateFormat == STATE_SOA) ? PSWAP_gate_soa : PSWAP_gate);
+            break;
+    }
+}
+
+/*===================================================================
+multi gate (chunk residency)
+
+連續的gate如果所有qubit都是local，作用範圍都在同一個CHUNK內，
+因此可以把一段chunk讀進buffer後，依序套用整組gate再寫回，
+整組gate只需要走過state file一次。
+
+is_local_gate(g): 這個gate是否可以放進同一組
+local_run(g, num): 從g開始連續可以放進同一組的gate數量
+set_local_gate(g): (thread 0) 設定all-local情況下的gate_func, gate_move
+multi_gate(g, num, ctx): 對num個連續local gate只讀寫state一次，ctx是execution plan預先算好的context (NULL: thread 0當場設定)
+===================================================================*/
+int is_local_gate(gate *g){
+    switch(g->gate_ops){
+        case 0: case 1: case 2: case 3:
+        case 4: case 5: case 6: case 7:
+            return isLocal(g->targs[0]);
+        case 8: case 9: case 10: case 11: case 12:
+            return isLocal(g->ctrls[0]) && isLocal(g->targs[0]);
+        case 13:
+        case 31:
+            return isLocal(g->targs[0]) && isLocal(g->targs[1]);
+        case 32:
+            return isLocal(g->targs[0]) && isLocal(g->targs[1]) && isLocal(g->targs[2]);
+        default:
+            return 0;
+    }
+}
+
+int local_run(gate *g, int num){
+    int cnt = 0;
+    while(cnt < num && is_local_gate(g+cnt))
+        cnt++;
+    return cnt;
+}
+
+void set_local_gate(gate *g){
+    real = g->real_matrix;
+    imag = g->imag_matrix;
+    gate_size = chunk_state;
+
+    switch(g->gate_ops){
+        case 0: case 1: case 2: case 3:
+        case 4: case 5: case 6: case 7:
+            gate_func = gate_ops[g->gate_ops][0];
+            gate_move.half_targ = (1ULL << (N-g->targs[0]-1));
+            break;
+
+        case 8: case 9: case 10: case 11: case 12:
+            set_up_lo(g->ctrls[0], g->targs[0]);
+            gate_func = gate_ops[g->gate_ops][0];
+            gate_move.large = large_offset;
+            gate_move.small = small_offset;
+            gate_move.half_ctrl = (1ULL << (N-g->ctrls[0]-1));
+            gate_move.half_targ = (1ULL << (N-g->targs[0]-1));
+            break;
+
+        case 13:
+        case 31:
+            set_up_lo(g->targs[0], g->targs[1]);
+            gate_func = (g->gate_ops == 13) ? gate_ops[14][0] : gate_ops[13][0];
+            gate_move.large = large_offset;
+            gate_move.small = small_offset;
+            gate_move.half_large = half_large_offset;
+            gate_move.half_small = half_small_offset;
+            break;
+
+        case 32:
+            gate_func = gate_ops[15][0];
+            gate_move.large = 1ULL << (N-g->targs[0]);
+            gate_move.middle = 1ULL << (N-g->targs[1]);
+            gate_move.small = 1ULL << (N-g->targs[2]);
+            gate_move.half_large = gate_move.large >> 1;
+            gate_move.half_middle = gate_move.middle >> 1;
+            gate_move.half_small = gate_move.small >> 1;
+            break;
+    }
+}
+
+void multi_gate(gate *g, int num, gate_ctx *ctx){
+    int t = omp_get_thread_num();
+    int fd = fd_arr[t/num_thread_per_file];
+    ull t_off = (t%num_thread_per_file) * thread_size;
+    void *rd = thread_settings[t].rd;
+
+    // 一次讀入整個thread buffer能放下的chunk
+    ull batch = 8 * IoDepth * chunk_state;
+    if(batch > thread_state)
+        batch = thread_state;
+    ull batch_size = batch * sizeof(Type);
+
+    // memory engine: 直接在state上做，整個thread的範圍一次處理
+    if(IoEngine == IO_MEM){
+        batch = thread_state;
+        batch_size = thread_size;
+    }
+
+    for (ull i = 0; i < thread_state; i += batch){
+        if(IoEngine == IO_MEM)
+            rd = io_mem_ptr(fd, t_off);
+        else
+            io_pread(fd, rd, batch_size, t_off);
+        for (int k = 0; k < num; k++){
+            // execution plan: 每個gate的context事先算好，不用等thread 0
+            if(ctx){
+                cur_ctx = &ctx[k];
+            }
+            else{
+                #pragma omp barrier
+                if(t == 0)
+                    set_local_gate(g+k);
+                #pragma omp barrier
+            }
+            real = g[k].real_matrix;
+            imag = g[k].imag_matrix;
+            // zero_chunk: 全0的chunk做完還是0
+            for (ull c = 0; c < batch; c += chunk_state)
+                if(!zchunk || !zchunk_zero(fd, t_off + c*sizeof(Type)))
+                    gate_func((Type *)rd + c);
+        }
+        if(IoEngine != IO_MEM)
+            io_pwrite(fd, rd, batch_size, t_off);
+        else if(zchunk)
+            for (ull c = 0; c < batch; c += chunk_state)
+                zchunk_set(fd, t_off + c*sizeof(Type), chunk_is_zero((Type *)rd + c));
+        t_off += batch_size;
+    }
+    cur_ctx = &shared_ctx;
+}
+
 inline void print_gate(gate* g) {
     printf("%2d ",
         g->gate_ops);
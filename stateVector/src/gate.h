@@ -13,8 +13,8 @@ typedef struct gate {
     int val_num; // #variable does the gate has
     int ctrls [3]; // at most three
     int targs [3]; // at most three
-    Type_t *real_matrix; // angle (real) also put in here 可能(?)
-    Type_t *imag_matrix; // row-maj
+    Acc_t *real_matrix; // angle (real) also put in here 可能(?)
+    Acc_t *imag_matrix; // row-maj
 } gate;
 
 typedef struct setStreamv2 {
@@ -30,14 +30,21 @@ extern unsigned int total_gate;
 extern gate *gateMap; // gate gateMap [MAX_QUBIT*max_depth];
 // extern int **qubitTime; // int qubitTime [MAX_QUBIT][max_depth];
 
-extern Type_t *real;
-extern Type_t *imag;
+extern Acc_t *real; // 每條thread各自一份
+extern Acc_t *imag;
+#pragma omp threadprivate(real, imag)
 
 void single_gate(int targ, int ops, int density);
 void control_gate(int ctrl, int targ, int ops, int density);
 void unitary4x4(int q0, int q1, int density);
 void SWAP(int q0, int q1, int density);
 void unitary8x8(int q0, int q1, int q2, int density);
+void qubit_swap(gate *g);
+int is_local_gate(gate *g);
+int local_run(gate *g, int num);
+void set_local_gate(gate *g);
+struct gate_ctx;
+void multi_gate(gate *g, int num, struct gate_ctx *ctx);
 void print_gate(gate* g);
 
 #endif
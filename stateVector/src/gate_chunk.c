@@ -5,9 +5,6 @@
 #include "gate_util.h"
 #include "gate_chunk.h"
 
-gate_args gate_move;
-
-int gate_size;
 int up_qubit;
 int lo_qubit;
 
@@ -23,6 +20,8 @@ ull targ_offset;
 ull half_ctrl_offset;
 ull half_targ_offset;
 
+ull swap_mask[3];
+
 void (*gate_ops[16][2])(Type *) = {{H_gate, H_gate},
                                    {S_gate, Sc_gate},
                                    {T_gate, Tc_gate},
@@ -62,8 +61,8 @@ expressed in row-maj as:
 void H_gate (Type *q_rd) {
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (ull i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (ull j = 0; j < gate_move.half_targ; j++){
@@ -90,7 +89,7 @@ expressed in row-maj as:
 */
 void S_gate (Type *q_rd) {
     int lo_off = gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (ull i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (ull j = 0; j < gate_move.half_targ; j++){
@@ -112,15 +111,13 @@ expressed in row-maj as:
 */
 void Sc_gate (Type *q_rd) {
     int lo_off = gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (ull i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (ull j = 0; j < gate_move.half_targ; j++){
             q_1r = q_rd[lo_off].real;   q_1i = q_rd[lo_off].imag;
-            Type_t q_1r = q_rd[lo_off].real;
-            Type_t q_1i = q_rd[lo_off].imag;
-            q_rd[lo_off].real = -q_1i;
-            q_rd[lo_off].imag = q_1r;
+            q_rd[lo_off].real = q_1i;
+            q_rd[lo_off].imag = -q_1r;
             lo_off += 1;
         }
         lo_off += gate_move.half_targ;
@@ -142,7 +139,7 @@ Finally:
 */
 void T_gate (Type *q_rd) {
     int lo_off = gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (ull i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (ull j = 0; j < gate_move.half_targ; j++){
@@ -164,13 +161,13 @@ expressed in row-maj as:
 */
 void Tc_gate (Type *q_rd) {
     int lo_off = gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (ull i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (ull j = 0; j < gate_move.half_targ; j++){
             q_1r = q_rd[lo_off].real;   q_1i = q_rd[lo_off].imag;
             q_rd[lo_off].real = 1./sqrt(2) * (q_1r + q_1i);
-            q_rd[lo_off].imag = 1./sqrt(2) * (q_1r - q_1i);
+            q_rd[lo_off].imag = 1./sqrt(2) * (q_1i - q_1r);
             lo_off += 1;
         }
         lo_off += gate_move.half_targ;
@@ -187,8 +184,8 @@ expressed in row-maj as:
 void X_gate (Type *q_rd) {
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -216,8 +213,8 @@ expressed in row-maj as:
 void Y_gate (Type *q_rd) {
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -245,8 +242,8 @@ expressed in row-maj as:
 void Yc_gate (Type *q_rd) {
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -273,8 +270,8 @@ expressed in row-maj as:
 */
 void Z_gate (Type *q_rd) {
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -298,7 +295,7 @@ where theta stored at real[0]
 void P_gate (Type *q_rd) {
     // printf("in P_gate\n");
     int lo_off = gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -322,7 +319,7 @@ where theta stored at real[0]
 void Pc_gate (Type *q_rd) {
     // printf("in Pc_gate\n");
     int lo_off = gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -350,8 +347,8 @@ expressed in row-maj as:
 void U_gate (Type *q_rd) {
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
@@ -384,17 +381,17 @@ expressed in row-maj as:
 void Uc_gate (Type *q_rd) {
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.half_targ*2) {
         for (int j = 0; j < gate_move.half_targ; j++){
             q_0r = q_rd[up_off].real;   q_0i = q_rd[up_off].imag;
             q_1r = q_rd[lo_off].real;   q_1i = q_rd[lo_off].imag;
-            q_rd[up_off].real =   real[0]*q_0r + real[1]*q_1r + imag[0]*q_0i + imag[1]*q_1i;
-            q_rd[up_off].imag = -(real[0]*q_0i + real[1]*q_1i + imag[0]*q_0r + imag[1]*q_1r);
-            q_rd[lo_off].real =   real[2]*q_0r + real[3]*q_1r + imag[2]*q_0i + imag[3]*q_1i;
-            q_rd[lo_off].imag = -(real[2]*q_0i + real[3]*q_1i + imag[2]*q_0r + imag[3]*q_1r);
+            q_rd[up_off].real = real[0]*q_0r + real[1]*q_1r + imag[0]*q_0i + imag[1]*q_1i;
+            q_rd[up_off].imag = real[0]*q_0i + real[1]*q_1i - imag[0]*q_0r - imag[1]*q_1r;
+            q_rd[lo_off].real = real[2]*q_0r + real[3]*q_1r + imag[2]*q_0i + imag[3]*q_1i;
+            q_rd[lo_off].imag = real[2]*q_0i + real[3]*q_1i - imag[2]*q_0r - imag[3]*q_1r;
             up_off++;
             lo_off++;
         }
@@ -427,8 +424,8 @@ gate level (Type II)
 void X_gate2 (Type *q_rd){
     int up_off = gate_move.half_ctrl;
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
             for (int k = 0; k < gate_move.small>>1; k++){
@@ -452,8 +449,8 @@ void X_gate2 (Type *q_rd){
 void Y_gate2 (Type *q_rd) {
     int up_off = gate_move.half_ctrl;
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -478,8 +475,8 @@ void Y_gate2 (Type *q_rd) {
 void Yc_gate2 (Type *q_rd) {
     int up_off = gate_move.half_ctrl;
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -503,7 +500,7 @@ void Yc_gate2 (Type *q_rd) {
 
 void Z_gate2 (Type *q_rd) {
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -521,7 +518,7 @@ void Z_gate2 (Type *q_rd) {
 
 void P_gate2 (Type *q_rd) {
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -539,7 +536,7 @@ void P_gate2 (Type *q_rd) {
 
 void Pc_gate2 (Type *q_rd) {
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -558,8 +555,8 @@ void Pc_gate2 (Type *q_rd) {
 void U_gate2 (Type *q_rd) {
     int up_off = gate_move.half_ctrl;
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -584,8 +581,8 @@ void U_gate2 (Type *q_rd) {
 void Uc_gate2 (Type *q_rd) {
     int up_off = gate_move.half_ctrl;
     int lo_off = gate_move.half_ctrl + gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.large>>1; j += gate_move.small ){
@@ -617,10 +614,10 @@ void U2_gate (Type *q_rd) {
     int q_10_off = gate_move.half_large;
     int q_11_off = gate_move.half_large + gate_move.half_small;
 
-    Type_t q_00r;   Type_t q_00i;
-    Type_t q_01r;   Type_t q_01i;
-    Type_t q_10r;   Type_t q_10i;
-    Type_t q_11r;   Type_t q_11i;
+    Acc_t q_00r;   Acc_t q_00i;
+    Acc_t q_01r;   Acc_t q_01i;
+    Acc_t q_10r;   Acc_t q_10i;
+    Acc_t q_11r;   Acc_t q_11i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.half_large; j += gate_move.small){
@@ -666,10 +663,10 @@ void U2c_gate (Type *q_rd) {
     int q_10_off = gate_move.half_large;
     int q_11_off = gate_move.half_large + gate_move.half_small;
 
-    Type_t q_00r;   Type_t q_00i;
-    Type_t q_01r;   Type_t q_01i;
-    Type_t q_10r;   Type_t q_10i;
-    Type_t q_11r;   Type_t q_11i;
+    Acc_t q_00r;   Acc_t q_00i;
+    Acc_t q_01r;   Acc_t q_01i;
+    Acc_t q_10r;   Acc_t q_10i;
+    Acc_t q_11r;   Acc_t q_11i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.half_large; j += gate_move.small){
@@ -712,8 +709,8 @@ void U2c_gate (Type *q_rd) {
 void SWAP_gate (Type *q_rd) {
     int q_01_off = gate_move.half_small;
     int q_10_off = gate_move.half_large;
-    Type_t q_01r;    Type_t q_01i;
-    Type_t q_10r;    Type_t q_10i;
+    Acc_t q_01r;    Acc_t q_01i;
+    Acc_t q_10r;    Acc_t q_10i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.half_large; j += gate_move.small){
@@ -738,6 +735,41 @@ void SWAP_gate (Type *q_rd) {
     }
 }
 
+/*
+parallel SWAP (qubit remap)
+
+buffer內有 gate_size/chunk_state 個chunk (2, 4 或 8 個)，
+chunk編號由高到低的第k個bit 跟 chunk內 swap_mask[k] 那個bit 互換。
+每個index配對是對稱的，所以只要 i < j 的時候交換一次。
+*/
+void PSWAP_gate (Type *q_rd) {
+    int nbit = __builtin_ctzll(gate_size / chunk_state);
+    ull in_chunk = chunk_state - 1;
+    Type tmp;
+
+    for (ull i = 0; i < gate_size; i++){
+        ull c = i >> chunk_segment;
+        ull off = i & in_chunk;
+        ull nc = 0;
+        ull noff = off;
+        for (int k = 0; k < nbit; k++){
+            ull cbit = 1ULL << (nbit-1-k);
+            if (off & swap_mask[k])
+                nc |= cbit;
+            if (c & cbit)
+                noff |= swap_mask[k];
+            else
+                noff &= ~swap_mask[k];
+        }
+        ull j = (nc << chunk_segment) | noff;
+        if (i < j){
+            tmp = q_rd[i];
+            q_rd[i] = q_rd[j];
+            q_rd[j] = tmp;
+        }
+    }
+}
+
 /*===================================================================
 gate level (Type III)
 General 3 qubit gate
@@ -763,14 +795,14 @@ void U3_gate (Type *q_rd){
     int q_101_off = gate_move.half_large + gate_move.half_small;
     int q_110_off = gate_move.half_large + gate_move.half_middle;
     int q_111_off = gate_move.half_large + gate_move.half_middle + gate_move.half_small;
-    Type_t q_000r;  Type_t q_000i;
-    Type_t q_001r;  Type_t q_001i;
-    Type_t q_010r;  Type_t q_010i;
-    Type_t q_011r;  Type_t q_011i;
-    Type_t q_100r;  Type_t q_100i;
-    Type_t q_101r;  Type_t q_101i;
-    Type_t q_110r;  Type_t q_110i;
-    Type_t q_111r;  Type_t q_111i;
+    Acc_t q_000r;  Acc_t q_000i;
+    Acc_t q_001r;  Acc_t q_001i;
+    Acc_t q_010r;  Acc_t q_010i;
+    Acc_t q_011r;  Acc_t q_011i;
+    Acc_t q_100r;  Acc_t q_100i;
+    Acc_t q_101r;  Acc_t q_101i;
+    Acc_t q_110r;  Acc_t q_110i;
+    Acc_t q_111r;  Acc_t q_111i;
 
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.half_large; j += gate_move.middle){
@@ -897,14 +929,14 @@ void U3c_gate (Type *q_rd){
     int q_101_off = gate_move.half_large + gate_move.half_small;
     int q_110_off = gate_move.half_large + gate_move.half_middle;
     int q_111_off = gate_move.half_large + gate_move.half_middle + gate_move.half_small;
-    Type_t q_000r;  Type_t q_000i;
-    Type_t q_001r;  Type_t q_001i;
-    Type_t q_010r;  Type_t q_010i;
-    Type_t q_011r;  Type_t q_011i;
-    Type_t q_100r;  Type_t q_100i;
-    Type_t q_101r;  Type_t q_101i;
-    Type_t q_110r;  Type_t q_110i;
-    Type_t q_111r;  Type_t q_111i;
+    Acc_t q_000r;  Acc_t q_000i;
+    Acc_t q_001r;  Acc_t q_001i;
+    Acc_t q_010r;  Acc_t q_010i;
+    Acc_t q_011r;  Acc_t q_011i;
+    Acc_t q_100r;  Acc_t q_100i;
+    Acc_t q_101r;  Acc_t q_101i;
+    Acc_t q_110r;  Acc_t q_110i;
+    Acc_t q_111r;  Acc_t q_111i;
     
     for (int i = 0; i < gate_size; i += gate_move.large) {
         for (int j = 0; j < gate_move.half_large; j += gate_move.middle){
@@ -1038,8 +1070,8 @@ input: 指向一個存放gate_size這麼多state的buffer。
 void PreMeasure(Type *q_rd){
     int up_off = 0;
     int lo_off = gate_move.half_targ;
-    Type_t q_0r;    Type_t q_0i;
-    Type_t q_1r;    Type_t q_1i;
+    Acc_t q_0r;    Acc_t q_0i;
+    Acc_t q_1r;    Acc_t q_1i;
 
     double p0=0;
     double p1=0;
@@ -18,6 +18,7 @@ void P_gate2 (Type *q_rd); void Pc_gate2 (Type *q_rd);
 void U_gate2 (Type *q_rd); void Uc_gate2 (Type *q_rd);
 void U2_gate (Type *q_rd); void U2c_gate (Type *q_rd);
 void SWAP_gate (Type *q_rd);
+void PSWAP_gate (Type *q_rd);
 void U3_gate (Type *q_rd); void U3c_gate (Type *q_rd);
 
 void PreMeasure (Type *q_rd);
@@ -25,5 +26,6 @@ void Measure_0 (Type *q_rd);
 void Measure_1 (Type *q_rd);
 
 extern void (*gate_ops[16][2])(Type *);
+extern unsigned long long swap_mask[3];
 
 #endif
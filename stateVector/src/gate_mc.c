@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_util.h"
+#include "gate_soa.h"
+#include "gate_mc.h"
+
+#define MC_SWAP  0 // X: 交換兩個state
+#define MC_DIAG  1 // Z, Phase: 只有target=1乘上 mc_r[3]+i*mc_i[3]
+#define MC_DENSE 2 // U
+
+static int mc_kind;
+static Acc_t mc_r[4], mc_i[4];
+static ull mc_lmask;    // chunk內的local control bit
+static ull mc_fixed;    // chunk內固定的bit (local control，及local target)
+static ull mc_half;     // target=1 的state在 +mc_half (target非local時是下一個chunk)
+static ull mc_cmask;    // chunk編號中的non-local control bit
+static ull mc_cfixed;   // chunk編號中固定的bit (non-local control，及non-local target)
+static ull mc_tchunk;   // target非local時，chunk編號中target的bit，否則0
+static ull mc_active;   // 要處理的chunk (pair) 數量
+static int mc_cbits;    // chunk編號的bit數
+
+int is_mc_gate(gate *g){
+    return g->gate_ops >= 14 && g->gate_ops <= 17;
+}
+
+/*===================================================================
+setup (thread 0)
+===================================================================*/
+static void mc_setup(gate *g, int density){
+    int off = density ? 0 : N/2*IsDensity;
+    int targ = g->targs[0] + off;
+
+    mc_cbits = N - chunk_segment;
+    mc_lmask = mc_cmask = 0;
+    for (int j = 0; j < g->numCtrls; j++){
+        int c = g->ctrls[j] + off;
+        if(isLocal(c))
+            mc_lmask |= 1ULL << (N-1-c);
+        else
+            mc_cmask |= 1ULL << (mc_cbits-1-c);
+    }
+    if(isLocal(targ)){
+        mc_half = 1ULL << (N-1-targ);
+        mc_fixed = mc_lmask | mc_half;
+        mc_tchunk = 0;
+    }
+    else{
+        mc_half = chunk_state;
+        mc_fixed = mc_lmask;
+        mc_tchunk = 1ULL << (mc_cbits-1-targ);
+    }
+    mc_cfixed = mc_cmask | mc_tchunk;
+    mc_active = (1ULL << mc_cbits) >> __builtin_popcountll(mc_cfixed);
+
+    for (int k = 0; k < 4; k++){
+        mc_r[k] = (k == 0 || k == 3);
+        mc_i[k] = 0;
+    }
+    switch(g->gate_ops){
+        case 14:
+            mc_kind = MC_SWAP;
+            break;
+        case 15:
+            mc_kind = MC_DIAG;
+            mc_r[3] = -1;
+            break;
+        case 16:
+            mc_kind = MC_DIAG;
+            mc_r[3] = cos(g->real_matrix[0]);
+            mc_i[3] = sin(g->real_matrix[0]);
+            break;
+        case 17:
+            mc_kind = MC_DENSE;
+            for (int k = 0; k < 4; k++){
+                mc_r[k] = g->real_matrix[k];
+                mc_i[k] = g->imag_matrix[k];
+            }
+            break;
+    }
+    if(density)
+        for (int k = 0; k < 4; k++)
+            mc_i[k] = -mc_i[k];
+}
+
+/*===================================================================
+kernel: 只走control都為1、target為0的state i，跟 i+mc_half 一起算
+下一個i: 固定的bit先補成1再+1，進位會跳過固定的bit
+===================================================================*/
+#define MC_NEXT(i, fixed, set) (((((i) | (fixed)) + 1) & ~(fixed)) | (set))
+
+static inline void mc_apply(Type_t *ar, Type_t *ai, Type_t *br, Type_t *bi){
+    Acc_t a_r = *ar, a_i = *ai, b_r = *br, b_i = *bi;
+    switch(mc_kind){
+        case MC_SWAP:
+            *ar = b_r; *ai = b_i;
+            *br = a_r; *bi = a_i;
+            break;
+        case MC_DIAG:
+            *br = mc_r[3]*b_r - mc_i[3]*b_i;
+            *bi = mc_r[3]*b_i + mc_i[3]*b_r;
+            break;
+        default:
+            *ar = mc_r[0]*a_r + mc_r[1]*b_r - mc_i[0]*a_i - mc_i[1]*b_i;
+            *ai = mc_r[0]*a_i + mc_r[1]*b_i + mc_i[0]*a_r + mc_i[1]*b_r;
+            *br = mc_r[2]*a_r + mc_r[3]*b_r - mc_i[2]*a_i - mc_i[3]*b_i;
+            *bi = mc_r[2]*a_i + mc_r[3]*b_i + mc_i[2]*a_r + mc_i[3]*b_r;
+            break;
+    }
+}
+
+static void MC_gate(Type *q_rd){
+    for (ull i = mc_lmask; i < chunk_state; i = MC_NEXT(i, mc_fixed, mc_lmask)){
+        Type *a = q_rd + i;
+        Type *b = q_rd + i + mc_half;
+        mc_apply(&a->real, &a->imag, &b->real, &b->imag);
+    }
+}
+
+static void MC_gate_soa(Type *q_rd){
+    for (ull i = mc_lmask; i < chunk_state; i = MC_NEXT(i, mc_fixed, mc_lmask)){
+        Type_t *a = SOA_RE(q_rd, i);
+        Type_t *b = SOA_RE(q_rd, i + mc_half);
+        mc_apply(a, a + chunk_state, b, b + chunk_state);
+    }
+}
+
+// 第r個要處理的chunk編號: 把r的bit依序放進沒有固定的bit
+static ull mc_chunk(ull r){
+    ull c = mc_cmask;
+    for (int b = 0; b < mc_cbits; b++){
+        if(mc_cfixed & (1ULL << b))
+            continue;
+        if(r & 1)
+            c |= 1ULL << b;
+        r >>= 1;
+    }
+    return c;
+}
+
+/*===================================================================
+mc_gate(g, density): (所有thread一起呼叫)
+density=0 作用在 q(+N/2)，density=1 是density matrix的conj那一半
+===================================================================*/
+void mc_gate(gate *g, int density){
+    int t = omp_get_thread_num();
+    setStreamv2 *s = &thread_settings[t];
+
+    #pragma omp barrier
+    if(t == 0){
+        mc_setup(g, density);
+        gate_func = (StateFormat == STATE_SOA) ? MC_gate_soa : MC_gate;
+        gate_size = mc_tchunk ? 2*chunk_state : chunk_state;
+    }
+    #pragma omp barrier
+
+    ull r0 = mc_active * t / num_thread;
+    ull r1 = mc_active * (t+1) / num_thread;
+    if(r0 == r1)
+        return;
+
+    int nfd = mc_tchunk ? 2 : 1;
+    int fd[2];
+    ull off[2], run_off[2] = {0, 0};
+    ull run = 0;
+    ull c = mc_chunk(r0);
+    for (ull r = r0; r < r1; r++){
+        // chunk c (及target=1的那一個) 在哪個file的哪裡，接得上前面的就一起做
+        int cont = run > 0;
+        for (int k = 0; k < nfd; k++){
+            ull idx = (k ? (c | mc_tchunk) : c) * chunk_state;
+            fd[k] = fd_arr[idx / file_state];
+            off[k] = (idx % file_state) * sizeof(Type);
+            cont = cont && fd[k] == s->fd[k] && off[k] == run_off[k] + run*sizeof(Type);
+        }
+        if(run && !cont){
+            s->fd_off[0] = run_off[0]; s->fd_off[1] = run_off[1];
+            (nfd == 2 ? inner_loop2 : inner_loop)(run, s->rd, s->fd, s->fd_off);
+            run = 0;
+        }
+        if(!run){
+            for (int k = 0; k < nfd; k++){
+                s->fd[k] = fd[k];
+                run_off[k] = off[k];
+            }
+        }
+        run += chunk_state;
+        c = MC_NEXT(c, mc_cfixed, mc_cmask);
+    }
+    s->fd_off[0] = run_off[0]; s->fd_off[1] = run_off[1];
+    (nfd == 2 ? inner_loop2 : inner_loop)(run, s->rd, s->fd, s->fd_off);
+}
@@ -0,0 +1,27 @@
+#ifndef GATE_MC_H_
+#define GATE_MC_H_
+
+/*===================================================================
+multi-controlled gate guide
+
+op 14-17: 1~3個control qubit (全部為1時) 作用在1個target qubit上
+    14 MCX (2個control時即Toffoli)
+    15 MCZ
+    16 MCPhase (angle)
+    17 MCU (2x2 unitary)
+不需要在circuit裡拆成很多個1, 2 qubit gate，整個gate只走一次state。
+
+只有control全為1的那部分state會改變:
+    non-local (global/thread/middle) control: 只挑出這些bit為1的chunk，
+        其他chunk (control在global/thread時就是整個file/thread_state) 完全不讀寫
+    local control: chunk內只計算control bit都為1的state
+target非local時一次處理 (target=0, target=1) 一對chunk。
+要處理的chunk依序平均分給所有thread，連續的chunk一起交給inner_loop/inner_loop2。
+===================================================================*/
+
+#define MC_MAX_CTRL 3
+
+int is_mc_gate(gate *g);
+void mc_gate(gate *g, int density);
+
+#endif
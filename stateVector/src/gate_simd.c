@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_util.h"
+#include "gate_chunk.h"
+#include "gate_soa.h"
+#include "gate_simd.h"
+
+// AVX kernel只寫了double的版本，float/mixed build時只有scalar及SoA kernel
+#ifdef PRECISION_DOUBLE
+/*===================================================================
+AVX2 + FMA: 一個 __m256d 放 2 個complex
+===================================================================*/
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define vec                 __m256d
+#define CW                  2
+#define VLOAD(p)            _mm256_loadu_pd(p)
+#define VSTORE(p, v)        _mm256_storeu_pd(p, v)
+#define VSET1(x)            _mm256_set1_pd(x)
+#define VSWAP(v)            _mm256_permute_pd(v, 0x5)
+#define VMUL(a, b)          _mm256_mul_pd(a, b)
+#define VADD(a, b)          _mm256_add_pd(a, b)
+#define VSUB(a, b)          _mm256_sub_pd(a, b)
+#define VFMADD(a, b, c)     _mm256_fmadd_pd(a, b, c)
+#define VFMADDSUB(a, b, c)  _mm256_fmaddsub_pd(a, b, c)
+#define SIMD(name)          name##_avx2
+#define FALLBACK(name)      name
+#include "gate_simd_impl.h"
+#undef vec
+#undef CW
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VSWAP
+#undef VMUL
+#undef VADD
+#undef VSUB
+#undef VFMADD
+#undef VFMADDSUB
+#undef SIMD
+#undef FALLBACK
+#pragma GCC pop_options
+
+/*===================================================================
+AVX-512: 一個 __m512d 放 4 個complex，不夠4個時退回AVX2
+===================================================================*/
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+#define vec                 __m512d
+#define CW                  4
+#define VLOAD(p)            _mm512_loadu_pd(p)
+#define VSTORE(p, v)        _mm512_storeu_pd(p, v)
+#define VSET1(x)            _mm512_set1_pd(x)
+#define VSWAP(v)            _mm512_permute_pd(v, 0x55)
+#define VMUL(a, b)          _mm512_mul_pd(a, b)
+#define VADD(a, b)          _mm512_add_pd(a, b)
+#define VSUB(a, b)          _mm512_sub_pd(a, b)
+#define VFMADD(a, b, c)     _mm512_fmadd_pd(a, b, c)
+#define VFMADDSUB(a, b, c)  _mm512_fmaddsub_pd(a, b, c)
+#define SIMD(name)          name##_avx512
+#define FALLBACK(name)      name##_avx2
+#include "gate_simd_impl.h"
+#undef vec
+#undef CW
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VSWAP
+#undef VMUL
+#undef VADD
+#undef VSUB
+#undef VFMADD
+#undef VFMADDSUB
+#undef SIMD
+#undef FALLBACK
+#pragma GCC pop_options
+
+#define SIMD_TABLE(isa) {{H_gate_##isa, H_gate_##isa}, \
+                         {S_gate_##isa, Sc_gate_##isa}, \
+                         {T_gate_##isa, Tc_gate_##isa}, \
+                         {X_gate_##isa, X_gate_##isa}, \
+                         {Y_gate_##isa, Yc_gate_##isa}, \
+                         {Z_gate_##isa, Z_gate_##isa}, \
+                         {P_gate_##isa, Pc_gate_##isa}, \
+                         {U_gate_##isa, Uc_gate_##isa}, \
+                                                        \
+                         {X_gate2_##isa, X_gate2_##isa}, \
+                         {Y_gate2_##isa, Yc_gate2_##isa}, \
+                         {Z_gate2_##isa, Z_gate2_##isa}, \
+                         {P_gate2_##isa, Pc_gate2_##isa}, \
+                         {U_gate2_##isa, Uc_gate2_##isa}, \
+                         {U2_gate_##isa, U2c_gate_##isa}, \
+                         {SWAP_gate_##isa, SWAP_gate_##isa}, \
+                         {U3_gate_##isa, U3c_gate_##isa}}
+
+static void (*gate_ops_avx2[16][2])(Type *) = SIMD_TABLE(avx2);
+static void (*gate_ops_avx512[16][2])(Type *) = SIMD_TABLE(avx512);
+#endif
+static void (*gate_ops_scalar[16][2])(Type *);
+
+void gate_simd_init(){
+    const char *isa = "scalar";
+    memcpy(gate_ops_scalar, gate_ops, sizeof(gate_ops_scalar));
+
+    if(StateFormat == STATE_SOA){
+        memcpy(gate_ops, gate_ops_soa, sizeof(gate_ops_soa));
+        isa = "SoA";
+    }
+#ifdef PRECISION_DOUBLE
+    else if(Simd){
+        __builtin_cpu_init();
+        int avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        if(avx2 && Simd != 2 && __builtin_cpu_supports("avx512f")){
+            memcpy(gate_ops, gate_ops_avx512, sizeof(gate_ops_avx512));
+            isa = "AVX-512";
+        }
+        else if(avx2){
+            memcpy(gate_ops, gate_ops_avx2, sizeof(gate_ops_avx2));
+            isa = "AVX2";
+        }
+    }
+#endif
+    printf("[SIMD]: %s kernels\n", isa);
+
+    if(SimdCheck)
+        gate_simd_check();
+}
+
+/*===================================================================
+gate_simd_check
+
+在 2^6 個state的buffer上，對每一組 (op, conj) 及所有 qubit 位置，
+比較目前 gate_ops 跟 scalar kernel 的結果。
+SoA格式時暫時把chunk設成 2^3 個state，讓gate同時有chunk內及跨chunk的offset。
+===================================================================*/
+static void check_move(int op, int a, int b, int c){
+    int q[3] = {a, b, c};
+    int n = (op == 13 || op == 14) ? 2 : 3;
+    memset(&gate_move, 0, sizeof(gate_args));
+
+    if(op < 8){
+        gate_move.half_targ = 1 << a;
+        return;
+    }
+    if(op < 13){
+        int hi = a > b ? a : b;
+        int lo = a > b ? b : a;
+        gate_move.half_ctrl = 1 << a;
+        gate_move.half_targ = 1 << b;
+        gate_move.large = 2 << hi;
+        gate_move.small = 2 << lo;
+        return;
+    }
+    // 由大到小排序
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && q[j-1] < q[j]; j--){
+            int tmp = q[j]; q[j] = q[j-1]; q[j-1] = tmp;
+        }
+    gate_move.large = 2 << q[0];
+    gate_move.half_large = 1 << q[0];
+    if(n == 2){
+        gate_move.small = 2 << q[1];
+        gate_move.half_small = 1 << q[1];
+        return;
+    }
+    gate_move.middle = 2 << q[1];
+    gate_move.half_middle = 1 << q[1];
+    gate_move.small = 2 << q[2];
+    gate_move.half_small = 1 << q[2];
+}
+
+void gate_simd_check(){
+    const int nbit = 6;
+    const int size = 1 << nbit;
+    Type *init = (Type *)malloc(size * sizeof(Type));
+    Type *ref = (Type *)malloc(size * sizeof(Type));
+    Type *got = (Type *)malloc(size * sizeof(Type));
+    Acc_t mat_r[64], mat_i[64];
+
+    Acc_t *save_real = real, *save_imag = imag;
+    int save_size = gate_size;
+    gate_args save_move = gate_move;
+    unsigned int save_segment = chunk_segment;
+    ull save_state = chunk_state, save_chunk_size = chunk_size;
+    if(StateFormat == STATE_SOA){
+        chunk_segment = 3;
+        chunk_state = 1ULL << chunk_segment;
+        chunk_size = chunk_state * sizeof(Type);
+    }
+
+    for (int i = 0; i < size; i++){
+        init[i].real = 2.0 * rand() / RAND_MAX - 1;
+        init[i].imag = 2.0 * rand() / RAND_MAX - 1;
+    }
+    for (int i = 0; i < 64; i++){
+        mat_r[i] = 2.0 * rand() / RAND_MAX - 1;
+        mat_i[i] = 2.0 * rand() / RAND_MAX - 1;
+    }
+    real = mat_r;
+    imag = mat_i;
+    gate_size = size;
+
+    // 跟同樣精度的scalar kernel比，只差在運算順序及何時round成Type_t
+    const double tol = sizeof(Type_t) == sizeof(double) ? 1e-12 : 1e-5;
+    int fail = 0;
+    double worst = 0;
+    for (int op = 0; op < 16; op++){
+        for (int d = 0; d < 2; d++){
+            if(gate_ops[op][d] == gate_ops_scalar[op][d])
+                continue;
+            double err = 0;
+            for (int a = 0; a < nbit; a++)
+            for (int b = 0; b < nbit; b++)
+            for (int c = 0; c < nbit; c++){
+                if(a == b || b == c || a == c)
+                    continue;
+                check_move(op, a, b, c);
+                memcpy(ref, init, size * sizeof(Type));
+                memcpy(got, init, size * sizeof(Type));
+                gate_ops_scalar[op][d](ref);
+                if(StateFormat == STATE_SOA){
+                    soa_from_aos(got, size);
+                    gate_ops[op][d](got);
+                    aos_from_soa(got, size);
+                }
+                else
+                    gate_ops[op][d](got);
+                for (int i = 0; i < size; i++){
+                    double e = fabs(ref[i].real - got[i].real) + fabs(ref[i].imag - got[i].imag);
+                    if(e > err) err = e;
+                }
+            }
+            if(err > tol){
+                printf("[SIMD]: gate_ops[%d][%d] mismatch, err = %e\n", op, d, err);
+                fail = 1;
+            }
+            if(err > worst) worst = err;
+        }
+    }
+    printf("[SIMD]: check %s, max err = %.1e\n", fail ? "failed" : "passed", worst);
+
+    real = save_real;
+    imag = save_imag;
+    gate_size = save_size;
+    gate_move = save_move;
+    chunk_segment = save_segment;
+    chunk_state = save_state;
+    chunk_size = save_chunk_size;
+    free(init);
+    free(ref);
+    free(got);
+    if(fail)
+        exit(1);
+}
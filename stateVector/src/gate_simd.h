@@ -0,0 +1,22 @@
+#ifndef GATE_SIMD_H_
+#define GATE_SIMD_H_
+
+/*===================================================================
+SIMD guide
+
+在ini的[system]設定:
+    simd=1        (default) 依CPU選擇最快的版本 (AVX-512 > AVX2 > scalar)
+    simd=2        最多用到AVX2
+    simd=0        只用原本的scalar kernel
+    simd_check=1  啟動時把SIMD kernel跟scalar kernel比對，不一致就結束
+
+gate_simd_init() 會把 gate_ops[16][2] 換成選到的版本；
+state_format=1 (SoA) 時則換成 gate_soa.c 的kernel，simd的設定不影響。
+gate內最小的offset不到一個vector時，kernel會自己退回較窄的版本。
+AVX kernel只有double版本，PRECISION=float/mixed build時simd=1也是scalar。
+===================================================================*/
+
+void gate_simd_init();
+void gate_simd_check();
+
+#endif
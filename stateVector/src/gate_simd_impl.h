@@ -0,0 +1,298 @@
+/*===================================================================
+SIMD gate kernels (template)
+
+由 gate_simd.c 以不同的向量寬度 include 兩次 (AVX2, AVX-512)，不要直接include。
+需要先定義:
+    vec             向量型別
+    CW              一個vector放幾個complex (Type)
+    VLOAD/VSTORE    unaligned load/store
+    VSET1           broadcast一個double
+    VSWAP           每個complex內的real/imag互換
+    VMUL/VADD/VSUB/VFMADD
+    VFMADDSUB       a*b-c (real lane), a*b+c (imag lane)
+    SIMD(name)      加上ISA後綴的函式名稱
+    FALLBACK(name)  連續的state不到CW個時改用的版本
+
+Type在記憶體中是 {real, imag} 交錯排列，一個vector剛好放CW個complex，
+所以只要gate內最小的offset (half_targ, small>>1, half_small) >= CW，
+就可以一次處理CW組state。矩陣元素在進迴圈前先broadcast成vector。
+===================================================================*/
+
+#define VP(p) ((double *)(p))
+
+// v * (cr + ci*i)，cr/ci 已經broadcast
+static inline vec SIMD(cmul)(vec v, vec cr, vec ci){
+    return VFMADDSUB(v, cr, VMUL(VSWAP(v), ci));
+}
+
+// 把row-major的 n*n 矩陣broadcast進 mr/mi，conj時把虛部變號
+static inline void SIMD(load_mat)(int n, vec *mr, vec *mi, int conj){
+    for (int k = 0; k < n*n; k++){
+        mr[k] = VSET1(real[k]);
+        mi[k] = VSET1(conj ? -imag[k] : imag[k]);
+    }
+}
+
+// p[0..n-1] 的 state 乘上 n*n 矩陣
+static inline void SIMD(matvec)(Type **p, int n, const vec *mr, const vec *mi){
+    vec x[8], xs[8];
+    vec one = VSET1(1.0);
+    for (int c = 0; c < n; c++){
+        x[c] = VLOAD(VP(p[c]));
+        xs[c] = VSWAP(x[c]);
+    }
+    for (int r = 0; r < n; r++){
+        vec a = VMUL(x[0], mr[r*n]);
+        vec b = VMUL(xs[0], mi[r*n]);
+        for (int c = 1; c < n; c++){
+            a = VFMADD(x[c], mr[r*n+c], a);
+            b = VFMADD(xs[c], mi[r*n+c], b);
+        }
+        VSTORE(VP(p[r]), VFMADDSUB(a, one, b));
+    }
+}
+
+/*===================================================================
+Type I: (up, lo) 相距 half_targ
+===================================================================*/
+static inline void SIMD(phase1)(Type *q_rd, double cr, double ci){
+    ull h = gate_move.half_targ;
+    vec vr = VSET1(cr), vi = VSET1(ci);
+    for (ull i = 0; i < gate_size; i += 2*h){
+        for (ull j = i+h; j < i+2*h; j += CW){
+            vec lo = VLOAD(VP(q_rd+j));
+            VSTORE(VP(q_rd+j), SIMD(cmul)(lo, vr, vi));
+        }
+    }
+}
+
+static inline void SIMD(mat1)(Type *q_rd, const double *ur, const double *ui){
+    ull h = gate_move.half_targ;
+    vec mr[4], mi[4];
+    for (int k = 0; k < 4; k++){
+        mr[k] = VSET1(ur[k]);
+        mi[k] = VSET1(ui[k]);
+    }
+    for (ull i = 0; i < gate_size; i += 2*h){
+        for (ull j = i; j < i+h; j += CW){
+            Type *p[2] = {q_rd+j, q_rd+j+h};
+            SIMD(matvec)(p, 2, mr, mi);
+        }
+    }
+}
+
+void SIMD(H_gate)(Type *q_rd){
+    ull h = gate_move.half_targ;
+    if (h < CW){ FALLBACK(H_gate)(q_rd); return; }
+    vec s = VSET1(1./sqrt(2));
+    for (ull i = 0; i < gate_size; i += 2*h){
+        for (ull j = i; j < i+h; j += CW){
+            vec up = VLOAD(VP(q_rd+j));
+            vec lo = VLOAD(VP(q_rd+j+h));
+            VSTORE(VP(q_rd+j), VMUL(VADD(up, lo), s));
+            VSTORE(VP(q_rd+j+h), VMUL(VSUB(up, lo), s));
+        }
+    }
+}
+
+void SIMD(X_gate)(Type *q_rd){
+    ull h = gate_move.half_targ;
+    if (h < CW){ FALLBACK(X_gate)(q_rd); return; }
+    for (ull i = 0; i < gate_size; i += 2*h){
+        for (ull j = i; j < i+h; j += CW){
+            vec up = VLOAD(VP(q_rd+j));
+            vec lo = VLOAD(VP(q_rd+j+h));
+            VSTORE(VP(q_rd+j), lo);
+            VSTORE(VP(q_rd+j+h), up);
+        }
+    }
+}
+
+#define SIMD_PHASE1(name, cr, ci) \
+void SIMD(name)(Type *q_rd){ \
+    if (gate_move.half_targ < CW){ FALLBACK(name)(q_rd); return; } \
+    SIMD(phase1)(q_rd, cr, ci); \
+}
+SIMD_PHASE1(S_gate, 0, 1)
+SIMD_PHASE1(Sc_gate, 0, -1)
+SIMD_PHASE1(T_gate, 1./sqrt(2), 1./sqrt(2))
+SIMD_PHASE1(Tc_gate, 1./sqrt(2), -1./sqrt(2))
+SIMD_PHASE1(Z_gate, -1, 0)
+SIMD_PHASE1(P_gate, cos(real[0]), sin(real[0]))
+SIMD_PHASE1(Pc_gate, cos(real[0]), -sin(real[0]))
+#undef SIMD_PHASE1
+
+void SIMD(Y_gate)(Type *q_rd){
+    static const double ur[4] = {0, 0, 0, 0}, ui[4] = {0, -1, 1, 0};
+    if (gate_move.half_targ < CW){ FALLBACK(Y_gate)(q_rd); return; }
+    SIMD(mat1)(q_rd, ur, ui);
+}
+
+void SIMD(Yc_gate)(Type *q_rd){
+    static const double ur[4] = {0, 0, 0, 0}, ui[4] = {0, 1, -1, 0};
+    if (gate_move.half_targ < CW){ FALLBACK(Yc_gate)(q_rd); return; }
+    SIMD(mat1)(q_rd, ur, ui);
+}
+
+void SIMD(U_gate)(Type *q_rd){
+    if (gate_move.half_targ < CW){ FALLBACK(U_gate)(q_rd); return; }
+    SIMD(mat1)(q_rd, real, imag);
+}
+
+void SIMD(Uc_gate)(Type *q_rd){
+    double ui[4] = {-imag[0], -imag[1], -imag[2], -imag[3]};
+    if (gate_move.half_targ < CW){ FALLBACK(Uc_gate)(q_rd); return; }
+    SIMD(mat1)(q_rd, real, ui);
+}
+
+/*===================================================================
+Type II: control-target，只動 ctrl = 1 的 (up, lo)
+up = half_ctrl + i + j + k, lo = up + half_targ
+===================================================================*/
+#define TYPE2_LOOP \
+    ull large = gate_move.large, small = gate_move.small; \
+    ull hc = gate_move.half_ctrl, ht = gate_move.half_targ; \
+    for (ull i = 0; i < gate_size; i += large) \
+        for (ull j = i; j < i + (large>>1); j += small) \
+            for (ull k = j + hc; k < j + hc + (small>>1); k += CW)
+
+static inline void SIMD(phase2)(Type *q_rd, double cr, double ci){
+    vec vr = VSET1(cr), vi = VSET1(ci);
+    TYPE2_LOOP {
+        vec lo = VLOAD(VP(q_rd+k+ht));
+        VSTORE(VP(q_rd+k+ht), SIMD(cmul)(lo, vr, vi));
+    }
+}
+
+static inline void SIMD(mat2)(Type *q_rd, const double *ur, const double *ui){
+    vec mr[4], mi[4];
+    for (int m = 0; m < 4; m++){
+        mr[m] = VSET1(ur[m]);
+        mi[m] = VSET1(ui[m]);
+    }
+    TYPE2_LOOP {
+        Type *p[2] = {q_rd+k, q_rd+k+ht};
+        SIMD(matvec)(p, 2, mr, mi);
+    }
+}
+
+void SIMD(X_gate2)(Type *q_rd){
+    if ((gate_move.small>>1) < CW){ FALLBACK(X_gate2)(q_rd); return; }
+    TYPE2_LOOP {
+        vec up = VLOAD(VP(q_rd+k));
+        vec lo = VLOAD(VP(q_rd+k+ht));
+        VSTORE(VP(q_rd+k), lo);
+        VSTORE(VP(q_rd+k+ht), up);
+    }
+}
+
+#define SIMD_PHASE2(name, cr, ci) \
+void SIMD(name)(Type *q_rd){ \
+    if ((gate_move.small>>1) < CW){ FALLBACK(name)(q_rd); return; } \
+    SIMD(phase2)(q_rd, cr, ci); \
+}
+SIMD_PHASE2(Z_gate2, -1, 0)
+SIMD_PHASE2(P_gate2, cos(real[0]), sin(real[0]))
+SIMD_PHASE2(Pc_gate2, cos(real[0]), -sin(real[0]))
+#undef SIMD_PHASE2
+
+void SIMD(Y_gate2)(Type *q_rd){
+    static const double ur[4] = {0, 0, 0, 0}, ui[4] = {0, -1, 1, 0};
+    if ((gate_move.small>>1) < CW){ FALLBACK(Y_gate2)(q_rd); return; }
+    SIMD(mat2)(q_rd, ur, ui);
+}
+
+void SIMD(Yc_gate2)(Type *q_rd){
+    static const double ur[4] = {0, 0, 0, 0}, ui[4] = {0, 1, -1, 0};
+    if ((gate_move.small>>1) < CW){ FALLBACK(Yc_gate2)(q_rd); return; }
+    SIMD(mat2)(q_rd, ur, ui);
+}
+
+void SIMD(U_gate2)(Type *q_rd){
+    if ((gate_move.small>>1) < CW){ FALLBACK(U_gate2)(q_rd); return; }
+    SIMD(mat2)(q_rd, real, imag);
+}
+
+void SIMD(Uc_gate2)(Type *q_rd){
+    double ui[4] = {-imag[0], -imag[1], -imag[2], -imag[3]};
+    if ((gate_move.small>>1) < CW){ FALLBACK(Uc_gate2)(q_rd); return; }
+    SIMD(mat2)(q_rd, real, ui);
+}
+#undef TYPE2_LOOP
+
+/*===================================================================
+Type II: general 2 qubit gate / SWAP
+q_00 = i + j + k，其餘加上 half_small / half_large
+===================================================================*/
+#define U2_LOOP \
+    ull large = gate_move.large, small = gate_move.small; \
+    ull hl = gate_move.half_large, hs = gate_move.half_small; \
+    for (ull i = 0; i < gate_size; i += large) \
+        for (ull j = i; j < i + hl; j += small) \
+            for (ull k = j; k < j + hs; k += CW)
+
+static inline void SIMD(u2)(Type *q_rd, int conj){
+    vec mr[16], mi[16];
+    SIMD(load_mat)(4, mr, mi, conj);
+    U2_LOOP {
+        Type *p[4] = {q_rd+k, q_rd+k+hs, q_rd+k+hl, q_rd+k+hl+hs};
+        SIMD(matvec)(p, 4, mr, mi);
+    }
+}
+
+void SIMD(U2_gate)(Type *q_rd){
+    if (gate_move.half_small < CW){ FALLBACK(U2_gate)(q_rd); return; }
+    SIMD(u2)(q_rd, 0);
+}
+
+void SIMD(U2c_gate)(Type *q_rd){
+    if (gate_move.half_small < CW){ FALLBACK(U2c_gate)(q_rd); return; }
+    SIMD(u2)(q_rd, 1);
+}
+
+void SIMD(SWAP_gate)(Type *q_rd){
+    if (gate_move.half_small < CW){ FALLBACK(SWAP_gate)(q_rd); return; }
+    U2_LOOP {
+        vec q01 = VLOAD(VP(q_rd+k+hs));
+        vec q10 = VLOAD(VP(q_rd+k+hl));
+        VSTORE(VP(q_rd+k+hs), q10);
+        VSTORE(VP(q_rd+k+hl), q01);
+    }
+}
+#undef U2_LOOP
+
+/*===================================================================
+Type III: general 3 qubit gate
+q_000 = i + j + k + l，q_abc 再加上 a*half_large + b*half_middle + c*half_small
+===================================================================*/
+static inline void SIMD(u3)(Type *q_rd, int conj){
+    ull large = gate_move.large, middle = gate_move.middle, small = gate_move.small;
+    ull hl = gate_move.half_large, hm = gate_move.half_middle, hs = gate_move.half_small;
+    ull off[8];
+    vec mr[64], mi[64];
+    SIMD(load_mat)(8, mr, mi, conj);
+    for (int b = 0; b < 8; b++)
+        off[b] = (b&4 ? hl : 0) + (b&2 ? hm : 0) + (b&1 ? hs : 0);
+
+    for (ull i = 0; i < gate_size; i += large)
+        for (ull j = i; j < i + hl; j += middle)
+            for (ull k = j; k < j + hm; k += small)
+                for (ull l = k; l < k + hs; l += CW){
+                    Type *p[8];
+                    for (int b = 0; b < 8; b++)
+                        p[b] = q_rd + l + off[b];
+                    SIMD(matvec)(p, 8, mr, mi);
+                }
+}
+
+void SIMD(U3_gate)(Type *q_rd){
+    if (gate_move.half_small < CW){ FALLBACK(U3_gate)(q_rd); return; }
+    SIMD(u3)(q_rd, 0);
+}
+
+void SIMD(U3c_gate)(Type *q_rd){
+    if (gate_move.half_small < CW){ FALLBACK(U3c_gate)(q_rd); return; }
+    SIMD(u3)(q_rd, 1);
+}
+
+#undef VP
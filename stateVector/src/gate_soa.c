@@ -0,0 +1,456 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_util.h"
+#include "gate_chunk.h"
+#include "gate_soa.h"
+
+/*===================================================================
+SoA kernels
+
+每個kernel跟 gate_chunk.c 的同名kernel作用相同，只是buffer內每個chunk
+是 [real x chunk_state][imag x chunk_state]。
+gate的offset都是2的次方，所以把state切成長度
+min(最小的offset, chunk_state) 的一段一段時，每一段在real/imag平面上
+都是連續的，交給下面的 run_* 處理。
+run_* 是單純的陣列迴圈，由compiler向量化；target_clones 會依CPU
+在AVX-512/AVX2/預設版本之間選擇。
+===================================================================*/
+#define VECTORIZE __attribute__((target_clones("avx512f", "avx2", "default")))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define RE(i) SOA_RE(q_rd, i)
+#define IM(i) (SOA_RE(q_rd, i) + chunk_state)
+
+/*===================================================================
+run level
+===================================================================*/
+VECTORIZE static void run_phase(Type_t *restrict r, Type_t *restrict i, ull n, Acc_t cr, Acc_t ci){
+    for (ull k = 0; k < n; k++){
+        Acc_t a = r[k], b = i[k];
+        r[k] = a*cr - b*ci;
+        i[k] = a*ci + b*cr;
+    }
+}
+
+VECTORIZE static void run_neg(Type_t *restrict r, Type_t *restrict i, ull n){
+    for (ull k = 0; k < n; k++){
+        r[k] = -r[k];
+        i[k] = -i[k];
+    }
+}
+
+VECTORIZE static void run_h(Type_t *restrict r0, Type_t *restrict i0,
+                            Type_t *restrict r1, Type_t *restrict i1, ull n){
+    const Acc_t s = 1./sqrt(2);
+    for (ull k = 0; k < n; k++){
+        Acc_t a = r0[k], b = i0[k], c = r1[k], d = i1[k];
+        r0[k] = (a + c) * s;    i0[k] = (b + d) * s;
+        r1[k] = (a - c) * s;    i1[k] = (b - d) * s;
+    }
+}
+
+VECTORIZE static void run_swap(Type_t *restrict r0, Type_t *restrict i0,
+                               Type_t *restrict r1, Type_t *restrict i1, ull n){
+    for (ull k = 0; k < n; k++){
+        Type_t a = r0[k], b = i0[k];
+        r0[k] = r1[k];  i0[k] = i1[k];
+        r1[k] = a;      i1[k] = b;
+    }
+}
+
+/*
+矩陣類的gate: 一次處理 SOA_TILE 組要一起運算的state。
+把第c個state的real/imag收集到 x[2c][t]、x[2c+1][t]，在local陣列上
+做向量化的矩陣乘法放到 y 後再寫回 (local陣列不會跟buffer alias，compiler才敢向量化)。
+offset >= SOA_TILE 時每個tile是buffer內連續的一段；
+offset較小時，把多組的run gather 進同一個tile。
+*/
+#define SOA_TILE 64
+
+static inline __attribute__((always_inline))
+void tile_mat_n(int dim, const Acc_t x[][SOA_TILE], Acc_t y[][SOA_TILE],
+                const Acc_t *ar, const Acc_t *ai){
+    for (int row = 0; row < dim; row++)
+        for (int t = 0; t < SOA_TILE; t++){
+            Acc_t sr = 0, si = 0;
+            for (int c = 0; c < dim; c++){
+                sr += ar[row*dim+c]*x[2*c][t] - ai[row*dim+c]*x[2*c+1][t];
+                si += ar[row*dim+c]*x[2*c+1][t] + ai[row*dim+c]*x[2*c][t];
+            }
+            y[2*row][t] = sr;
+            y[2*row+1][t] = si;
+        }
+}
+
+/*
+gather/scatter 一次搬 g 個連續的state: len >= SOA_VEC 時用固定長度的迴圈
+(compiler會變成一個向量load/store)，否則一次一個。
+不用 memcpy 或變動長度的迴圈，因為很短的copy會被換成 rep movs，啟動成本很高。
+*/
+#define SOA_VEC 8
+#define GATHER_COPY(dr, di, sr, si) \
+    do { \
+        if (g == SOA_VEC) \
+            for (int k = 0; k < SOA_VEC; k++){ \
+                (dr)[k] = (sr)[k]; \
+                (di)[k] = (si)[k]; \
+            } \
+        else { \
+            *(dr) = *(sr); \
+            *(di) = *(si); \
+        } \
+    } while (0)
+
+/*
+run_mat: 對 base[0..nbase) 每組做矩陣乘法，組內第c個state在 base + off[c]，
+每組往後連續 len 個state (len 為2的次方，len 與 off 都不會跨chunk)。
+*/
+#define RUN_MAT(dim) \
+VECTORIZE static void run_mat##dim(Type *q_rd, const ull *base, ull nbase, ull len, \
+                                   const ull *off, const Acc_t *mr, const Acc_t *mi){ \
+    Acc_t x[2*dim][SOA_TILE], y[2*dim][SOA_TILE]; \
+    Acc_t ar[dim*dim], ai[dim*dim]; \
+    for (int k = 0; k < dim*dim; k++){ \
+        ar[k] = mr[k]; \
+        ai[k] = mi[k]; \
+    } \
+    if (len >= SOA_TILE){ \
+        for (ull b = 0; b < nbase; b++) \
+            for (ull k = 0; k < len; k += SOA_TILE){ \
+                for (int c = 0; c < dim; c++){ \
+                    const Type_t *sr = RE(base[b]+off[c]+k), *si = IM(base[b]+off[c]+k); \
+                    for (int t = 0; t < SOA_TILE; t++){ \
+                        x[2*c][t] = sr[t]; \
+                        x[2*c+1][t] = si[t]; \
+                    } \
+                } \
+                tile_mat_n(dim, x, y, ar, ai); \
+                for (int c = 0; c < dim; c++){ \
+                    Type_t *sr = RE(base[b]+off[c]+k), *si = IM(base[b]+off[c]+k); \
+                    for (int t = 0; t < SOA_TILE; t++){ \
+                        sr[t] = y[2*c][t]; \
+                        si[t] = y[2*c+1][t]; \
+                    } \
+                } \
+            } \
+        return; \
+    } \
+    /* len < SOA_TILE: 一個tile放 SOA_TILE/len 組run，第t個元素是第 t/len 組的第 t%len 個 */ \
+    int sh = __builtin_ctzll(len); \
+    int g = len >= SOA_VEC ? SOA_VEC : 1; \
+    memset(x, 0, sizeof(x)); \
+    for (ull b0 = 0; b0 < nbase; b0 += SOA_TILE >> sh){ \
+        int n = (nbase-b0) << sh < SOA_TILE ? (nbase-b0) << sh : SOA_TILE; \
+        for (int c = 0; c < dim; c++) \
+            for (int t = 0; t < n; t += g){ \
+                ull s = base[b0 + (t>>sh)] + off[c] + (t & (len-1)); \
+                GATHER_COPY(x[2*c]+t, x[2*c+1]+t, RE(s), IM(s)); \
+            } \
+        tile_mat_n(dim, x, y, ar, ai); \
+        for (int c = 0; c < dim; c++) \
+            for (int t = 0; t < n; t += g){ \
+                ull s = base[b0 + (t>>sh)] + off[c] + (t & (len-1)); \
+                GATHER_COPY(RE(s), IM(s), y[2*c]+t, y[2*c+1]+t); \
+            } \
+    } \
+}
+
+RUN_MAT(2)
+RUN_MAT(4)
+RUN_MAT(8)
+
+// 收集每段run的起點，滿了就交給 run_mat 處理
+#define MAT_BASES 256
+#define MAT_PUSH(dim, b) \
+    do { \
+        base[nb++] = (b); \
+        if (nb == MAT_BASES){ \
+            run_mat##dim(q_rd, base, nb, len, off, mr, mi); \
+            nb = 0; \
+        } \
+    } while (0)
+#define MAT_FLUSH(dim) \
+    do { \
+        if (nb) \
+            run_mat##dim(q_rd, base, nb, len, off, mr, mi); \
+    } while (0)
+
+/*===================================================================
+gate level (Type I)
+===================================================================*/
+#define TYPE1_RUNS \
+    ull h = gate_move.half_targ; \
+    ull len = MIN(h, chunk_state); \
+    for (ull i = 0; i < gate_size; i += 2*h) \
+        for (ull up = i; up < i+h; up += len)
+
+static void phase1(Type *q_rd, Acc_t cr, Acc_t ci){
+    TYPE1_RUNS
+        run_phase(RE(up+h), IM(up+h), len, cr, ci);
+}
+
+static void mat1(Type *q_rd, const Acc_t *mr, const Acc_t *mi){
+    ull base[MAT_BASES], nb = 0;
+    ull off[2] = {0, gate_move.half_targ};
+    TYPE1_RUNS
+        MAT_PUSH(2, up);
+    MAT_FLUSH(2);
+}
+
+static const Acc_t Y_r[4] = {0, 0, 0, 0}, Y_i[4] = {0, -1, 1, 0}, Yc_i[4] = {0, 1, -1, 0};
+
+void H_gate_soa (Type *q_rd){
+    TYPE1_RUNS
+        run_h(RE(up), IM(up), RE(up+h), IM(up+h), len);
+}
+
+void X_gate_soa (Type *q_rd){
+    TYPE1_RUNS
+        run_swap(RE(up), IM(up), RE(up+h), IM(up+h), len);
+}
+
+void Z_gate_soa (Type *q_rd){
+    TYPE1_RUNS
+        run_neg(RE(up+h), IM(up+h), len);
+}
+
+void S_gate_soa  (Type *q_rd){ phase1(q_rd, 0,  1); }
+void Sc_gate_soa (Type *q_rd){ phase1(q_rd, 0, -1); }
+void T_gate_soa  (Type *q_rd){ phase1(q_rd, 1./sqrt(2),  1./sqrt(2)); }
+void Tc_gate_soa (Type *q_rd){ phase1(q_rd, 1./sqrt(2), -1./sqrt(2)); }
+void P_gate_soa  (Type *q_rd){ phase1(q_rd, cos(real[0]),  sin(real[0])); }
+void Pc_gate_soa (Type *q_rd){ phase1(q_rd, cos(real[0]), -sin(real[0])); }
+
+void Y_gate_soa  (Type *q_rd){ mat1(q_rd, Y_r, Y_i); }
+void Yc_gate_soa (Type *q_rd){ mat1(q_rd, Y_r, Yc_i); }
+void U_gate_soa  (Type *q_rd){ mat1(q_rd, real, imag); }
+void Uc_gate_soa (Type *q_rd){
+    Acc_t mi[4] = {-imag[0], -imag[1], -imag[2], -imag[3]};
+    mat1(q_rd, real, mi);
+}
+
+/*===================================================================
+gate level (Type II)
+2nd type of 1 qubit gate for control-target format
+===================================================================*/
+#define TYPE2_RUNS \
+    ull large = gate_move.large, small = gate_move.small; \
+    ull hc = gate_move.half_ctrl; \
+    ull len = MIN(small>>1, chunk_state); \
+    for (ull i = 0; i < gate_size; i += large) \
+        for (ull j = i; j < i + (large>>1); j += small) \
+            for (ull up = j+hc; up < j+hc+(small>>1); up += len)
+
+static void phase2(Type *q_rd, Acc_t cr, Acc_t ci){
+    ull h = gate_move.half_targ;
+    TYPE2_RUNS
+        run_phase(RE(up+h), IM(up+h), len, cr, ci);
+}
+
+static void mat2(Type *q_rd, const Acc_t *mr, const Acc_t *mi){
+    ull base[MAT_BASES], nb = 0;
+    ull off[2] = {0, gate_move.half_targ};
+    TYPE2_RUNS
+        MAT_PUSH(2, up);
+    MAT_FLUSH(2);
+}
+
+void X_gate2_soa (Type *q_rd){
+    ull h = gate_move.half_targ;
+    TYPE2_RUNS
+        run_swap(RE(up), IM(up), RE(up+h), IM(up+h), len);
+}
+
+void Z_gate2_soa (Type *q_rd){
+    ull h = gate_move.half_targ;
+    TYPE2_RUNS
+        run_neg(RE(up+h), IM(up+h), len);
+}
+
+void P_gate2_soa  (Type *q_rd){ phase2(q_rd, cos(real[0]),  sin(real[0])); }
+void Pc_gate2_soa (Type *q_rd){ phase2(q_rd, cos(real[0]), -sin(real[0])); }
+void Y_gate2_soa  (Type *q_rd){ mat2(q_rd, Y_r, Y_i); }
+void Yc_gate2_soa (Type *q_rd){ mat2(q_rd, Y_r, Yc_i); }
+void U_gate2_soa  (Type *q_rd){ mat2(q_rd, real, imag); }
+void Uc_gate2_soa (Type *q_rd){
+    Acc_t mi[4] = {-imag[0], -imag[1], -imag[2], -imag[3]};
+    mat2(q_rd, real, mi);
+}
+
+/*===================================================================
+gate level (Type II)
+General 2 qubit gate / SWAP
+===================================================================*/
+#define U2_RUNS \
+    ull large = gate_move.large, small = gate_move.small; \
+    ull hl = gate_move.half_large, hs = gate_move.half_small; \
+    ull len = MIN(hs, chunk_state); \
+    for (ull i = 0; i < gate_size; i += large) \
+        for (ull j = i; j < i + hl; j += small) \
+            for (ull q = j; q < j + hs; q += len)
+
+static void u2(Type *q_rd, const Acc_t *mr, const Acc_t *mi){
+    ull base[MAT_BASES], nb = 0;
+    ull off[4] = {0, gate_move.half_small, gate_move.half_large, gate_move.half_large+gate_move.half_small};
+    U2_RUNS
+        MAT_PUSH(4, q);
+    MAT_FLUSH(4);
+}
+
+void U2_gate_soa (Type *q_rd){ u2(q_rd, real, imag); }
+void U2c_gate_soa (Type *q_rd){
+    Acc_t mi[16];
+    for (int k = 0; k < 16; k++)
+        mi[k] = -imag[k];
+    u2(q_rd, real, mi);
+}
+
+void SWAP_gate_soa (Type *q_rd){
+    U2_RUNS
+        run_swap(RE(q+hs), IM(q+hs), RE(q+hl), IM(q+hl), len);
+}
+
+/*===================================================================
+gate level (Type III)
+General 3 qubit gate
+===================================================================*/
+static void u3(Type *q_rd, const Acc_t *mr, const Acc_t *mi){
+    ull large = gate_move.large, middle = gate_move.middle, small = gate_move.small;
+    ull hl = gate_move.half_large, hm = gate_move.half_middle, hs = gate_move.half_small;
+    ull len = MIN(hs, chunk_state);
+    ull base[MAT_BASES], nb = 0;
+    ull off[8];
+    for (int b = 0; b < 8; b++)
+        off[b] = (b&4 ? hl : 0) + (b&2 ? hm : 0) + (b&1 ? hs : 0);
+
+    for (ull i = 0; i < gate_size; i += large)
+        for (ull j = i; j < i + hl; j += middle)
+            for (ull k = j; k < j + hm; k += small)
+                for (ull q = k; q < k + hs; q += len)
+                    MAT_PUSH(8, q);
+    MAT_FLUSH(8);
+}
+
+void U3_gate_soa (Type *q_rd){ u3(q_rd, real, imag); }
+void U3c_gate_soa (Type *q_rd){
+    Acc_t mi[64];
+    for (int k = 0; k < 64; k++)
+        mi[k] = -imag[k];
+    u3(q_rd, real, mi);
+}
+
+/*===================================================================
+parallel SWAP (qubit remap)，見 PSWAP_gate
+===================================================================*/
+void PSWAP_gate_soa (Type *q_rd) {
+    int nbit = __builtin_ctzll(gate_size / chunk_state);
+    ull in_chunk = chunk_state - 1;
+
+    for (ull i = 0; i < gate_size; i++){
+        ull c = i >> chunk_segment;
+        ull off = i & in_chunk;
+        ull nc = 0;
+        ull noff = off;
+        for (int k = 0; k < nbit; k++){
+            ull cbit = 1ULL << (nbit-1-k);
+            if (off & swap_mask[k])
+                nc |= cbit;
+            if (c & cbit)
+                noff |= swap_mask[k];
+            else
+                noff &= ~swap_mask[k];
+        }
+        ull j = (nc << chunk_segment) | noff;
+        if (i < j){
+            Type_t r = *RE(i), im = *IM(i);
+            *RE(i) = *RE(j);    *IM(i) = *IM(j);
+            *RE(j) = r;         *IM(j) = im;
+        }
+    }
+}
+
+/*===================================================================
+measure，見 PreMeasure / Measure_0 / Measure_1
+===================================================================*/
+void PreMeasure_soa (Type *q_rd){
+    double p0 = 0;
+    double p1 = 0;
+    TYPE1_RUNS {
+        Type_t *r0 = RE(up), *i0 = IM(up), *r1 = RE(up+h), *i1 = IM(up+h);
+        for (ull k = 0; k < len; k++){
+            p0 += r0[k]*r0[k] + i0[k]*i0[k];
+            p1 += r1[k]*r1[k] + i1[k]*i1[k];
+        }
+    }
+    #pragma omp critical
+    {
+        real[0] += p0;
+        real[1] += p1;
+    }
+}
+
+void Measure_0_soa (Type *q_rd){
+    TYPE1_RUNS {
+        run_phase(RE(up), IM(up), len, real[0], 0);
+        memset(RE(up+h), 0, len*sizeof(Type_t));
+        memset(IM(up+h), 0, len*sizeof(Type_t));
+    }
+}
+
+void Measure_1_soa (Type *q_rd){
+    TYPE1_RUNS {
+        memset(RE(up), 0, len*sizeof(Type_t));
+        memset(IM(up), 0, len*sizeof(Type_t));
+        run_phase(RE(up+h), IM(up+h), len, real[0], 0);
+    }
+}
+
+/*===================================================================
+buffer內的格式轉換 (size個state，需為chunk_state的倍數)
+===================================================================*/
+void soa_from_aos(Type *q, ull size){
+    Type_t *tmp = (Type_t *)malloc(chunk_size);
+    for (ull c = 0; c < size; c += chunk_state){
+        Type *src = q + c;
+        for (ull k = 0; k < chunk_state; k++){
+            tmp[k] = src[k].real;
+            tmp[chunk_state+k] = src[k].imag;
+        }
+        memcpy(src, tmp, chunk_size);
+    }
+    free(tmp);
+}
+
+void aos_from_soa(Type *q, ull size){
+    Type *tmp = (Type *)malloc(chunk_size);
+    for (ull c = 0; c < size; c += chunk_state){
+        Type_t *src = (Type_t *)(q + c);
+        for (ull k = 0; k < chunk_state; k++){
+            tmp[k].real = src[k];
+            tmp[k].imag = src[chunk_state+k];
+        }
+        memcpy(q + c, tmp, chunk_size);
+    }
+    free(tmp);
+}
+
+void (*gate_ops_soa[16][2])(Type *) = {{H_gate_soa, H_gate_soa},
+                                       {S_gate_soa, Sc_gate_soa},
+                                       {T_gate_soa, Tc_gate_soa},
+                                       {X_gate_soa, X_gate_soa},
+                                       {Y_gate_soa, Yc_gate_soa},
+                                       {Z_gate_soa, Z_gate_soa},
+                                       {P_gate_soa, Pc_gate_soa},
+                                       {U_gate_soa, Uc_gate_soa},
+
+                                       {X_gate2_soa, X_gate2_soa},
+                                       {Y_gate2_soa, Yc_gate2_soa},
+                                       {Z_gate2_soa, Z_gate2_soa},
+                                       {P_gate2_soa, Pc_gate2_soa},
+                                       {U_gate2_soa, Uc_gate2_soa},
+                                       {U2_gate_soa, U2c_gate_soa},
+                                       {SWAP_gate_soa, SWAP_gate_soa},
+                                       {U3_gate_soa, U3c_gate_soa}};
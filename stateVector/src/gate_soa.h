@@ -0,0 +1,32 @@
+#ifndef GATE_SOA_H_
+#define GATE_SOA_H_
+
+/*===================================================================
+SoA state format guide
+
+在ini的[system]設定 state_format:
+    state_format=0   (default) interleaved，每個state是 Type {real, imag}
+    state_format=1   SoA，每個chunk內先放chunk_state個real，再放chunk_state個imag
+
+chunk大小不變，所以I/O量及所有file offset都跟原本一樣；
+只有buffer內的kernel需要換成 *_soa 版本 (gate_simd_init() 會換掉 gate_ops)。
+兩種格式可以用 convert_state.py 互轉。
+===================================================================*/
+
+#define STATE_AOS 0
+#define STATE_SOA 1
+
+// chunk內第i個state的real，imag在 +chunk_state
+#define SOA_RE(q, i) ((Type_t *)(q) + (((i) >> chunk_segment) << (chunk_segment+1)) + ((i) & (chunk_state-1)))
+
+void PSWAP_gate_soa (Type *q_rd);
+void PreMeasure_soa (Type *q_rd);
+void Measure_0_soa (Type *q_rd);
+void Measure_1_soa (Type *q_rd);
+
+void soa_from_aos(Type *q, unsigned long long size);
+void aos_from_soa(Type *q, unsigned long long size);
+
+extern void (*gate_ops_soa[16][2])(Type *);
+
+#endif
@@ -2,9 +2,13 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <omp.h>
 #include "common.h"
 #include "gate.h"
 #include "gate_util.h"
+#include "io_engine.h"
+#include "plan.h"
+#include "zchunk.h"
 
 void set_outer(ull outer){
     _outer = outer;
@@ -12,13 +16,88 @@ void set_outer(ull outer){
     _half_outer_size = _half_outer * sizeof(Type);
 }
 
+int inner_loop_width(){
+    if(inner_loop_func == inner_loop8) return 8;
+    if(inner_loop_func == inner_loop4) return 4;
+    if(inner_loop_func == inner_loop2 || inner_loop_func == inner_loop2_read
+        || inner_loop_func == inner_loop2_swap) return 2;
+    return 1;
+}
+
+/*
+_thread_CX{width}(s) 結束後 s->fd_off 的位置:
+每次迴圈inner_loop_func把用到的fd往後推size，_thread_CX2/4/8再各加 _half_outer_size
+*/
+void thread_advance(setStreamv2 *s, int width){
+    int nfd = inner_loop_width();
+    ull iters = (loop_size + _outer - 1) / _outer;
+    ull size = (width == 1) ? _outer : _half_outer;
+    ull adv = iters * ((size + chunk_state - 1) / chunk_state) * chunk_size;
+    for (int k = 0; k < nfd; k++)
+        s->fd_off[k] += adv;
+    if(width > 1)
+        for (int k = 0; k < width; k++)
+            s->fd_off[k] += iters * _half_outer_size;
+}
+
+/*===================================================================
+thread split guide
+
+gate的qubit在global/thread段時，一對 (或四、八個) file/thread_state 的組合只交給一條thread，
+原本只有 num_thread/2 (/4, /8) 條thread有工作。
+現在 thread_split = F 條相鄰的thread (t/F 相同) 分同一組，
+_thread_CX* 裡總共 iters * (size/chunk_state) 個chunk (group) 依序切成F段，
+第 t%F 條thread做第 t%F 段，所有thread都有事做。結束後 s->fd_off 跟沒切開時一樣。
+===================================================================*/
+static void thread_part(setStreamv2 *s, int width){
+    int nfd = inner_loop_width();
+    int F = thread_split;
+    int j = omp_get_thread_num() % F;
+    ull size = (width == 1) ? _outer : _half_outer;
+    ull cpc = (size + chunk_state - 1) / chunk_state;  // 每次inner_loop的chunk數
+    ull iters = (loop_size + _outer - 1) / _outer;
+    ull iter_adv = cpc * chunk_size + ((width > 1) ? _half_outer_size : 0);
+    ull u0 = iters * cpc * j / F;
+    ull u1 = iters * cpc * (j+1) / F;
+    ull off[8];
+
+    for (ull u = u0; u < u1; ){
+        ull i = u / cpc;
+        ull c = u % cpc;
+        ull n = cpc - c;
+        if(n > u1 - u)
+            n = u1 - u;
+        for (int k = 0; k < nfd; k++)
+            off[k] = s->fd_off[k] + i*((k < width) ? iter_adv : cpc*chunk_size) + c*chunk_size;
+        inner_loop_func(n * chunk_state, s->rd, s->fd, off);
+        u += n;
+    }
+    thread_advance(s, width);
+}
+
 inline void _thread_CX(setStreamv2 *s){
+    if(plan_rec){
+        plan_record(s, 1);
+        return;
+    }
+    if(thread_split > 1){
+        thread_part(s, 1);
+        return;
+    }
     for(ull i = 0; i < loop_size; i += _outer){
         inner_loop_func(_outer, s->rd, s->fd, s->fd_off);
     }
 }
 
 inline void _thread_CX2(setStreamv2 *s){
+    if(plan_rec){
+        plan_record(s, 2);
+        return;
+    }
+    if(thread_split > 1){
+        thread_part(s, 2);
+        return;
+    }
     for(ull i = 0; i < loop_size; i += _outer){
         inner_loop_func(_half_outer, s->rd, s->fd, s->fd_off);
         s->fd_off[0] += _half_outer_size;
@@ -27,6 +106,14 @@ inline void _thread_CX2(setStreamv2 *s){
 }
 
 inline void _thread_CX4(setStreamv2 *s){
+    if(plan_rec){
+        plan_record(s, 4);
+        return;
+    }
+    if(thread_split > 1){
+        thread_part(s, 4);
+        return;
+    }
     for(ull i = 0; i < loop_size; i += _outer){
         inner_loop_func(_half_outer, s->rd, s->fd, s->fd_off);
         s->fd_off[0] += _half_outer_size;
@@ -37,6 +124,14 @@ inline void _thread_CX4(setStreamv2 *s){
 }
 
 inline void _thread_CX8(setStreamv2 *s){
+    if(plan_rec){
+        plan_record(s, 8);
+        return;
+    }
+    if(thread_split > 1){
+        thread_part(s, 8);
+        return;
+    }
     for(ull i = 0; i < loop_size; i += _outer){
         inner_loop_func(_half_outer, s->rd, s->fd, s->fd_off);
         s->fd_off[0] += _half_outer_size;
@@ -68,6 +163,10 @@ inline void set_up_lo(int ctrl, int targ){
 
 // fd_off[0] += size * sizeof(Type) afterward
 void inner_loop(ull size, void *rd, int fd[1], ull fd_off[1]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 1, fd, fd_off, IO_RD|IO_WR);
+        return;
+    }
     for (ull i = 0; i < size; i += chunk_state){
         if(pread (fd[0], rd, chunk_size, fd_off[0]));
         gate_func((Type *)rd);
@@ -77,6 +176,10 @@ void inner_loop(ull size, void *rd, int fd[1], ull fd_off[1]){
 }
 
 void inner_loop_read(ull size, void *rd, int fd[1], ull fd_off[1]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 1, fd, fd_off, IO_RD);
+        return;
+    }
     for (ull i = 0; i < size; i += chunk_state){
         if(pread (fd[0], rd, chunk_size, fd_off[0]));
         gate_func((Type *)rd);
@@ -87,6 +190,10 @@ void inner_loop_read(ull size, void *rd, int fd[1], ull fd_off[1]){
 // fd_off[0] += size * sizeof(Type) afterward
 // fd_off[1] += size * sizeof(Type) afterward
 void inner_loop2(ull size, void *rd, int fd[2], ull fd_off[2]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 2, fd, fd_off, IO_RD|IO_WR);
+        return;
+    }
     for (ull i = 0; i < size; i += chunk_state){
         if(pread (fd[0], rd,           chunk_size, fd_off[0]));
         if(pread (fd[1], rd+chunk_size, chunk_size, fd_off[1]));
@@ -101,6 +208,10 @@ void inner_loop2(ull size, void *rd, int fd[2], ull fd_off[2]){
 }
 
 void inner_loop2_read(ull size, void *rd, int fd[2], ull fd_off[2]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 2, fd, fd_off, IO_RD);
+        return;
+    }
     for (ull i = 0; i < size; i += chunk_state){
         if(pread (fd[0], rd,           chunk_size, fd_off[0]));
         if(pread (fd[1], rd+chunk_size, chunk_size, fd_off[1]));
@@ -111,6 +222,10 @@ void inner_loop2_read(ull size, void *rd, int fd[2], ull fd_off[2]){
 }
 
 void inner_loop2_swap(ull size, void *rd, int fd[2], ull fd_off[2]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 2, fd, fd_off, IO_SWAP|IO_WR);
+        return;
+    }
     for (ull i = 0; i < size; i += chunk_state){
         if(pread (fd[0], rd + chunk_size, chunk_size, fd_off[0]));
         if(pread (fd[1], rd,             chunk_size, fd_off[1]));
@@ -123,6 +238,10 @@ void inner_loop2_swap(ull size, void *rd, int fd[2], ull fd_off[2]){
 }
 
 void inner_loop4(ull size, void *rd, int fd[4], ull fd_off[4]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 4, fd, fd_off, IO_RD|IO_WR);
+        return;
+    }
     for (ull i = 0; i < size; i += chunk_state){
         if(pread (fd[0], rd,               chunk_size, fd_off[0]));
         if(pread (fd[1], rd +   chunk_size, chunk_size, fd_off[1]));
@@ -143,6 +262,10 @@ void inner_loop4(ull size, void *rd, int fd[4], ull fd_off[4]){
 }
 
 void inner_loop8(ull size, void *rd, int fd[8], ull fd_off[8]){
+    if(IoEngine || zchunk){
+        io_pipeline(size, rd, 8, fd, fd_off, IO_RD|IO_WR);
+        return;
+    }
     void *rd0 = rd;
     void *rd1 = rd + 1*chunk_size;
     void *rd2 = rd + 2*chunk_size;
@@ -24,19 +24,43 @@ typedef struct {
     int half_ctrl;  // "buffer內" 要找到 ctrl 這個bit反轉之後另一個state 的距離
     int half_targ;  // "buffer內" 要找到 targ 這個bit反轉之後另一個state 的距離
 } gate_args;
-extern gate_args gate_move;
 
-// global variable
-extern Type_t *real;
-extern Type_t *imag;
+/* gate context guide
+    kernel及 _thread_CX* 讀的設定 (gate_func, gate_move, gate_size, loop_size, _outer...)
+    放在 gate_ctx 裡，透過每條thread自己的 cur_ctx 存取。
+    cur_ctx 預設指向共用的 shared_ctx，原本 thread 0 設定、barrier 之後大家讀的寫法不變；
+    execution plan (plan.h) 讓每條thread指向預先算好的context，各自往下走不用等其他thread。
+    real, imag 同樣是每條thread各自一份 (threadprivate)。
+*/
+typedef struct gate_ctx {
+    void (*func)(Type *);
+    void (*loop_func)(unsigned long long, void*, int*, unsigned long long*);
+    unsigned long long loop;
+    unsigned long long outer;
+    unsigned long long half_outer;
+    unsigned long long half_outer_size;
+    int size;
+    int split;  // 每個 _thread_CX* 的工作分給幾條thread (thread split guide, gate_util.c)
+    gate_args move;
+} gate_ctx;
+extern gate_ctx shared_ctx;
+extern gate_ctx *cur_ctx;
+#pragma omp threadprivate(cur_ctx)
 
-extern int gate_size;
-extern void (*gate_func)(Type *);
-extern void (*inner_loop_func)(unsigned long long, void*, int*, unsigned long long*);
-extern unsigned long long loop_size;
-extern unsigned long long _outer;
-extern unsigned long long _half_outer;
-extern unsigned long long _half_outer_size;
+#define gate_func       (cur_ctx->func)
+#define inner_loop_func (cur_ctx->loop_func)
+#define loop_size       (cur_ctx->loop)
+#define _outer          (cur_ctx->outer)
+#define _half_outer     (cur_ctx->half_outer)
+#define _half_outer_size (cur_ctx->half_outer_size)
+#define gate_size       (cur_ctx->size)
+#define gate_move       (cur_ctx->move)
+#define thread_split    (cur_ctx->split)
+
+// global variable
+extern Acc_t *real;
+extern Acc_t *imag;
+#pragma omp threadprivate(real, imag)
 
 extern int up_qubit;
 extern int lo_qubit;
@@ -61,6 +85,8 @@ void _thread_CX2(setStreamv2 *s);
 void _thread_CX4(setStreamv2 *s);
 void _thread_CX8(setStreamv2 *s);
 void set_up_lo(int ctrl, int targ);
+int inner_loop_width();
+void thread_advance(setStreamv2 *s, int width);
 
 void inner_loop(ull size, void *rd, int fd[1], ull fd_off[1]);
 void inner_loop_read(ull size, void *rd, int fd[1], ull fd_off[1]);
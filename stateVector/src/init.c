@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -6,21 +7,39 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
 
 #include "ini.h"
 #include "init.h"
 #include "common.h"
 #include "gate.h"
+#include "io_engine.h"
+#include "remap.h"
+#include "gate_simd.h"
+#include "scheduler_refine.h"
+#include "plan.h"
+#include "circuit_bin.h"
+#include "checkpoint.h"
+#include "zchunk.h"
+#include "density.h"
+#include "expect.h"
 
 inline void set_buffer() {
-    q_read = (Type*) malloc(buffer_size);
+    // O_DIRECT需要buffer address對齊block，每條thread的buffer是chunk_size的倍數所以也會對齊
+    if(posix_memalign((void **)&q_read, DIRECT_ALIGN, buffer_size)){
+        printf("[MEM]: cannot allocate %llu bytes buffer\n", buffer_size);
+        exit(1);
+    }
     memset((void *) (q_read),  0.0, buffer_size);
     thread_settings = (setStreamv2*)malloc(num_thread*sizeof(setStreamv2));
     for (int i = 0; i < num_thread; i++){
-        thread_settings[i].rd = (void*)q_read + i * 8*chunk_size;
+        thread_settings[i].rd = (void*)q_read + i * 8*chunk_size*IoDepth;
     }
     fd_pair = (int*)malloc(num_file * sizeof(int));
     td_pair = (int*)malloc(num_thread_per_file * sizeof(int));
@@ -40,6 +59,34 @@ inline void set_ini(char *path) {
     IsDensity =  read_profile_int(section, "is_density", 0, path);
     SkipInithread_state = read_profile_int(section, "skip_init_state", 0, path);
     SetOfSaveState = read_profile_int(section, "set_of_save_state", 1, path);
+    IoEngine = read_profile_int(section, "io_engine", IO_SYNC, path);
+    // memory engine不需要pipeline，每條thread的buffer只放一組chunk
+    int pipelined = IoEngine && IoEngine != IO_MEM;
+    IoDepth = pipelined ? read_profile_int(section, "io_depth", 4, path) : 1;
+    if(IoDepth < 2 && pipelined) IoDepth = 2;
+    MemDump = read_profile_int(section, "mem_dump", 1, path);
+    DirectIo = IoEngine == IO_MEM ? 0 : read_profile_int(section, "direct_io", 0, path);
+    IoAdvice = read_profile_int(section, "io_advice", IO_ADVICE_NONE, path);
+    MultiGate = read_profile_int(section, "multi_gate", 0, path);
+    Remap = read_profile_int(section, "remap", 0, path);
+    DiagFusion = read_profile_int(section, "diag_fusion", 0, path);
+    Sampling = read_profile_int(section, "sampling", 1, path);
+    Fusion = read_profile_int(section, "fusion", 0, path);
+    FusionMaxQubit = read_profile_int(section, "fusion_max_qubit", 3, path);
+    ExecPlan = read_profile_int(section, "exec_plan", 1, path);
+    ZeroChunk = read_profile_int(section, "zero_chunk", 0, path);
+    Checkpoint = read_profile_int(section, "checkpoint", 0, path);
+    CheckpointInterval = read_profile_int(section, "checkpoint_interval", 0, path);
+    CheckpointMtbf = read_profile_int(section, "checkpoint_mtbf", 3600, path);
+    Resume = read_profile_int(section, "resume", 0, path);
+    CheckpointPath = (char *) malloc(max_path*sizeof(char));
+    read_profile_string(section, "checkpoint_path", CheckpointPath, max_path, "./checkpoint", path);
+    Observable = (char *) malloc(max_path*sizeof(char));
+    read_profile_string(section, "observable", Observable, max_path, "", path);
+    RemapWindow = read_profile_int(section, "remap_window", 64, path);
+    Simd = read_profile_int(section, "simd", 1, path);
+    SimdCheck = read_profile_int(section, "simd_check", 0, path);
+    StateFormat = read_profile_int(section, "state_format", 0, path);
     num_file = (1ULL << file_segment);
     num_thread = (1ULL << thread_segment);
     half_num_thread = (1ULL << (thread_segment-1));
@@ -52,7 +99,7 @@ inline void set_ini(char *path) {
     file_size = file_state * sizeof(Type);
     thread_size = thread_state * sizeof(Type);
     chunk_size = chunk_state*sizeof(Type);
-    buffer_size = (num_thread*8*chunk_size);
+    buffer_size = (num_thread*8*chunk_size*IoDepth);
 
     printf("is density: %d\n", IsDensity);
     char *state_form_ini = (char *) malloc(SetOfSaveState*num_file*max_path*sizeof(char));
@@ -72,6 +119,23 @@ inline void set_ini(char *path) {
 	    token = strtok(NULL, ",");
         cnt++;
     }
+
+    // io_engine=4: 每個device一個stripe file
+    if(IoEngine == IO_STRIPE){
+        char *stripe_ini = (char *) malloc(STRIPE_MAX_DEV*max_path*sizeof(char));
+        read_profile_string(section, "stripe_paths", stripe_ini, STRIPE_MAX_DEV*max_path, "", path);
+        stripe_paths = (char **) malloc(STRIPE_MAX_DEV*sizeof(char*));
+        num_stripe = 0;
+        for(char *tok = strtok(stripe_ini, ","); tok != NULL && num_stripe < STRIPE_MAX_DEV; tok = strtok(NULL, ","))
+            stripe_paths[num_stripe++] = strdup(tok);
+        free(stripe_ini);
+        if(!num_stripe){
+            printf("[IO]: io_engine=%d needs stripe_paths\n", IO_STRIPE);
+            exit(1);
+        }
+        StripeWorkers = read_profile_int(section, "stripe_workers", 1, path);
+        if(StripeWorkers < 1) StripeWorkers = 1;
+    }
     // assert for invalid case
     //assert (N <= MAX_QUBIT);
     assert (N >= (thread_segment + chunk_segment));
@@ -82,6 +146,10 @@ inline void set_ini(char *path) {
 }
 
 inline void set_circuit(char *path) {
+    // binary circuit (circuit_bin.h): mmap，沒有max_depth限制
+    if(load_circuit_bin(path))
+        return;
+
     FILE *circuit;
     if((circuit = fopen(path, "r"))== NULL) {
         printf("no circuit file.\n");
@@ -102,8 +170,8 @@ void rotate_axis_4x4(gate *g, int q0, int q1){
     printf("rotating...\n");
     g->targs[0] = q1;
     g->targs[1] = q0;
-    Type_t *tmp_r = (Type_t *)malloc(16 * sizeof(Type_t));
-    Type_t *tmp_i = (Type_t *)malloc(16 * sizeof(Type_t));
+    Acc_t *tmp_r = (Acc_t *)malloc(16 * sizeof(Acc_t));
+    Acc_t *tmp_i = (Acc_t *)malloc(16 * sizeof(Acc_t));
     int b[4];
     for(int i = 0; i < 16; i++){
         b[3] = i&1;
@@ -132,8 +200,8 @@ void rotate_axis_8x8(gate *g, int q0, int q1, int q2){
     if(q0 < q1 && q1 < q2) return;
     printf("rotating...\n");
 
-    Type_t *tmp_r = (Type_t *)malloc(64 * sizeof(Type_t));
-    Type_t *tmp_i = (Type_t *)malloc(64 * sizeof(Type_t));
+    Acc_t *tmp_r = (Acc_t *)malloc(64 * sizeof(Acc_t));
+    Acc_t *tmp_i = (Acc_t *)malloc(64 * sizeof(Acc_t));
     int order[3];
     if(q0 < q2 && q2 < q1){
         order[0] = 0; order[1] = 2; order[2] = 1;
@@ -178,6 +246,47 @@ void rotate_axis_8x8(gate *g, int q0, int q1, int q2){
     }
 }
 
+// 讀進來的gate: control/target數量是否合法
+void check_gate(int i, gate *g){
+    if(g->numCtrls > 3 || g->numTargs > 3){
+        printf("gate %d (op %d): at most 3 controls and 3 targets\n", i, g->gate_ops);
+        exit(1);
+    }
+    if(g->gate_ops >= 14 && g->gate_ops <= 17 && (g->numCtrls < 1 || g->numTargs != 1)){
+        printf("gate %d (op %d): multi-controlled gate needs 1-3 controls and 1 target\n", i, g->gate_ops);
+        exit(1);
+    }
+    if(g->gate_ops == DENSITY_CHANNEL && (!IsDensity || g->numCtrls != 0 || g->numTargs != 1 || g->val_num < 4 || g->val_num % 4)){
+        printf("gate %d (op %d): Kraus channel needs is_density=1, 1 target and 4k values\n", i, g->gate_ops);
+        exit(1);
+    }
+    if(g->gate_ops == 26 && (IsDensity || g->numCtrls != 1 || g->numTargs != 0)){
+        printf("gate %d (op %d): expectation value needs 1 control (src_set), no target and is_density=0\n", i, g->gate_ops);
+        exit(1);
+    }
+    if(g->gate_ops == DENSITY_SUPEROP){
+        printf("gate %d (op %d): internal op, not allowed in circuit\n", i, g->gate_ops);
+        exit(1);
+    }
+}
+
+// SWAP的target由小到大，U2, U3的matrix轉成target由小到大的順序
+void normalize_gate(gate *g){
+    if(g->gate_ops == 13 && g->targs[0] > g->targs[1]){ //SWAP
+        int tmp = g->targs[0];
+        g->targs[0] = g->targs[1];
+        g->targs[1] = tmp;
+    }
+
+    if(g->gate_ops == 31){ //Unitary 2 qubit Gate
+        rotate_axis_4x4(g, g->targs[0], g->targs[1]);
+    }
+
+    if(g->gate_ops == 32){ //Unitary 3 qubit Gate
+        rotate_axis_8x8(g, g->targs[0], g->targs[1], g->targs[2]);
+    }
+}
+
 inline void set_gates(FILE *circuit) {
     gateMap = (gate*) malloc(total_gate*sizeof(gate));
     for (int i = 0; i < total_gate; i++)
@@ -186,31 +295,21 @@ inline void set_gates(FILE *circuit) {
         gate g;
         if(fscanf(circuit, "%d%d%d%d",
             &g.gate_ops, &g.numCtrls, &g.numTargs, &g.val_num));
+        check_gate(i, &g);
         for (int j = 0; j < g.numCtrls; j++)
             if(fscanf(circuit, "%d", &g.ctrls[j]));
         for (int j = 0; j < g.numTargs; j++)
             if(fscanf(circuit, "%d", &g.targs[j]));
 
-        g.real_matrix = (Type_t*) malloc(g.val_num*sizeof(Type_t));
-        g.imag_matrix = (Type_t*) malloc(g.val_num*sizeof(Type_t));
+        g.real_matrix = (Acc_t*) malloc(g.val_num*sizeof(Acc_t));
+        g.imag_matrix = (Acc_t*) malloc(g.val_num*sizeof(Acc_t));
+        double v; // Acc_t 可能是float，先讀成double
         for (int j = 0; j < g.val_num; j++)
-            if(fscanf(circuit, "%lf", &g.real_matrix[j]));
+            if(fscanf(circuit, "%lf", &v)) g.real_matrix[j] = v;
         for (int j = 0; j < g.val_num; j++)
-            if(fscanf(circuit, "%lf", &g.imag_matrix[j]));
-
-        if(g.gate_ops == 13 && g.targs[0] > g.targs[1]){ //SWAP
-            int tmp = g.targs[0];
-            g.targs[0] = g.targs[1];
-            g.targs[1] = tmp;
-        }
+            if(fscanf(circuit, "%lf", &v)) g.imag_matrix[j] = v;
 
-        if(g.gate_ops == 31){ //Unitary 2 qubit Gate
-            rotate_axis_4x4(&g, g.targs[0], g.targs[1]);
-        }
-
-        if(g.gate_ops == 32){ //Unitary 3 qubit Gate
-            rotate_axis_8x8(&g, g.targs[0], g.targs[1], g.targs[2]);
-        }
+        normalize_gate(&g);
 
         g.action = 1;
         gateMap[i] = g; // add the gate to the gatMpa
@@ -239,27 +338,108 @@ inline void set_gates(FILE *circuit) {
 //     }
 // }
 
+/*
+state file所在device的logical block size (O_DIRECT的I/O大小及offset要是它的倍數)
+block device直接問BLKSSZGET，一般file從 /sys/dev/block/<major>:<minor> 找，
+partition要再往上一層找queue；都找不到時當成DIRECT_ALIGN。
+*/
+static int logical_block_size(int fd){
+    struct stat st;
+    int lbs = 0;
+    if(fstat(fd, &st))
+        return DIRECT_ALIGN;
+    if(S_ISBLK(st.st_mode) && !ioctl(fd, BLKSSZGET, &lbs) && lbs > 0)
+        return lbs;
+    const char *fmt[2] = {"/sys/dev/block/%u:%u/queue/logical_block_size",
+                          "/sys/dev/block/%u:%u/../queue/logical_block_size"};
+    char path[128];
+    for(int i = 0; i < 2; i++){
+        snprintf(path, sizeof(path), fmt[i], major(st.st_dev), minor(st.st_dev));
+        FILE *f = fopen(path, "r");
+        if(!f)
+            continue;
+        int ok = fscanf(f, "%d", &lbs) == 1 && lbs > 0;
+        fclose(f);
+        if(ok)
+            return lbs;
+    }
+    return DIRECT_ALIGN;
+}
+
+// 開state file，依 direct_io / io_advice 設定
+static int open_state_file(char *path, int flags){
+    if(DirectIo)
+        flags |= O_DIRECT;
+    int fd = open(path, flags, 0777);
+    if(fd < 0){
+        printf("[FILE]: cannot open %s%s\n", path,
+            DirectIo && errno == EINVAL ? " with O_DIRECT (not supported by the filesystem)" : "");
+        exit(-1);
+    }
+    if(DirectIo){
+        int lbs = logical_block_size(fd);
+        if(chunk_size % lbs || DIRECT_ALIGN % lbs){
+            printf("[FILE]: %s: chunk size %llu is not a multiple of the logical block size %d, "
+                   "increase local_qbit for direct_io\n", path, chunk_size, lbs);
+            exit(-1);
+        }
+        return fd;
+    }
+    int advice[4] = {POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED};
+    if(IoAdvice > IO_ADVICE_NONE && IoAdvice <= IO_ADVICE_WILLNEED)
+        posix_fadvise(fd, 0, 0, advice[IoAdvice]);
+    return fd;
+}
+
 void set_state_files() {
     // fd_arr malloc
     fd_arr_set = (int**) malloc(SetOfSaveState*sizeof(int*));
-    for (int i = 0; i <= SetOfSaveState; i++){
+    for (int i = 0; i < SetOfSaveState; i++){
         fd_arr_set[i] = (int*) malloc(num_file*sizeof(int));
     }
 
     fd_arr = fd_arr_set[0];
 
+    if(IoEngine == IO_MEM){
+        io_mem_init_state();
+        return;
+    }
+
+    // stripe: state_paths只在skip_init_state/mem_dump時用到，state放在每個device的stripe file
+    if(IoEngine == IO_STRIPE){
+        ull num_chunk = SetOfSaveState*num_file*(file_size/chunk_size);
+        ull dev_size = (num_chunk + num_stripe - 1) / num_stripe * chunk_size;
+        char *stripe_dir = (char *) malloc(max_path*sizeof(char));
+        stripe_fd = (int *) malloc(num_stripe*sizeof(int));
+        for(int d = 0; d < num_stripe; d++){
+            strcpy(stripe_dir, stripe_paths[d]);
+            mk_dir(dirname(stripe_dir));
+            stripe_fd[d] = open_state_file(stripe_paths[d], O_RDWR|O_CREAT);
+            // zero_chunk: 不寫入全0的chunk，舊的內容要先清掉
+            if((zchunk && ftruncate(stripe_fd[d], 0)) || ftruncate(stripe_fd[d], dev_size)){
+                printf("[FILE]: cannot resize %s to %llu bytes\n", stripe_paths[d], dev_size);
+                exit(-1);
+            }
+            printf("[FILE]: stripe %s, %llu MB, fd: %2d \n", stripe_paths[d], dev_size >> 20, stripe_fd[d]);
+        }
+        free(stripe_dir);
+        io_stripe_init_state();
+        fflush(stdout);
+        return;
+    }
+
     // create the dir of the output path and touch them
-    if(SkipInithread_state){
+    if(SkipInithread_state && !ckpt_restore){
         for(int i = 0; i < SetOfSaveState*num_file; i++) {
             if (!file_exists(state_paths[i])){
                 printf("[FILE]: %s skip init but not exists.\n", state_paths[i]);
                 exit(-1);
             }
-            fd_arr_set[i/num_file][i%num_file] = open(state_paths[i], O_RDWR);
-            assert(fd_arr_set[i/num_file][i%num_file] > 0);
+            fd_arr_set[i/num_file][i%num_file] = open_state_file(state_paths[i], O_RDWR);
             printf("[FILE]: previous state %s open success!, fd: %2d \n", state_paths[i], fd_arr_set[i/num_file][i%num_file]);
             lseek(fd_arr_set[i/num_file][i%num_file], 0, SEEK_SET);
         }
+        zchunk_bind();
         return;
     }
 
@@ -270,13 +450,31 @@ void set_state_files() {
         if (md != -1) {
             if (file_exists(state_paths[i]))
                 remove(state_paths[i]);
-            fd_arr_set[i/num_file][i%num_file] = open(state_paths[i], O_RDWR|O_CREAT, 0777);
-            assert(fd_arr_set[i/num_file][i%num_file] > 0);
+            fd_arr_set[i/num_file][i%num_file] = open_state_file(state_paths[i], O_RDWR|O_CREAT);
             printf("[FILE]: %s create success!, fd: %2d \n", state_paths[i], fd_arr_set[i/num_file][i%num_file]);
             lseek(fd_arr_set[i/num_file][i%num_file], 0, SEEK_SET);
         }
     }
     free(state_dir);
+    zchunk_bind();
+
+    // zero_chunk: state file建成sparse file (全是0)，只寫入 |0...0> 所在的chunk
+    if(zchunk){
+        for(int i = 0; i < SetOfSaveState*num_file; i++)
+            if(ftruncate(fd_arr_set[i/num_file][i%num_file], file_size));
+        if(!ckpt_restore){
+            q_read[0].real = 1.;
+            for(int set = 0; set < SetOfSaveState; set++)
+                io_pwrite(fd_arr_set[set][0], q_read, chunk_size, 0);
+            q_read[0].real = 0.;
+        }
+        fflush(stdout);
+        return;
+    }
+
+    // resume: checkpoint_restore() 會寫入整個state
+    if(ckpt_restore)
+        return;
 
     // init files: reset all strings in file as 0
     // use "od -tfD [file_name] to verify"
@@ -291,25 +489,66 @@ void set_state_files() {
             void *wr = thread_settings[t].rd;
             ull fd_off = td * thread_size;
             for (ull sz = 0; sz < thread_state; sz += chunk_state) {
-                pwrite(fd, wr, chunk_size, fd_off);
+                if(pwrite(fd, wr, chunk_size, fd_off));
                 fd_off += chunk_size;
             }
 
+            // |0...0>: 第0個state的real在file開頭，interleaved及SoA格式都一樣
+            // 寫整個chunk (O_DIRECT不能只寫一個state)，寫完還原成0給下一組用
             if (t == 0) {
                 q_read[0].real = 1.;
                 q_read[0].imag = 0.;
-                pwrite(fd, q_read, sizeof(Type), 0);
+                if(pwrite(fd, q_read, chunk_size, 0));
+                q_read[0].real = 0.;
             }
         }
     }
     fflush(stdout);
 }
 
+// memory/stripe engine: 模擬結束後把state寫回state_paths，格式與file模式相同
+void save_state_files() {
+    if((IoEngine != IO_MEM && IoEngine != IO_STRIPE) || !MemDump)
+        return;
+    // stripe: 一次讀一整個thread buffer (所有device同時讀)
+    void *buf = thread_settings[0].rd;
+    ull batch = 8*IoDepth*chunk_size < file_size ? 8*IoDepth*chunk_size : file_size;
+    char *state_dir = (char *) malloc(max_path*sizeof(char));
+    for(int i = 0; i < SetOfSaveState*num_file; i++) {
+        strcpy(state_dir, state_paths[i]);
+        mk_dir(dirname(state_dir));
+        int fd = open(state_paths[i], O_RDWR|O_CREAT|O_TRUNC, 0777);
+        assert(fd > 0);
+        if(IoEngine == IO_STRIPE){
+            for (ull off = 0; off < file_size; off += batch){
+                ull len = file_size - off < batch ? file_size - off : batch;
+                io_pread(i, buf, len, off);
+                if(pwrite(fd, buf, len, off));
+            }
+        }
+        else
+            for (ull off = 0; off < file_size; off += chunk_size)
+                if(pwrite(fd, io_mem_ptr(i, off), chunk_size, off));
+        close(fd);
+    }
+    free(state_dir);
+}
+
 void set_all(char *ini, char *cir) {
     set_ini(ini);
+    gate_simd_init();
     set_circuit(cir);
+    circuit_scheduler();
+    remap_circuit();
+    density_lower();
+    expect_init();
     set_buffer();
+    io_engine_init();
+    checkpoint_init();
+    zchunk_init();
     set_state_files();
+    checkpoint_restore();
+    plan_build();
 }
 
 inline int read_args(int argc, char* argv[], char **ini, char **cir) {
@@ -335,7 +574,7 @@ inline int read_args(int argc, char* argv[], char **ini, char **cir) {
             /* Single arg */
             case 'c':
                 destination_size = strlen(optarg);
-                *cir = (char *) malloc(sizeof(char) * destination_size);
+                *cir = (char *) malloc(sizeof(char) * (destination_size+1));
                 strncpy(*cir, optarg, destination_size);
                 (*cir)[destination_size] = '\0';
                 ++ret_val;
@@ -343,7 +582,7 @@ inline int read_args(int argc, char* argv[], char **ini, char **cir) {
             case 'i':
                 // fprintf(stderr, "option arg:%s\n", optarg);
                 destination_size = strlen(optarg);
-                *ini = (char *) malloc(sizeof(char) * destination_size);
+                *ini = (char *) malloc(sizeof(char) * (destination_size+1));
                 strncpy(*ini, optarg, destination_size);
                 (*ini)[destination_size] = '\0';
                 ++ret_val;
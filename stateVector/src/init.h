@@ -1,6 +1,8 @@
 #ifndef INIT_H_
 #define INIT_H_
 #include <stdio.h>
+#include "common.h"
+#include "gate.h"
 
 extern unsigned long long thread_state;
 extern int *fd_pair;
@@ -9,8 +11,13 @@ void set_buffer();
 void set_ini(char *path);
 void set_circuit (char *path);
 void set_gates(FILE *circuit);
+void check_gate(int i, gate *g);
+void normalize_gate(gate *g);
+void rotate_axis_4x4(gate *g, int q0, int q1);
+void rotate_axis_8x8(gate *g, int q0, int q1, int q2);
 void set_qubitTimes();
 void set_state_files();
+void save_state_files();
 void set_all(char *ini, char *cir);
 int read_args(int argc, char *argv[], char **ini, char **cir);
 
@@ -0,0 +1,740 @@
+#define _GNU_SOURCE // fallocate
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <aio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <omp.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_util.h"
+#include "io_engine.h"
+#include "checkpoint.h"
+#include "zchunk.h"
+
+/*===================================================================
+per-thread context
+每條thread各自有一組ring/aiocb，thread之間不共用queue。
+pending[slot]: 該slot還沒完成的request數量
+===================================================================*/
+typedef struct io_ctx {
+    int *pending;
+    char *skip;         // zero_chunk: 這個slot的chunk group全是0，不用算也不用寫
+
+    // stripe: worker完成request時通知
+    pthread_mutex_t mu;
+    pthread_cond_t done;
+
+    // POSIX AIO
+    struct aiocb *cbs;  // cbs[slot*8 + k]
+
+    // io_uring
+    int ring_fd;
+    unsigned to_submit;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} io_ctx;
+
+static io_ctx *io_ctxs;
+
+static void io_fail(const char *op, long ret){
+    printf("[IO]: %s failed (%ld)\n", op, ret);
+    exit(1);
+}
+
+/*===================================================================
+io_uring backend
+===================================================================*/
+static int uring_setup(io_ctx *c, unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        return -1;
+
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single){
+        if (cq_sz > sq_sz) sq_sz = cq_sz;
+        cq_sz = sq_sz;
+    }
+
+    void *sq_ptr = mmap(0, sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+    void *cq_ptr = sq_ptr;
+    if (!single){
+        cq_ptr = mmap(0, cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED){
+            close(fd);
+            return -1;
+        }
+    }
+    void *sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+
+    c->ring_fd = fd;
+    c->to_submit = 0;
+    c->sq_entries = p.sq_entries;
+    c->sq_head  = sq_ptr + p.sq_off.head;
+    c->sq_tail  = sq_ptr + p.sq_off.tail;
+    c->sq_mask  = sq_ptr + p.sq_off.ring_mask;
+    c->sq_array = sq_ptr + p.sq_off.array;
+    c->sqes = sqes;
+    c->cq_head = cq_ptr + p.cq_off.head;
+    c->cq_tail = cq_ptr + p.cq_off.tail;
+    c->cq_mask = cq_ptr + p.cq_off.ring_mask;
+    c->cqes = cq_ptr + p.cq_off.cqes;
+    return 0;
+}
+
+static void uring_enter(io_ctx *c, unsigned min_complete){
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    while (c->to_submit || min_complete){
+        int ret = syscall(__NR_io_uring_enter, c->ring_fd, c->to_submit, min_complete, flags, NULL, 0);
+        if (ret < 0){
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            io_fail("io_uring_enter", -errno);
+        }
+        c->to_submit -= ret;
+        if (!c->to_submit)
+            break;
+    }
+}
+
+static void uring_submit(io_ctx *c, int op, int fd, void *buf, ull off, int slot){
+    unsigned tail = *c->sq_tail;
+    if (tail - __atomic_load_n(c->sq_head, __ATOMIC_ACQUIRE) == c->sq_entries)
+        uring_enter(c, 0);
+    unsigned idx = tail & *c->sq_mask;
+    struct io_uring_sqe *sqe = &c->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)buf;
+    sqe->len = chunk_size;
+    sqe->off = off;
+    sqe->user_data = slot;
+    c->sq_array[idx] = idx;
+    __atomic_store_n(c->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    c->to_submit++;
+    c->pending[slot]++;
+}
+
+static void uring_reap(io_ctx *c){
+    unsigned head = *c->cq_head;
+    while (head != __atomic_load_n(c->cq_tail, __ATOMIC_ACQUIRE)){
+        struct io_uring_cqe *cqe = &c->cqes[head & *c->cq_mask];
+        if (cqe->res != (int)chunk_size)
+            io_fail("io_uring request", cqe->res);
+        c->pending[cqe->user_data]--;
+        head++;
+    }
+    __atomic_store_n(c->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_wait(io_ctx *c, int slot){
+    uring_reap(c);
+    while (c->pending[slot]){
+        uring_enter(c, 1);
+        uring_reap(c);
+    }
+}
+
+/*===================================================================
+POSIX AIO backend
+===================================================================*/
+static void aio_submit(io_ctx *c, int op, int fd, void *buf, ull off, int slot, int k){
+    struct aiocb *cb = &c->cbs[slot*8 + k];
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_fildes = fd;
+    cb->aio_buf = buf;
+    cb->aio_nbytes = chunk_size;
+    cb->aio_offset = off;
+    int ret = (op == IORING_OP_READ) ? aio_read(cb) : aio_write(cb);
+    if (ret)
+        io_fail(op == IORING_OP_READ ? "aio_read" : "aio_write", -errno);
+    c->pending[slot]++;
+}
+
+static void aio_wait(io_ctx *c, int slot){
+    for (int k = 0; c->pending[slot]; k++){
+        struct aiocb *cb = &c->cbs[slot*8 + k];
+        const struct aiocb *list[1] = {cb};
+        while (aio_error(cb) == EINPROGRESS)
+            aio_suspend(list, 1, NULL);
+        if (aio_return(cb) != (ssize_t)chunk_size)
+            io_fail("aio request", aio_error(cb));
+        c->pending[slot]--;
+    }
+}
+
+/*===================================================================
+stripe backend (io_engine=4)
+
+"fd" 跟memory backend一樣是 set*num_file + f，整個state依 (fd, offset) 排成一串chunk，
+第c個chunk放在 stripe_paths[c % num_stripe] 的 (c / num_stripe) * chunk_size。
+所以不論gate動到哪個file，連續的chunk都會平均分到每個device，頻寬跟global_qbit無關。
+
+每個device有自己的queue及 stripe_workers 條I/O worker (pthread)，
+compute thread只把request放進對應device的queue，worker做完pread/pwrite後把pending[slot]減一，
+io_pipeline照原本的方式提前送出後面chunk group的read，等到要算的時候才wait。
+io_pread/io_pwrite也拆成chunk送給worker (用第IoDepth個slot)，size及offset要是chunk的倍數。
+===================================================================*/
+#define STRIPE_QUEUE 256
+
+typedef struct stripe_req {
+    int op;
+    void *buf;
+    ull off;        // device file內的offset
+    io_ctx *c;
+    int slot;
+} stripe_req;
+
+typedef struct stripe_dev {
+    int id;
+    pthread_mutex_t mu;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    unsigned head, tail;
+    stripe_req q[STRIPE_QUEUE];
+} stripe_dev;
+
+static stripe_dev *stripe_devs;
+
+// (fd, off) -> device，*dev_off: device file內的offset
+static inline int stripe_map(int fd, ull off, ull *dev_off){
+    ull c = ((ull)fd * file_size + off) / chunk_size;
+    *dev_off = c / num_stripe * chunk_size;
+    return c % num_stripe;
+}
+
+static void stripe_submit(io_ctx *c, int op, int fd, void *buf, ull off, int slot){
+    ull dev_off;
+    stripe_dev *d = &stripe_devs[stripe_map(fd, off, &dev_off)];
+    __atomic_add_fetch(&c->pending[slot], 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&d->mu);
+    while (d->tail - d->head == STRIPE_QUEUE)
+        pthread_cond_wait(&d->not_full, &d->mu);
+    d->q[d->tail++ % STRIPE_QUEUE] = (stripe_req){op, buf, dev_off, c, slot};
+    pthread_cond_signal(&d->not_empty);
+    pthread_mutex_unlock(&d->mu);
+}
+
+static void stripe_wait(io_ctx *c, int slot){
+    if (!__atomic_load_n(&c->pending[slot], __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&c->mu);
+    while (__atomic_load_n(&c->pending[slot], __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&c->done, &c->mu);
+    pthread_mutex_unlock(&c->mu);
+}
+
+static void *stripe_worker(void *arg){
+    stripe_dev *d = (stripe_dev *)arg;
+    for (;;){
+        pthread_mutex_lock(&d->mu);
+        while (d->head == d->tail)
+            pthread_cond_wait(&d->not_empty, &d->mu);
+        stripe_req r = d->q[d->head++ % STRIPE_QUEUE];
+        pthread_cond_signal(&d->not_full);
+        pthread_mutex_unlock(&d->mu);
+
+        // stripe_fd在set_state_files才打開，第一個request一定在那之後
+        int fd = stripe_fd[d->id];
+        ssize_t ret = r.op == IORING_OP_READ ? pread(fd, r.buf, chunk_size, r.off)
+                                             : pwrite(fd, r.buf, chunk_size, r.off);
+        if (ret != (ssize_t)chunk_size)
+            io_fail(r.op == IORING_OP_READ ? "stripe read" : "stripe write", ret < 0 ? -errno : ret);
+
+        if (!__atomic_sub_fetch(&r.c->pending[r.slot], 1, __ATOMIC_RELEASE)){
+            pthread_mutex_lock(&r.c->mu);
+            pthread_cond_broadcast(&r.c->done);
+            pthread_mutex_unlock(&r.c->mu);
+        }
+    }
+    return NULL;
+}
+
+// 同步讀寫: 拆成chunk丟給各device，全部完成才回傳
+static void stripe_rw(int op, int fd, void *buf, ull size, ull off){
+    io_ctx *c = &io_ctxs[omp_get_thread_num()];
+    for (ull i = 0; i < size; i += chunk_size)
+        stripe_submit(c, op, fd, buf + i, off + i, IoDepth);
+    stripe_wait(c, IoDepth);
+}
+
+static void stripe_init(){
+    stripe_devs = (stripe_dev *)calloc(num_stripe, sizeof(stripe_dev));
+    for (int d = 0; d < num_stripe; d++){
+        stripe_dev *dev = &stripe_devs[d];
+        dev->id = d;
+        pthread_mutex_init(&dev->mu, NULL);
+        pthread_cond_init(&dev->not_empty, NULL);
+        pthread_cond_init(&dev->not_full, NULL);
+        for (int w = 0; w < StripeWorkers; w++){
+            pthread_t th;
+            if (pthread_create(&th, NULL, stripe_worker, dev))
+                io_fail("pthread_create", -errno);
+            pthread_detach(th);
+        }
+    }
+}
+
+/*
+取代 set_state_files 裡寫入初始state的部分 (stripe file由set_state_files打開)。
+skip_init_state=1 時從state_paths讀入之前的state，否則每組都設成 |0...0>。
+每次寫一整個thread buffer，讓所有device同時在寫。
+*/
+void io_stripe_init_state(){
+    for (int i = 0; i < SetOfSaveState * num_file; i++)
+        fd_arr_set[i/num_file][i%num_file] = i;
+    if (ckpt_restore) // checkpoint_restore() 會寫入
+        return;
+
+    #pragma omp parallel num_threads(num_thread)
+    {
+        int t = omp_get_thread_num();
+        int f = t/num_thread_per_file;
+        int td = t%num_thread_per_file;
+        Type *buf = (Type *)thread_settings[t].rd;
+        ull batch = 8 * IoDepth * chunk_size;
+        if (batch > thread_size)
+            batch = thread_size;
+
+        for (int set = 0; set < SetOfSaveState; set++){
+            int src = -1;
+            if (SkipInithread_state){
+                src = open(state_paths[set*num_file + f], O_RDONLY);
+                if (src < 0){
+                    printf("[IO]: cannot load previous state %s\n", state_paths[set*num_file + f]);
+                    exit(1);
+                }
+            }
+            else
+                memset(buf, 0, batch);
+            ull end = (td+1) * thread_size;
+            for (ull off = td * thread_size, len; off < end; off += len){
+                len = end - off < batch ? end - off : batch;
+                if (src >= 0 && pread(src, buf, len, off) != (ssize_t)len){
+                    printf("[IO]: cannot load previous state %s\n", state_paths[set*num_file + f]);
+                    exit(1);
+                }
+                if (src < 0 && t == 0 && off == 0)
+                    buf[0].real = 1.;   // |0...0>
+                io_pwrite(fd_arr_set[set][f], buf, len, off);
+                if (src < 0)
+                    buf[0].real = 0.;
+            }
+            if (src >= 0)
+                close(src);
+        }
+    }
+}
+
+/*===================================================================
+memory backend (io_engine=3)
+
+整個state (SetOfSaveState組 x num_file個file) 放在一塊記憶體，
+"fd" 是 set*num_file + f，file內的offset跟原本一樣，所以gate.c不用改。
+先試 MAP_HUGETLB (要先設定 vm.nr_hugepages)，失敗就用一般mmap + MADV_HUGEPAGE (THP)；
+有多個NUMA node時用 mbind(MPOL_INTERLEAVE) 把page平均分散到各node。
+chunk group在記憶體內連續時 (例如只有一個fd的 inner_loop) 直接把指標交給gate_func，
+不連續時才copy到thread的buffer。
+===================================================================*/
+#define MEM_HUGE_PAGE (2ULL << 20)
+#define MEM_MPOL_INTERLEAVE 3
+
+static char *mem_base;
+
+void *io_mem_ptr(int fd, ull off){
+    return mem_base + (ull)fd * file_size + off;
+}
+
+// /sys/devices/system/node/online: "0" or "0-3" or "0,2-3"
+static int mem_node_mask(unsigned long *mask){
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    int nodes = 0;
+    *mask = 0;
+    if (!f)
+        return 0;
+    int lo, hi;
+    char sep;
+    while (fscanf(f, "%d", &lo) == 1){
+        hi = lo;
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-'){
+            if (fscanf(f, "%d", &hi) != 1)
+                break;
+            if (fscanf(f, "%c", &sep) != 1)
+                sep = 0;
+        }
+        for (int n = lo; n <= hi && n < 64; n++, nodes++)
+            *mask |= 1UL << n;
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return nodes;
+}
+
+static void mem_init(){
+    ull total = SetOfSaveState * num_file * file_size;
+    ull len = (total + MEM_HUGE_PAGE - 1) & ~(MEM_HUGE_PAGE - 1);
+    const char *page = "hugetlb";
+
+    mem_base = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (mem_base == MAP_FAILED){
+        mem_base = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (mem_base == MAP_FAILED)
+            io_fail("mmap state", -errno);
+        page = madvise(mem_base, len, MADV_HUGEPAGE) ? "4k" : "THP";
+    }
+
+    unsigned long mask;
+    int nodes = mem_node_mask(&mask);
+    if (nodes > 1 && syscall(__NR_mbind, mem_base, len, MEM_MPOL_INTERLEAVE, &mask, 64, 0))
+        nodes = 1;
+
+    printf("[IO]: memory engine, %llu MB, %s pages, %d NUMA node(s)\n", total >> 20, page, nodes > 1 ? nodes : 1);
+}
+
+/*
+取代 set_state_files 裡開檔及寫入初始state的部分。
+skip_init_state=1 時從state_paths讀入之前的state，否則每組都設成 |0...0>。
+每條thread touch自己的那段，page fault不會算進模擬時間。
+*/
+void io_mem_init_state(){
+    for (int i = 0; i < SetOfSaveState * num_file; i++)
+        fd_arr_set[i/num_file][i%num_file] = i;
+
+    #pragma omp parallel for num_threads(num_thread) schedule(static, 1)
+    for (int t = 0; t < num_thread; t++){
+        int f = t/num_thread_per_file;
+        int td = t%num_thread_per_file;
+        for (int set = 0; set < SetOfSaveState; set++){
+            void *p = io_mem_ptr(fd_arr_set[set][f], td * thread_size);
+            if (ckpt_restore) // checkpoint_restore() 會寫入
+                continue;
+            if (!SkipInithread_state){
+                memset(p, 0, thread_size);
+                continue;
+            }
+            int fd = open(state_paths[set*num_file + f], O_RDONLY);
+            if (fd < 0 || pread(fd, p, thread_size, td * thread_size) != (ssize_t)thread_size){
+                printf("[IO]: cannot load previous state %s\n", state_paths[set*num_file + f]);
+                exit(1);
+            }
+            close(fd);
+        }
+    }
+    if (!SkipInithread_state && !ckpt_restore)
+        for (int set = 0; set < SetOfSaveState; set++){
+            ((Type *)io_mem_ptr(fd_arr_set[set][0], 0))->real = 1.;
+            if (zchunk)
+                zchunk_set(fd_arr_set[set][0], 0, 0);
+        }
+}
+
+static void raw_pread(int fd, void *buf, ull size, ull off){
+    if (IoEngine == IO_MEM)
+        memcpy(buf, io_mem_ptr(fd, off), size);
+    else if (IoEngine == IO_STRIPE)
+        stripe_rw(IORING_OP_READ, fd, buf, size, off);
+    else if (pread(fd, buf, size, off));
+}
+
+static void raw_pwrite(int fd, void *buf, ull size, ull off){
+    if (IoEngine == IO_MEM)
+        memcpy(io_mem_ptr(fd, off), buf, size);
+    else if (IoEngine == IO_STRIPE)
+        stripe_rw(IORING_OP_WRITE, fd, buf, size, off);
+    else if (pwrite(fd, buf, size, off));
+}
+
+/*===================================================================
+zero chunk (zchunk.h)
+===================================================================*/
+// chunk變成全0: 在file上挖洞，成功回傳1 (不用再寫入0)
+static int punch_chunk(int fd, ull off){
+    if (IoEngine == IO_MEM)
+        return 0;
+    if (IoEngine == IO_STRIPE){
+        ull dev_off;
+        fd = stripe_fd[stripe_map(fd, off, &dev_off)];
+        off = dev_off;
+    }
+    return !fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, off, chunk_size);
+}
+
+// 寫回一個chunk之前呼叫，更新zchunk；回傳1時不用寫入 (chunk是0且file上已經是0)
+static int zero_write(int fd, void *buf, ull off){
+    ull id = zchunk_id(fd, off);
+    if (!chunk_is_zero(buf)){
+        zchunk[id] = 0;
+        return 0;
+    }
+    if (zchunk[id])
+        return 1;
+    zchunk[id] = 1;
+    return punch_chunk(fd, off);
+}
+
+// 要寫回的這組chunk全是0: gate做完還是0，read, gate_func, write都跳過
+static inline int group_zero(int nfd, int *fd, ull *fd_off, ull i, int mode){
+    if (!zchunk || !(mode & IO_WR))
+        return 0;
+    for (int k = 0; k < nfd; k++)
+        if (!zchunk_zero(fd[k], fd_off[k] + i * chunk_size))
+            return 0;
+    __atomic_add_fetch(&zchunk_skipped, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+io_pread/io_pwrite: size及offset是chunk的倍數 (zero_chunk, stripe)。
+zero_chunk時全0的chunk不讀 (memset)，連續非0的chunk一次讀寫。
+*/
+void io_pread(int fd, void *buf, ull size, ull off){
+    if (!zchunk || IoEngine == IO_MEM){
+        raw_pread(fd, buf, size, off);
+        return;
+    }
+    ull run = 0;
+    for (ull i = 0; i <= size; i += chunk_size){
+        if (i < size && !zchunk_zero(fd, off + i)){
+            run += chunk_size;
+            continue;
+        }
+        if (run)
+            raw_pread(fd, buf + i - run, run, off + i - run);
+        run = 0;
+        if (i < size)
+            memset(buf + i, 0, chunk_size);
+    }
+}
+
+void io_pwrite(int fd, void *buf, ull size, ull off){
+    if (!zchunk){
+        raw_pwrite(fd, buf, size, off);
+        return;
+    }
+    ull run = 0;
+    for (ull i = 0; i <= size; i += chunk_size){
+        if (i < size && !zero_write(fd, buf + i, off + i)){
+            run += chunk_size;
+            continue;
+        }
+        if (run)
+            raw_pwrite(fd, buf + i - run, run, off + i - run);
+        run = 0;
+    }
+}
+
+// io_engine=0 + zero_chunk: inner_loop* 的同步版本
+static void sync_pipeline(ull size, void *rd, int nfd, int *fd, ull *fd_off, int mode){
+    for (ull i = 0; i < size; i += chunk_state){
+        if (!group_zero(nfd, fd, fd_off, 0, mode)){
+            for (int k = 0; k < nfd; k++){
+                int pos = (mode & IO_SWAP) ? nfd-1-k : k;
+                io_pread(fd[k], rd + pos * chunk_size, chunk_size, fd_off[k]);
+            }
+            if (!(mode & IO_SWAP))
+                gate_func((Type *)rd);
+            if (mode & IO_WR)
+                for (int k = 0; k < nfd; k++)
+                    io_pwrite(fd[k], rd + k * chunk_size, chunk_size, fd_off[k]);
+        }
+        for (int k = 0; k < nfd; k++)
+            fd_off[k] += chunk_size;
+    }
+}
+
+// inner_loop* 的memory版本
+static void mem_pipeline(ull size, void *rd, int nfd, int *fd, ull *fd_off, int mode){
+    for (ull i = 0; i < size; i += chunk_state){
+        if (group_zero(nfd, fd, fd_off, 0, mode)){
+            for (int k = 0; k < nfd; k++)
+                fd_off[k] += chunk_size;
+            continue;
+        }
+        void *p[8] = {0};
+        int direct = 1;
+        for (int k = 0; k < nfd; k++){
+            p[k] = io_mem_ptr(fd[k], fd_off[k]);
+            if (p[k] != p[0] + k * chunk_size)
+                direct = 0;
+        }
+
+        if (mode & IO_SWAP){
+            memcpy(rd, p[0], chunk_size);
+            memcpy(p[0], p[1], chunk_size);
+            memcpy(p[1], rd, chunk_size);
+        }
+        else if (direct)
+            gate_func((Type *)p[0]);
+        else {
+            for (int k = 0; k < nfd; k++)
+                memcpy(rd + k * chunk_size, p[k], chunk_size);
+            gate_func((Type *)rd);
+            if (mode & IO_WR)
+                for (int k = 0; k < nfd; k++)
+                    memcpy(p[k], rd + k * chunk_size, chunk_size);
+        }
+        if (zchunk && (mode & IO_WR))
+            for (int k = 0; k < nfd; k++)
+                zchunk_set(fd[k], fd_off[k], chunk_is_zero(p[k]));
+
+        for (int k = 0; k < nfd; k++)
+            fd_off[k] += chunk_size;
+    }
+}
+
+/*===================================================================
+io_pipeline
+
+對應 inner_loop* 的非同步版本，結果(包含fd_off的位移)與同步版本相同。
+size: 要處理的state數量 (以chunk_state為單位前進)
+rd:   thread的buffer，切成IoDepth個slot，每個slot放nfd個chunk
+===================================================================*/
+static inline void submit(io_ctx *c, int op, int fd, void *buf, ull off, int slot, int k){
+    if (IoEngine == IO_STRIPE)
+        stripe_submit(c, op, fd, buf, off, slot);
+    else if (c->ring_fd >= 0)
+        uring_submit(c, op, fd, buf, off, slot);
+    else
+        aio_submit(c, op, fd, buf, off, slot, k);
+}
+
+static inline void wait_slot(io_ctx *c, int slot){
+    if (IoEngine == IO_STRIPE)
+        stripe_wait(c, slot);
+    else if (!c->pending[slot])
+        return;
+    else if (c->ring_fd >= 0)
+        uring_wait(c, slot);
+    else
+        aio_wait(c, slot);
+}
+
+static inline void issue(io_ctx *c, int op, void *rd, int nfd, int *fd, ull *fd_off, ull i, int mode){
+    int slot = i % IoDepth;
+    void *buf = rd + slot * nfd * chunk_size;
+    if (op == IORING_OP_READ)
+        c->skip[slot] = group_zero(nfd, fd, fd_off, i, mode);
+    if (c->skip[slot])
+        return;
+    for (int k = 0, n = 0; k < nfd; k++){
+        int pos = (mode & IO_SWAP) && op == IORING_OP_READ ? nfd-1-k : k;
+        void *p = buf + pos * chunk_size;
+        ull off = fd_off[k] + i * chunk_size;
+        if (zchunk && op == IORING_OP_READ && zchunk_zero(fd[k], off)){
+            memset(p, 0, chunk_size);
+            continue;
+        }
+        if (zchunk && op == IORING_OP_WRITE && zero_write(fd[k], p, off))
+            continue;
+        submit(c, op, fd[k], p, off, slot, n++);
+    }
+    if (c->ring_fd >= 0)
+        uring_enter(c, 0);
+}
+
+void io_pipeline(ull size, void *rd, int nfd, int *fd, ull *fd_off, int mode){
+    if (IoEngine == IO_MEM){
+        mem_pipeline(size, rd, nfd, fd, fd_off, mode);
+        return;
+    }
+    if (IoEngine == IO_SYNC){
+        sync_pipeline(size, rd, nfd, fd, fd_off, mode);
+        return;
+    }
+    io_ctx *c = &io_ctxs[omp_get_thread_num()];
+
+    ull n = (size + chunk_state - 1) / chunk_state;
+    ull D = IoDepth;
+
+    for (ull i = 0; i < n && i < D-1; i++)
+        issue(c, IORING_OP_READ, rd, nfd, fd, fd_off, i, mode);
+
+    for (ull i = 0; i < n; i++){
+        int slot = i % D;
+        wait_slot(c, slot);
+        if (!(mode & IO_SWAP) && !c->skip[slot])
+            gate_func((Type *)(rd + slot * nfd * chunk_size));
+        if (mode & IO_WR)
+            issue(c, IORING_OP_WRITE, rd, nfd, fd, fd_off, i, mode);
+
+        // slot of chunk group i-1 is reused by i+D-1
+        ull next = i + D - 1;
+        if (next < n){
+            wait_slot(c, next % D);
+            issue(c, IORING_OP_READ, rd, nfd, fd, fd_off, next, mode);
+        }
+    }
+
+    for (ull s = 0; s < D; s++)
+        wait_slot(c, s);
+
+    for (int k = 0; k < nfd; k++)
+        fd_off[k] += n * chunk_size;
+}
+
+void io_engine_init(){
+    if (IoEngine == IO_SYNC)
+        return;
+    if (IoEngine == IO_MEM){
+        mem_init();
+        return;
+    }
+    if (IoEngine != IO_AIO && IoEngine != IO_URING && IoEngine != IO_STRIPE){
+        printf("[IO]: unknown io_engine %d\n", IoEngine);
+        exit(1);
+    }
+    unsigned entries = 1;
+    while (entries < (unsigned)(IoDepth * 8))
+        entries <<= 1;
+
+    io_ctxs = (io_ctx *)calloc(num_thread, sizeof(io_ctx));
+    for (int t = 0; t < num_thread; t++){
+        io_ctx *c = &io_ctxs[t];
+        c->pending = (int *)calloc(IoDepth + 1, sizeof(int)); // stripe: 第IoDepth個給io_pread/io_pwrite
+        c->skip = (char *)calloc(IoDepth, sizeof(char));
+        c->cbs = (struct aiocb *)calloc(IoDepth * 8, sizeof(struct aiocb));
+        c->ring_fd = -1;
+        pthread_mutex_init(&c->mu, NULL);
+        pthread_cond_init(&c->done, NULL);
+        if (IoEngine == IO_URING && uring_setup(c, entries)){
+            printf("[IO]: io_uring unavailable, fall back to POSIX AIO\n");
+            IoEngine = IO_AIO;
+        }
+    }
+    if (IoEngine == IO_STRIPE){
+        stripe_init();
+        printf("[IO]: stripe engine, %d device(s) x %d worker(s), depth %d\n", num_stripe, StripeWorkers, IoDepth);
+        return;
+    }
+    printf("[IO]: %s engine, depth %d\n", IoEngine == IO_URING ? "io_uring" : "POSIX AIO", IoDepth);
+}
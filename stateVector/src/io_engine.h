@@ -0,0 +1,44 @@
+#ifndef IO_ENGINE_H_
+#define IO_ENGINE_H_
+
+/*===================================================================
+IO engine guide
+
+inner_loop* 預設是同步的 pread -> gate_func -> pwrite。
+在ini的[system]設定 io_engine 可以換成非同步的pipeline:
+    io_engine=0   sync (pread/pwrite, 原本的行為)
+    io_engine=1   POSIX AIO (aio_read/aio_write)
+    io_engine=2   io_uring (直接走syscall, 不需要liburing)
+    io_engine=3   memory，整個state放在記憶體 (見 io_engine.c 的 memory backend)
+    io_engine=4   stripe，state以chunk為單位分散到 stripe_paths 的每個device (見 io_engine.c 的 stripe backend)
+    io_depth=N    每條thread同時在buffer內的chunk group數量 (>=2)
+
+pipeline在計算第i個chunk group時，第i+1..i+N-2個group的read
+以及第i-1個group的write都還在進行中。
+io_uring初始化失敗時會退回POSIX AIO。
+===================================================================*/
+
+#define IO_SYNC  0
+#define IO_AIO   1
+#define IO_URING 2
+#define IO_MEM   3
+#define IO_STRIPE 4
+
+#define STRIPE_MAX_DEV 64
+
+// io_pipeline mode
+#define IO_RD   1   // read chunks into buffer and call gate_func
+#define IO_WR   2   // write chunks back afterward
+#define IO_SWAP 4   // (2 fds) read crosswise and skip gate_func
+
+void io_engine_init();
+void io_pipeline(unsigned long long size, void *rd, int nfd, int *fd, unsigned long long *fd_off, int mode);
+
+// memory/stripe backend: fd 是 set*num_file + f
+void *io_mem_ptr(int fd, unsigned long long off);
+void io_mem_init_state();
+void io_stripe_init_state();
+void io_pread(int fd, void *buf, unsigned long long size, unsigned long long off);
+void io_pwrite(int fd, void *buf, unsigned long long size, unsigned long long off);
+
+#endif
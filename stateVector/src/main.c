@@ -4,6 +4,7 @@
 #include "init.h"
 #include "common.h"
 #include "gate.h"
+#include "zchunk.h"
 
 int main(int argc, char *argv[]) {
     char *ini, *cir;
@@ -21,6 +22,8 @@ int main(int argc, char *argv[]) {
     MEASURET_START;
     run_simulator();
     MEASURET_END("Total: ");
+    zchunk_report();
+    save_state_files();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#! /bin/bash
+
+# Toffoli: native op 14 vs the usual 15-gate decomposition (H, CX, T, Tdg)
+# usage: ./mc_bench.sh [toffolis] [total_qbit] [io_engine]
+G=${1:-50}
+N=${2:-20}
+ENGINE=${3:-0}
+DIR=./mc_bench
+mkdir -p $DIR/state
+
+for M in native decomp
+do
+    awk -v G=$G -v N=$N -v M=$M 'BEGIN{
+        srand(1);
+        pi = atan2(0, -1);
+        n = (M == "native") ? N+G : N+15*G;
+        print n;
+        for (q = 0; q < N; q++)
+            print "0 0 1 0", q;
+        for (i = 0; i < G; i++){
+            a = int(rand()*N);
+            do { b = int(rand()*N); } while (b == a);
+            do { c = int(rand()*N); } while (c == a || c == b);
+            if (M == "native"){
+                print "14 2 1 0", a, b, c;
+                continue;
+            }
+            print "0 0 1 0", c;
+            print "8 1 1 0", b, c;     print "6 0 1 1", c, -pi/4, pi/4;
+            print "8 1 1 0", a, c;     print "2 0 1 0", c;
+            print "8 1 1 0", b, c;     print "6 0 1 1", c, -pi/4, pi/4;
+            print "8 1 1 0", a, c;     print "2 0 1 0", b;
+            print "2 0 1 0", c;        print "0 0 1 0", c;
+            print "8 1 1 0", a, b;     print "2 0 1 0", a;
+            print "6 0 1 1", b, -pi/4, pi/4;
+            print "8 1 1 0", a, b;
+        }
+    }' > $DIR/circuit.txt
+
+    cat > $DIR/bench.ini << EOF
+[system]
+total_qbit=$N
+global_qbit=1
+thread_qbit=3
+local_qbit=12
+max_qbit=38
+max_path=260
+max_depth=$((15*G+N+1))
+is_density=0
+set_of_save_state=2
+state_paths=$DIR/state/path1,$DIR/state/path2,$DIR/state/path3,$DIR/state/path4
+io_engine=$ENGINE
+mem_dump=0
+EOF
+    ./qSim.out -i $DIR/bench.ini -c $DIR/circuit.txt | grep "Total:" | \
+        awk -v M=$M -v G=$G '{printf "%s: %d toffolis, %.2f s\n", M, G, $2/1e6}'
+done
@@ -9,9 +9,12 @@
 #include "gate.h"
 #include "gate_util.h"
 #include "gate_chunk.h"
+#include "gate_soa.h"
 #include "measure.h"
+#include "io_engine.h"
 
 int* measure_fd_arr;
+static Acc_t *measure_prob; // 機率 {p0, p1}，所有thread共用 (real是每條thread各自一份)
 
 void measure(int targ, int fd_set){
     int t = omp_get_thread_num();
@@ -23,9 +26,10 @@ void measure(int targ, int fd_set){
     if (t == 0){
         measure_fd_arr = fd_arr_set[fd_set];
 
-        gate_func = PreMeasure;
+        gate_func = (StateFormat == STATE_SOA) ? PreMeasure_soa : PreMeasure;
 
         loop_size = thread_state;
+        thread_split = (isGlobal(targ) || isThread(targ)) ? 2 : 1;
     
         if (isLocal(targ)){
             inner_loop_func = inner_loop_read;
@@ -53,26 +57,24 @@ void measure(int targ, int fd_set){
             make_targ_pair(para_segment, targ-file_segment, td_pair);
         }
 
-        real = (double*)malloc(2*sizeof(double));
-        real[0] = 0.0;
-        real[1] = 0.0;
+        measure_prob = (Acc_t*)malloc(2*sizeof(Acc_t));
+        measure_prob[0] = 0.0;
+        measure_prob[1] = 0.0;
         // printf("Thread rank: %d pass barrier, targ= %d\n", t, targ);
     }
 
     #pragma omp barrier
+    real = measure_prob;
+    // global/thread qubit: 一對由 thread_split 條thread分著做 (thread split guide, gate_util.c)
+    int v = t / thread_split;
 
     /*------------------------------
     [2nd phase] Applying measure
     ------------------------------*/
-    if ((isGlobal(targ) || isThread(targ)) && t >= half_num_thread){
-        #pragma omp barrier
-        #pragma omp barrier
-        return;
-    }
 
     if (isGlobal(targ)){
-        int f = t/num_thread_per_file;
-        int td = t%num_thread_per_file;
+        int f = v/num_thread_per_file;
+        int td = v%num_thread_per_file;
 
         int fd0 = fd_pair[2*f];
         int fd1 = fd_pair[2*f+1];
@@ -85,8 +87,8 @@ void measure(int targ, int fd_set){
     }
     
     if (isThread(targ)) {
-        int fd = t/(num_thread_per_file/2);
-        int td = t%(num_thread_per_file/2);
+        int fd = v/(num_thread_per_file/2);
+        int td = v%(num_thread_per_file/2);
 
         int t0 = td_pair[2*td];
         int t1 = td_pair[2*td + 1];
@@ -100,8 +102,8 @@ void measure(int targ, int fd_set){
     } 
 
     if(isMiddle(targ)){
-        int fd = t/num_thread_per_file;
-        int td = t%num_thread_per_file;
+        int fd = v/num_thread_per_file;
+        int td = v%num_thread_per_file;
 
         ull t0_off = td * thread_state * sizeof(Type);
         ull t1_off = t0_off + half_targ_offset * sizeof(Type);
@@ -112,8 +114,8 @@ void measure(int targ, int fd_set){
     }
 
     if (isLocal(targ)){
-        int fd = t/num_thread_per_file;
-        int td = t%num_thread_per_file;
+        int fd = v/num_thread_per_file;
+        int td = v%num_thread_per_file;
 
         ull t_off = td * thread_state * sizeof(Type);
 
@@ -155,7 +157,7 @@ void measure(int targ, int fd_set){
             // printf("[3]");
             // printf("[0]target %d = 0", targ);
             // fflush(stdout);
-            gate_func = Measure_0;
+            gate_func = (StateFormat == STATE_SOA) ? Measure_0_soa : Measure_0;
             real[0] = 1/sqrt(real[0]);
             real[1] = 0;
         }
@@ -163,7 +165,7 @@ void measure(int targ, int fd_set){
             // printf("[4]");
             // printf("[1]target %d = 1", targ);
             // fflush(stdout);
-            gate_func = Measure_1;
+            gate_func = (StateFormat == STATE_SOA) ? Measure_1_soa : Measure_1;
             real[0] = 1/sqrt(real[1]);
             real[1] = 1;
         }
@@ -182,8 +184,8 @@ void measure(int targ, int fd_set){
     [4th phase] Applying measure
     ------------------------------*/
     if (isGlobal(targ)){
-        int f = t/num_thread_per_file;
-        int td = t%num_thread_per_file;
+        int f = v/num_thread_per_file;
+        int td = v%num_thread_per_file;
 
         int fd1 = fd_pair[2*f];
         int fd2 = fd_pair[2*f+1];
@@ -197,8 +199,8 @@ void measure(int targ, int fd_set){
     }
     
     if (isThread(targ)) {
-        int fd = t/(num_thread_per_file/2);
-        int td = t%(num_thread_per_file/2);
+        int fd = v/(num_thread_per_file/2);
+        int td = v%(num_thread_per_file/2);
 
         int t0 = td_pair[2*td];
         int t1 = td_pair[2*td + 1];
@@ -213,11 +215,11 @@ void measure(int targ, int fd_set){
     }
 
     if(isMiddle(targ)){
-        int fd = t/num_thread_per_file;
-        int td = t%num_thread_per_file;
+        int fd = v/num_thread_per_file;
+        int td = v%num_thread_per_file;
 
         ull t0_off = td * thread_state * sizeof(Type);
-        ull t1_off = t1_off + half_targ_offset * sizeof(Type);
+        ull t1_off = t0_off + half_targ_offset * sizeof(Type);
 
         s->fd[0] = measure_fd_arr[fd]; s->fd_off[0] = t0_off;
         s->fd[1] = measure_fd_arr[fd]; s->fd_off[1] = t1_off;
@@ -226,8 +228,8 @@ void measure(int targ, int fd_set){
     }
 
     if (isLocal(targ)){
-        int fd = t/num_thread_per_file;
-        int td = t%num_thread_per_file;
+        int fd = v/num_thread_per_file;
+        int td = v%num_thread_per_file;
 
         ull t_off = td * thread_state * sizeof(Type);
 
@@ -253,9 +255,156 @@ void save_state(int fd_set_src, int fd_set_dst){
 
     void* rd = (void *) q_read + t * chunk_size;
     for(ull i = 0; i < thread_state; i += chunk_state){
-        if(pread  (fd_src, rd, chunk_size, t_off));
-        if(pwrite (fd_dst, rd, chunk_size, t_off));
+        io_pread (fd_src, rd, chunk_size, t_off);
+        io_pwrite(fd_dst, rd, chunk_size, t_off);
         t_off += chunk_size;
     }
     return;
-}
\ No newline at end of file
+}
+/*===================================================================
+sampling (sampling=1)
+
+op 20/21 的多個shot不再每個shot都複製state再逐一measure，
+而是直接從fd_set那組state抽出所有shot:
+1. 每條thread讀過自己的thread_state，算出每個chunk的機率
+2. (thread 0) chunk機率做prefix sum，用exponential spacing產生排序好的
+   shots個uniform random，依prefix sum分給各個chunk
+3. 每條thread只讀有分到shot的chunk，在chunk內累加機率找到對應的state
+4. (thread 0) 打亂shot的順序
+
+state只讀不寫，整組shot最多讀兩次state，跟shots數量無關。
+抽出的是整個state的編號，measure部分qubit時再取出對應的bit (marginal)。
+===================================================================*/
+static double *chunk_cum;       // chunk_cum[c]: chunk c之前的機率總和, chunk_cum[num_chunk] = 全部
+static ull *chunk_first;        // chunk c分到的shot是 [chunk_first[c], chunk_first[c+1])
+static ull *chunk_cursor;       // 每條thread下一個chunk的編號
+static double *sample_u;
+static ull *sample_idx;
+static int sample_cap;
+
+static void ChunkProb(Type *q_rd){
+    int t = omp_get_thread_num();
+    Type_t *v = (Type_t *)q_rd;
+    double p = 0;
+    // interleaved及SoA都是chunk內所有real、imag的平方和
+    for (ull i = 0; i < 2*chunk_state; i++)
+        p += (double)v[i]*v[i];
+    chunk_cum[chunk_cursor[t]++ + 1] = p;
+}
+
+static inline double state_prob(Type *q_rd, ull i){
+    if(StateFormat == STATE_SOA){
+        Type_t *re = (Type_t *)q_rd;
+        return (double)re[i]*re[i] + (double)re[chunk_state+i]*re[chunk_state+i];
+    }
+    return (double)q_rd[i].real*q_rd[i].real + (double)q_rd[i].imag*q_rd[i].imag;
+}
+
+static void sample_prepare(int shots){
+    ull num_chunk = (1ULL << N) / chunk_state;
+    if(!chunk_cum){
+        chunk_cum = (double *)malloc((num_chunk+1)*sizeof(double));
+        chunk_first = (ull *)malloc((num_chunk+1)*sizeof(ull));
+        chunk_cursor = (ull *)malloc(num_thread*sizeof(ull));
+    }
+    if(shots > sample_cap){
+        free(sample_u);
+        free(sample_idx);
+        sample_u = (double *)malloc(shots*sizeof(double));
+        sample_idx = (ull *)malloc(shots*sizeof(ull));
+        sample_cap = shots;
+    }
+    chunk_cum[0] = 0;
+    gate_func = ChunkProb;
+    gate_size = chunk_state;
+}
+
+// 排序好的uniform: 前k個exponential的和 / 全部shots+1個的和
+static void sample_draw(int shots){
+    ull num_chunk = (1ULL << N) / chunk_state;
+    for (ull c = 0; c < num_chunk; c++)
+        chunk_cum[c+1] += chunk_cum[c];
+    double total = chunk_cum[num_chunk];
+
+    double sum = 0;
+    for (int k = 0; k < shots; k++){
+        sum += -log(1. - (double) rand() / ((double) RAND_MAX + 1));
+        sample_u[k] = sum;
+    }
+    sum += -log(1. - (double) rand() / ((double) RAND_MAX + 1));
+    for (int k = 0; k < shots; k++)
+        sample_u[k] *= total / sum;
+
+    ull j = 0;
+    for (ull c = 0; c < num_chunk; c++){
+        while(j < shots && sample_u[j] < chunk_cum[c])
+            j++;
+        chunk_first[c] = j;
+    }
+    chunk_first[num_chunk] = shots;
+}
+
+/*
+從fd_set那組state抽shots個state，回傳的array (shots個state編號) 在下一次呼叫前有效
+所有thread都要呼叫
+*/
+ull *sample_states(int fd_set, int shots){
+    int t = omp_get_thread_num();
+    setStreamv2 *s = &thread_settings[t];
+    int f = t/num_thread_per_file;
+    int td = t%num_thread_per_file;
+    ull first_chunk = (f*file_state + td*thread_state) / chunk_state;
+
+    #pragma omp barrier
+    if(t == 0)
+        sample_prepare(shots);
+    #pragma omp barrier
+
+    // 1. 每個chunk的機率
+    chunk_cursor[t] = first_chunk;
+    s->fd[0] = fd_arr_set[fd_set][f];
+    s->fd_off[0] = td*thread_size;
+    inner_loop_read(thread_state, s->rd, s->fd, s->fd_off);
+    #pragma omp barrier
+
+    // 2. 抽排序好的uniform並分給chunk
+    if(t == 0)
+        sample_draw(shots);
+    #pragma omp barrier
+
+    // 3. 只讀有shot的chunk
+    for (ull c = first_chunk; c < first_chunk + thread_state/chunk_state; c++){
+        ull j = chunk_first[c];
+        ull end = chunk_first[c+1];
+        if(j == end)
+            continue;
+        io_pread(s->fd[0], s->rd, chunk_size, (c - first_chunk)*chunk_size + td*thread_size);
+        double acc = chunk_cum[c];
+        ull last = 0;
+        for (ull i = 0; i < chunk_state && j < end; i++){
+            double p = state_prob((Type *)s->rd, i);
+            if(p == 0)
+                continue;
+            acc += p;
+            last = i;
+            while(j < end && sample_u[j] < acc)
+                sample_idx[j++] = c*chunk_state + i;
+        }
+        // 累加順序不同造成的誤差，剩下的給chunk內最後一個非0的state
+        while(j < end)
+            sample_idx[j++] = c*chunk_state + last;
+    }
+    #pragma omp barrier
+
+    // 4. 打亂順序，讓輸出跟逐一measure一樣是獨立的shot序列
+    if(t == 0){
+        for (int k = shots-1; k > 0; k--){
+            int r = rand() % (k+1);
+            ull tmp = sample_idx[k];
+            sample_idx[k] = sample_idx[r];
+            sample_idx[r] = tmp;
+        }
+    }
+    #pragma omp barrier
+    return sample_idx;
+}
@@ -3,5 +3,6 @@
 
 void measure(int targ, int fd_set);
 void save_state(int fd_set_src, int fd_set_dst);
+unsigned long long *sample_states(int fd_set, int shots);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "common.h"
+#include "gate.h"
+#include "gate_util.h"
+#include "plan.h"
+#include "checkpoint.h"
+#include "density.h"
+
+#define STEP_GATE  0 // 預先記錄的gate
+#define STEP_MULTI 1 // multi_gate，context事先算好
+#define STEP_CALL  2 // 其他: run_gate()
+
+// 一次 _thread_CX*，同樣的呼叫重複reps次，每次fd_off加stride
+typedef struct plan_call {
+    int width;      // 1: _thread_CX, 2: _thread_CX2, 4: _thread_CX4, 8: _thread_CX8
+    int nfd;        // inner_loop_func用到的fd數量
+    int fd[8];
+    ull fd_off[8];
+    ull reps;
+    ull stride;
+} plan_call;
+
+typedef struct plan_step {
+    int kind;
+    int sync;       // 執行前要barrier
+    int ckpt;       // 執行前由checkpoint_point()取代barrier (checkpoint.h)
+    gate *g;
+    int num;        // STEP_MULTI, STEP_CALL: gate數量
+    gate_ctx ctx;
+    Acc_t *real;
+    Acc_t *imag;
+    gate_ctx *multi_ctx;
+    int *num_call;  // [num_thread]
+    plan_call **call;
+} plan_step;
+
+plan_step *plan_rec;
+static plan_step *steps;
+static int num_step;
+
+static void (*const thread_cx[9])(setStreamv2 *) = {
+    [1] = _thread_CX, [2] = _thread_CX2, [4] = _thread_CX4, [8] = _thread_CX8
+};
+
+/*
+(記錄模式) 取代 _thread_CX* 的執行:
+記下這條thread的 fd, fd_off，再照 _thread_CX* 及 inner_loop* 的方式把 s->fd_off 往後推，
+呼叫的地方接下來算的offset才會跟真的執行時一樣。
+*/
+void plan_record(setStreamv2 *s, int width){
+    int t = omp_get_thread_num();
+    plan_step *p = plan_rec;
+    int nfd = inner_loop_width();
+    int n = p->num_call[t];
+    plan_call *c = n ? &p->call[t][n-1] : NULL;
+
+    // 跟上一次同樣的fd，每個fd_off都往後同樣的距離 -> 併進上一次
+    int merge = c && c->width == width && c->nfd == nfd;
+    ull d = 0;
+    for (int k = 0; merge && k < nfd; k++){
+        ull last = c->fd_off[k] + (c->reps-1)*c->stride;
+        if(k == 0)
+            d = s->fd_off[0] - last;
+        merge = c->fd[k] == s->fd[k] && s->fd_off[k] - last == d;
+    }
+    if(merge && (c->reps == 1 || c->stride == d)){
+        c->stride = d;
+        c->reps++;
+    }
+    else{
+        if((n & (n-1)) == 0)
+            p->call[t] = (plan_call *)realloc(p->call[t], (n ? 2*n : 1)*sizeof(plan_call));
+        c = &p->call[t][n];
+        c->width = width;
+        c->nfd = nfd;
+        for (int k = 0; k < nfd; k++){
+            c->fd[k] = s->fd[k];
+            c->fd_off[k] = s->fd_off[k];
+        }
+        c->reps = 1;
+        c->stride = 0;
+        p->num_call[t]++;
+    }
+
+    thread_advance(s, width);
+}
+
+static int plannable(gate *g){
+    switch(g->gate_ops){
+        case 0: case 1: case 2: case 3:
+        case 4: case 5: case 6: case 7:
+        case 8: case 9: case 10: case 11: case 12:
+        case 13: case 31: case 32:
+        case DENSITY_SUPEROP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static plan_step *new_step(int kind, gate *g, int num){
+    plan_step *p = &steps[num_step++];
+    memset(p, 0, sizeof(plan_step));
+    p->kind = kind;
+    p->g = g;
+    p->num = num;
+    p->real = g->real_matrix;
+    p->imag = g->imag_matrix;
+    return p;
+}
+
+/*
+(所有thread一起呼叫) 記錄一個gate: density=0 作用在 q(+N/2)，density=1 是density matrix的conj那一半
+跟 run_gate() 的呼叫方式相同
+*/
+static void record_gate(gate *g, int density){
+    int t = omp_get_thread_num();
+    int off = density ? 0 : N/2*IsDensity;
+
+    #pragma omp barrier
+    if(t == 0){
+        plan_rec = new_step(STEP_GATE, g, 1);
+        plan_rec->num_call = (int *)calloc(num_thread, sizeof(int));
+        plan_rec->call = (plan_call **)calloc(num_thread, sizeof(plan_call *));
+    }
+    #pragma omp barrier
+
+    switch(g->gate_ops){
+        case 0: case 1: case 2: case 3:
+        case 4: case 5: case 6: case 7:
+            single_gate(g->targs[0]+off, g->gate_ops, density);
+            break;
+        case 8: case 9: case 10: case 11: case 12:
+            control_gate(g->ctrls[0]+off, g->targs[0]+off, g->gate_ops, density);
+            break;
+        case 13:
+            SWAP(g->targs[0]+off, g->targs[1]+off, density);
+            break;
+        case 31:
+            unitary4x4(g->targs[0]+off, g->targs[1]+off, density);
+            break;
+        case 32:
+            unitary8x8(g->targs[0]+off, g->targs[1]+off, g->targs[2]+off, density);
+            break;
+        case DENSITY_SUPEROP:
+            unitary4x4(g->targs[0], g->targs[1], 0);
+            break;
+    }
+
+    #pragma omp barrier
+    if(t == 0){
+        plan_rec->ctx = shared_ctx;
+        plan_rec = NULL;
+    }
+}
+
+// 每條thread都只碰自己那段thread_state
+static int step_private(plan_step *p){
+    if(p->kind == STEP_MULTI)
+        return 1;
+    if(p->kind == STEP_CALL)
+        return 0;
+    for (int t = 0; t < num_thread; t++){
+        int fd = fd_arr[t/num_thread_per_file];
+        ull lo = (t%num_thread_per_file) * thread_size;
+        ull hi = lo + thread_size;
+        for (int i = 0; i < p->num_call[t]; i++){
+            plan_call *c = &p->call[t][i];
+            for (int k = 0; k < c->nfd; k++){
+                ull last = c->fd_off[k] + (c->reps-1)*c->stride;
+                if(c->fd[k] != fd || c->fd_off[k] < lo || last >= hi)
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void plan_build(){
+    if(!ExecPlan)
+        return;
+
+    steps = (plan_step *)malloc((2*total_gate+1) * sizeof(plan_step));
+    num_step = 0;
+
+    #pragma omp parallel num_threads(num_thread)
+    {
+        int t = omp_get_thread_num();
+        // resume: 從checkpoint的gate開始記錄
+        for (int i = resume_gate; i < total_gate; ){
+            gate *g = gateMap+i;
+            int kind;
+            int n = gate_run(g, total_gate-i, &kind);
+
+            if(kind == RUN_ONE && plannable(g)){
+                record_gate(g, 0);
+                if(IsDensity && g->gate_ops != DENSITY_SUPEROP)
+                    record_gate(g, 1);
+            }
+            else if(t == 0 && kind == RUN_MULTI){
+                plan_step *p = new_step(STEP_MULTI, g, n);
+                p->multi_ctx = (gate_ctx *)malloc(n * sizeof(gate_ctx));
+                for (int k = 0; k < n; k++){
+                    set_local_gate(g+k);
+                    p->multi_ctx[k] = shared_ctx;
+                }
+            }
+            else if(t == 0){
+                new_step(STEP_CALL, g, n);
+            }
+            i += n;
+        }
+    }
+
+    // run_gate() 最後已經有barrier，接在它後面的step不用再等
+    int num_sync = 0;
+    int prev_private = 1;
+    int gap = 0;
+    for (int i = 0; i < num_step; i++){
+        plan_step *p = &steps[i];
+        int priv = step_private(p);
+        int first = i == 0 || steps[i-1].g != p->g; // gate的第一個step (density matrix的conj那一半不算)
+        p->sync = (i > 0) && steps[i-1].kind != STEP_CALL && !(priv && prev_private);
+        p->ckpt = Checkpoint && first && (p->sync || i == 0 || ++gap >= CKPT_MAX_GAP);
+        if(p->ckpt){
+            p->sync = 0;
+            gap = 0;
+        }
+        prev_private = priv;
+        num_sync += p->sync + p->ckpt;
+    }
+    printf("[PLAN]: %u gates -> %d steps, %d barriers\n", total_gate, num_step, num_sync);
+}
+
+void plan_run(){
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        setStreamv2 *s = &thread_settings[t];
+
+        for (int i = 0; i < num_step; i++){
+            plan_step *p = &steps[i];
+            if(p->sync){
+                #pragma omp barrier
+            }
+            if(p->ckpt)
+                checkpoint_point(p->g - gateMap);
+
+            switch(p->kind){
+                case STEP_GATE:
+                    cur_ctx = &p->ctx;
+                    real = p->real;
+                    imag = p->imag;
+                    for (int j = 0; j < p->num_call[t]; j++){
+                        plan_call *c = &p->call[t][j];
+                        for (int k = 0; k < c->nfd; k++)
+                            s->fd[k] = c->fd[k];
+                        for (ull r = 0; r < c->reps; r++){
+                            for (int k = 0; k < c->nfd; k++)
+                                s->fd_off[k] = c->fd_off[k] + r*c->stride;
+                            thread_cx[c->width](s);
+                        }
+                    }
+                    break;
+
+                case STEP_MULTI:
+                    multi_gate(p->g, p->num, p->multi_ctx);
+                    break;
+
+                case STEP_CALL:
+                    cur_ctx = &shared_ctx;
+                    run_gate(p->g, p->num);
+                    break;
+            }
+        }
+        cur_ctx = &shared_ctx;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef PLAN_H_
+#define PLAN_H_
+
+/*===================================================================
+execution plan guide
+
+原本每個gate都要由thread 0設定共用變數 (gate_func, gate_move, _outer, fd_pair...)，
+前後各一個barrier，gate很多、chunk很小的時候barrier跟setup的時間比gate本身還多。
+
+ini設定 exec_plan=1 (default) 時，讀完circuit後 plan_build() 先把每個gate走過一次:
+single_gate/control_gate/unitary4x4/SWAP/unitary8x8 照常設定，
+但 _thread_CX* 只把每條thread要做的 (fd, fd_off) 記下來不讀寫state (plan_record)，
+再把設定好的 gate_ctx 複製一份，整個circuit變成一個不會再改的step陣列。
+執行時每條thread自己照著step走，把 cur_ctx 指到step的context，不需要thread 0。
+
+barrier只放在有相依性的地方:
+每條thread只碰自己那段thread_state的step (gate的qubit都是middle/local，multi_gate)
+接在同樣的step後面時不用barrier；碰到別的thread那段的step (global/thread qubit) 前後都要。
+measure, copy, qubit swap, diag_fusion等其他step照原本的 run_gate() 執行。
+===================================================================*/
+
+struct plan_step;
+extern struct plan_step *plan_rec; // 記錄中的step，NULL表示正常執行
+
+void plan_record(setStreamv2 *s, int width);
+void plan_build();
+void plan_run();
+
+#endif
@@ -0,0 +1,45 @@
+#! /bin/bash
+
+# per-gate dispatch overhead: exec_plan=0 (thread 0 setup + barriers every gate) vs exec_plan=1
+# usage: ./plan_bench.sh [gates] [total_qbit] [io_engine]
+G=${1:-20000}
+N=${2:-16}
+ENGINE=${3:-3}
+DIR=./plan_bench
+mkdir -p $DIR/state
+
+# 便宜的gate (H, X, T, 相鄰qubit的CX)，隨機放在所有qubit上
+awk -v G=$G -v N=$N 'BEGIN{
+    srand(1);
+    op[0] = 0; op[1] = 3; op[2] = 2;
+    print G;
+    for (i = 0; i < G; i++){
+        q = int(rand()*N);
+        if (i%4 == 3)
+            print "8 1 1 0", (q+1)%N, q;
+        else
+            print op[int(rand()*3)], "0 1 0", q;
+    }
+}' > $DIR/circuit.txt
+
+for P in 0 1
+do
+    cat > $DIR/bench.ini << EOF
+[system]
+total_qbit=$N
+global_qbit=1
+thread_qbit=3
+local_qbit=10
+max_qbit=38
+max_path=260
+max_depth=$((G+1))
+is_density=0
+set_of_save_state=2
+state_paths=$DIR/state/path1,$DIR/state/path2,$DIR/state/path3,$DIR/state/path4
+io_engine=$ENGINE
+mem_dump=0
+exec_plan=$P
+EOF
+    ./qSim.out -i $DIR/bench.ini -c $DIR/circuit.txt | grep "Total:" | \
+        awk -v P=$P -v G=$G '{printf "exec_plan=%d: %d gates, %d us, %.2f us/gate\n", P, G, $2, $2/G}'
+done
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "gate.h"
+#include "init.h"
+#include "remap.h"
+
+static int *perm;   // perm[logical qubit] = physical qubit
+static int *inv;    // inv[physical qubit] = logical qubit
+static int *cnt;    // cnt[logical qubit]: 在window內被用到幾次
+
+static gate *out;
+static unsigned int out_num;
+static unsigned int out_cap;
+static int num_swap;
+
+// 會走gate.c的一般gate才需要搬進local
+static int remappable(gate *g){
+    switch(g->gate_ops){
+        case 0: case 1: case 2: case 3:
+        case 4: case 5: case 6: case 7:
+        case 8: case 9: case 10: case 11: case 12:
+        case 13: case 31: case 32:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int qubits_of(gate *g, int *q){
+    int n = 0;
+    if(!remappable(g))
+        return 0;
+    for (int j = 0; j < g->numCtrls; j++)
+        q[n++] = g->ctrls[j];
+    for (int j = 0; j < g->numTargs; j++)
+        q[n++] = g->targs[j];
+    return n;
+}
+
+static int has_qubit(int *q, int n, int x){
+    for (int j = 0; j < n; j++)
+        if(q[j] == x)
+            return 1;
+    return 0;
+}
+
+static void window_update(int i, int d){
+    int q[6];
+    if(i >= total_gate)
+        return;
+    int n = qubits_of(gateMap+i, q);
+    for (int j = 0; j < n; j++)
+        cnt[q[j]] += d;
+}
+
+static int next_use(int x, int from, int to){
+    int q[6];
+    for (int i = from; i < to; i++){
+        int n = qubits_of(gateMap+i, q);
+        if(has_qubit(q, n, x))
+            return i;
+    }
+    return to;
+}
+
+static void push(gate *g){
+    if(out_num == out_cap){
+        out_cap *= 2;
+        out = (gate *)realloc(out, out_cap*sizeof(gate));
+    }
+    out[out_num++] = *g;
+}
+
+// 產生一個op 23並更新perm/inv，a[k], b[k]是physical qubit
+static void emit_swap(int k, int *a, int *b){
+    gate g;
+    memset(&g, 0, sizeof(gate));
+    g.action = 1;
+    g.gate_ops = 23;
+    g.numCtrls = k;
+    g.numTargs = k;
+    for (int j = 0; j < k; j++){
+        g.ctrls[j] = a[j];
+        g.targs[j] = b[j];
+        int la = inv[a[j]];
+        int lb = inv[b[j]];
+        perm[la] = b[j];    perm[lb] = a[j];
+        inv[a[j]] = lb;     inv[b[j]] = la;
+    }
+    push(&g);
+    num_swap++;
+}
+
+// 換回 perm[q] == q
+static void restore(){
+    int *used = (int *)malloc(N*sizeof(int));
+    while(1){
+        int a[3], b[3], k = 0;
+        memset(used, 0, N*sizeof(int));
+        for (int p = 0; p < N && k < 3; p++){
+            int q = perm[p];
+            if(q == p || used[p] || used[q])
+                continue;
+            a[k] = p;   b[k] = q;
+            used[p] = used[q] = 1;
+            k++;
+        }
+        if(!k)
+            break;
+        emit_swap(k, a, b);
+    }
+    free(used);
+}
+
+/*
+在gate i之前決定要不要插入op 23。
+1. gate i用到的non-local qubit，如果在window內還會用到 (cnt >= 2) 就換進來
+2. 還有空位的話，window內其他常用的non-local qubit一起換進來
+3. 換出去的local qubit選window內用得最少、下次用到最晚的，
+   而且要比換進來的qubit少用才換
+*/
+static void bring_local(int i, int end){
+    int q[6], r[6];
+    int n = qubits_of(gateMap+i, q);
+    int in[3], k = 0;
+
+    for (int j = 0; j < n && k < 3; j++){
+        if(!isLocal(perm[q[j]]) && cnt[q[j]] >= 2 && !has_qubit(in, k, q[j]))
+            in[k++] = q[j];
+    }
+    if(!k)
+        return;
+    for (int l = i+1; l < end && k < 3; l++){
+        int m = qubits_of(gateMap+l, r);
+        for (int j = 0; j < m && k < 3; j++){
+            if(!isLocal(perm[r[j]]) && cnt[r[j]] >= 2 && !has_qubit(in, k, r[j]))
+                in[k++] = r[j];
+        }
+    }
+
+    int a[3], b[3], num = 0;
+    for (int j = 0; j < k; j++){
+        int best = -1, best_cnt = 0, best_next = 0;
+        for (int p = N-chunk_segment; p < N; p++){
+            int v = inv[p];
+            if(has_qubit(q, n, v) || has_qubit(b, num, p))
+                continue;
+            int nx = next_use(v, i, end);
+            if(best < 0 || cnt[v] < best_cnt || (cnt[v] == best_cnt && nx > best_next)){
+                best = p;   best_cnt = cnt[v];  best_next = nx;
+            }
+        }
+        if(best < 0 || best_cnt >= cnt[in[j]])
+            continue;
+        a[num] = perm[in[j]];
+        b[num] = best;
+        num++;
+    }
+    if(num)
+        emit_swap(num, a, b);
+}
+
+static void relabel(gate *g){
+    switch(g->gate_ops){
+        case 20:
+            g->targs[0] = perm[g->targs[0]];
+            return;
+        case 21:
+            for (int q = 0; q < g->val_num; q++)
+                g->imag_matrix[q] = perm[(int)(g->imag_matrix[q])];
+            return;
+        case 22: case 26:
+            return;
+    }
+    for (int j = 0; j < g->numCtrls; j++)
+        g->ctrls[j] = perm[g->ctrls[j]];
+    for (int j = 0; j < g->numTargs; j++)
+        g->targs[j] = perm[g->targs[j]];
+
+    if(g->gate_ops == 13 && g->targs[0] > g->targs[1]){
+        int tmp = g->targs[0];
+        g->targs[0] = g->targs[1];
+        g->targs[1] = tmp;
+    }
+    if(g->gate_ops == 31)
+        rotate_axis_4x4(g, g->targs[0], g->targs[1]);
+    if(g->gate_ops == 32)
+        rotate_axis_8x8(g, g->targs[0], g->targs[1], g->targs[2]);
+}
+
+void remap_circuit(){
+    if(!Remap)
+        return;
+    if(IsDensity){
+        printf("[REMAP]: density matrix is not supported, skip.\n");
+        return;
+    }
+
+    perm = (int *)malloc(N*sizeof(int));
+    inv = (int *)malloc(N*sizeof(int));
+    cnt = (int *)calloc(N, sizeof(int));
+    for (int q = 0; q < N; q++)
+        perm[q] = inv[q] = q;
+    out_cap = total_gate + 16;
+    out = (gate *)malloc(out_cap*sizeof(gate));
+    out_num = 0;
+    num_swap = 0;
+
+    for (int i = 0; i < RemapWindow; i++)
+        window_update(i, 1);
+
+    for (int i = 0; i < total_gate; i++){
+        gate g = gateMap[i];
+        int end = (i+RemapWindow < total_gate) ? i+RemapWindow : total_gate;
+
+        if(g.gate_ops == 22 || g.gate_ops == 26)
+            restore();
+        else if(remappable(&g))
+            bring_local(i, end);
+
+        relabel(&g);
+        push(&g);
+
+        window_update(i, -1);
+        window_update(i+RemapWindow, 1);
+    }
+    restore();
+
+    printf("[REMAP]: %u gates -> %u gates (%d swap passes)\n", total_gate, out_num, num_swap);
+    free(gateMap);
+    gateMap = out;
+    total_gate = out_num;
+    free(perm);
+    free(inv);
+    free(cnt);
+}
@@ -0,0 +1,19 @@
+#ifndef REMAP_H_
+#define REMAP_H_
+
+/*===================================================================
+remap guide
+
+在ini的[system]設定 remap=1 之後，讀進circuit時會先跑一次remap pass:
+往後看 remap_window 個gate，把常用的global/thread/middle qubit
+跟local qubit互換 (op 23, 一次pass最多換三對)，並把後面的gate
+改成作用在交換後的位置上。這樣大部分的gate都會走單一chunk的inner_loop，
+也不會有一半的thread閒置。
+
+circuit結束 (以及op 22複製state) 之前會再換回原本的順序，
+所以存下來的state跟沒有remap時相同。density matrix模式下不啟用。
+===================================================================*/
+
+void remap_circuit();
+
+#endif
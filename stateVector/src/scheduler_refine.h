@@ -0,0 +1,28 @@
+#ifndef SCHEDULER_REFINE_H_
+#define SCHEDULER_REFINE_H_
+
+#include "common.h"
+#include "gate.h"
+
+/*===================================================================
+gate fusion guide
+
+在ini的[system]設定 fusion=1 之後，讀進circuit時 (remap之前) 會先跑一次fusion pass:
+依序把相鄰的1, 2, 3 qubit gate合併成一個最多 fusion_max_qubit 個qubit的gate，
+合併後是1個qubit就變成U1 (op 7)，2個變成op 31，3個變成op 32，
+targs由小到大排列，matrix以double計算。只有一個gate的組保持原本的gate。
+每少一個gate就少走一次state file。
+
+gate G作用在qubit集合S上，S裡每個qubit最後一個所在的組中最晚的那一組為B，
+B跟S的qubit合起來不超過 fusion_max_qubit 個時G併進B，否則G自己成為新的一組。
+B之後的組都不會碰到S，所以把G往前移到B的位置結果不變。
+measure/copy/qubit swap等其他op是所有qubit的分界，不會跨過去合併。
+density matrix模式下合併出來的U1會再由density_lower換成一次pass的superoperator (density.h)。
+===================================================================*/
+
+void circuit_scheduler();
+
+// gate (op 0-13, 31, 32) 的matrix，作用在q[0..n-1] (row-maj, q[0]是最高位)，回傳n
+int gate_matrix(gate *g, int *q, double *re, double *im);
+
+#endif
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "io_engine.h"
+#include "checkpoint.h"
+#include "zchunk.h"
+
+unsigned char *zchunk;
+ull zchunk_skipped;
+int *zchunk_fd;     // file engine: fd -> set*num_file + f
+
+/*
+set_state_files之前呼叫。
+全新的state (或resume時重建的state file) 一開始全是0，寫入第一個chunk時會更新；
+skip_init_state讀入的state當作非0。
+*/
+void zchunk_init(){
+    if(!ZeroChunk)
+        return;
+    ull num = SetOfSaveState * num_file * (file_size / chunk_size);
+    zchunk = (unsigned char *)malloc(num);
+    memset(zchunk, !SkipInithread_state || ckpt_restore, num);
+    printf("[ZERO]: zero chunk elision, %llu chunks\n", num);
+}
+
+/*
+file engine開完state file之後呼叫: 記下每個fd是第幾個file
+*/
+void zchunk_bind(){
+    if(!zchunk || IoEngine == IO_MEM || IoEngine == IO_STRIPE)
+        return;
+    int max_fd = 0;
+    for (int i = 0; i < SetOfSaveState*num_file; i++)
+        if(fd_arr_set[i/num_file][i%num_file] > max_fd)
+            max_fd = fd_arr_set[i/num_file][i%num_file];
+    zchunk_fd = (int *)malloc((max_fd + 1) * sizeof(int));
+    for (int i = 0; i < SetOfSaveState*num_file; i++)
+        zchunk_fd[fd_arr_set[i/num_file][i%num_file]] = i;
+}
+
+int chunk_is_zero(void *p){
+    const unsigned long long *w = (const unsigned long long *)p;
+    for (ull i = 0; i < chunk_size / sizeof(*w); i++)
+        if(w[i])
+            return 0;
+    return 1;
+}
+
+void zchunk_report(){
+    if(!zchunk)
+        return;
+    ull num = SetOfSaveState * num_file * (file_size / chunk_size);
+    ull zero = 0;
+    for (ull i = 0; i < num; i++)
+        zero += zchunk[i];
+    printf("[ZERO]: %llu/%llu chunks are zero, %llu chunk groups skipped\n", zero, num, zchunk_skipped);
+}
@@ -0,0 +1,48 @@
+#ifndef ZCHUNK_H_
+#define ZCHUNK_H_
+
+#include "common.h"
+
+/*===================================================================
+zero chunk guide
+
+在ini的[system]設定 zero_chunk=1 時，每個chunk (每一組set_of_save_state) 有一個byte記錄是不是全部為0:
+    zchunk[id] = 1   chunk內全是0，file裡這段是hole (或寫入的0)
+    zchunk[id] = 0   不知道/不是0
+
+讀的時候全0的chunk直接memset，不碰disk；
+寫的時候先檢查buffer，變成全0的chunk用 fallocate(PUNCH_HOLE) 在file上挖洞 (不支援時照常寫入0)，
+本來就是0的不用寫。所以state file的內容永遠正確，zchunk只是加速用。
+
+所有gate都是線性的 (0 -> 0)，一組要一起算的chunk (inner_loop2/4/8的2/4/8個) 全部是0時，
+read, gate_func, write都跳過；只讀不寫的loop (measure的機率等) 仍然照常呼叫gate_func。
+BV、GHZ、QFT前段這類只有少數state不為0的circuit，I/O量與state file實際佔用的空間都會減少。
+
+state一開始 (|0...0>) 除了第一個chunk都是0，所以state file用ftruncate建成sparse file，不用整個寫一次0；
+skip_init_state讀入之前的state時不知道哪些是0，全部當作非0，寫回時才會更新。
+===================================================================*/
+
+extern unsigned char *zchunk;       // NULL: zero_chunk=0
+extern ull zchunk_skipped;          // 跳過的chunk group數量
+
+void zchunk_init();
+void zchunk_bind();
+void zchunk_report();
+int chunk_is_zero(void *p);
+
+// fd: file engine是state file的fd，memory/stripe engine是 set*num_file + f
+extern int *zchunk_fd;
+static inline ull zchunk_id(int fd, ull off){
+    ull f = zchunk_fd ? zchunk_fd[fd] : fd;
+    return f * (file_size / chunk_size) + off / chunk_size;
+}
+
+static inline int zchunk_zero(int fd, ull off){
+    return zchunk[zchunk_id(fd, off)];
+}
+
+static inline void zchunk_set(int fd, ull off, int zero){
+    zchunk[zchunk_id(fd, off)] = zero;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#! /bin/bash
+
+# sparse circuit (GHZ + T layers, only 2 non-zero states): zero_chunk=0 vs 1
+# usage: ./zero_bench.sh [layers] [total_qbit] [io_engine]
+L=${1:-4}
+N=${2:-22}
+ENGINE=${3:-0}
+DIR=./zero_bench
+mkdir -p $DIR/state
+
+awk -v L=$L -v N=$N 'BEGIN{
+    print N + L*N;
+    print "0 0 1 0", 0;
+    for (q = 1; q < N; q++)
+        print "8 1 1 0", q-1, q;
+    for (l = 0; l < L; l++)
+        for (q = 0; q < N; q++)
+            print "2 0 1 0", q;
+}' > $DIR/circuit.txt
+
+for Z in 0 1
+do
+    cat > $DIR/bench.ini << EOF
+[system]
+total_qbit=$N
+global_qbit=1
+thread_qbit=3
+local_qbit=12
+max_qbit=38
+max_path=260
+max_depth=$((L*N+N+1))
+is_density=0
+set_of_save_state=1
+state_paths=$DIR/state/path1,$DIR/state/path2
+io_engine=$ENGINE
+mem_dump=0
+zero_chunk=$Z
+EOF
+    rm -f $DIR/state/*
+    T=$(./qSim.out -i $DIR/bench.ini -c $DIR/circuit.txt | grep "Total:" | awk '{print $2}')
+    D=$(du -k -c $DIR/state/* 2>/dev/null | tail -1 | awk '{print $1}')
+    echo "zero_chunk=$Z: $((L*N+N)) gates, $(awk -v t=$T 'BEGIN{printf "%.2f", t/1e6}') s, state files use ${D:-0} KB on disk"
+done